@@ -0,0 +1,566 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include "violajones.h"
+#include "greyframe.h"
+#include "frameio.h"
+
+//! Accuracy vs speed regression harness
+//! Runs detection engines over an annotated image set and reports, per engine, recall, precision
+//! and mean IoU against the annotations, agreement with stored golden detections of the reference
+//! engine, and time per image, so a speed change can be judged on both axes in one command.
+//!
+//!   accuracy [--wider file | --fddb file] [--images dir] [--synthetic n] [--size WxH] [--seed s]
+//!            [--engines detect,scan,budget:20] [--iou t] [--min-face px] [--runs n]
+//!            [--golden file [--max-drift f]] [--write-golden file]
+//!
+//! Annotations are WIDER FACE style (image path, face count, "x y w h ..." per face) or FDDB
+//! style (image path, face count, "major minor angle cx cy 1" ellipse per face, taken as its
+//! bounding box). Only PGM/PPM images are decoded: a path whose image is missing is retried with
+//! .ppm and .pgm extensions (convert with e.g. mogrify -format ppm). Without annotations a
+//! synthetic set is generated, with faces of random position and size and some empty frames.
+//!
+//! Regression check of the reference engine against bench/golden/synthetic.txt:
+//!   accuracy --engines detect --golden bench/golden/synthetic.txt --max-drift 0
+
+const unsigned int SYNTH_IMAGES = 40;       // Default synthetic set size
+const unsigned int SYNTH_EMPTY = 8;         // Every n-th synthetic image has no face
+const double SYNTH_MIN_FACE = 0.55;         // Synthetic face size range (fraction of frame height)
+const double SYNTH_MAX_FACE = 0.8;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Sample
+{
+    std::string name;           // Image path (annotated) or id (synthetic)
+    Image image;
+    std::vector<Rect> faces;    // Ground truth
+};
+
+struct Options
+{
+    std::string wider;
+    std::string fddb;
+    std::string images;         // Image root of the annotation paths
+    unsigned int nSynthetic;
+    int synthW;
+    int synthH;
+    unsigned int seed;
+    std::vector<std::string> engines;
+    double iou;                 // Minimum IoU of a true positive
+    int minFace;                // Ground truth faces narrower are ignored
+    unsigned int runs;          // Timed runs per image (median kept)
+    std::string golden;
+    double maxDrift;            // Fraction of images allowed to differ from golden
+    std::string writeGolden;
+};
+
+struct Score
+{
+    std::string engine;
+    unsigned int images;
+    unsigned int faces;         // Ground truth faces (not ignored)
+    unsigned int detections;    // Detections not matching ignored faces
+    unsigned int truePos;
+    double sumIoU;              // Over true positives
+    unsigned int compared;      // Images with a golden detection
+    unsigned int exact;         // Images where the detection equals the golden one
+    unsigned int drift;         // Images where they differ
+    double sumGoldenIoU;        // Over images where both found a face
+    unsigned int bothFound;
+    double ms;                  // Mean time per image
+    double p90;
+};
+
+// Split comma separated list
+std::vector<std::string> splitList(const std::string& str)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start<=str.size())
+    {
+        size_t end = str.find(',', start);
+        if(end==std::string::npos)
+            end = str.size();
+        if(end>start)
+            items.push_back(str.substr(start, end-start));
+        start = end+1;
+    }
+    return items;
+}
+
+double intersectionOverUnion(Rect a, Rect b)
+{
+    int x0 = std::max(a.getX(), b.getX());
+    int y0 = std::max(a.getY(), b.getY());
+    int x1 = std::min(a.getX()+a.getWidth(), b.getX()+b.getWidth());
+    int y1 = std::min(a.getY()+a.getHeight(), b.getY()+b.getHeight());
+    if(x1<=x0 || y1<=y0)
+        return 0;
+
+    double inter = (double)(x1-x0)*(y1-y0);
+    return inter/(a.area() + b.area() - inter);
+}
+
+bool found(Rect r)
+{
+    return r.getWidth()>0 && r.getHeight()>0;
+}
+
+// ***************************************************************
+// ** IMAGE SETS
+// ***************************************************************
+
+// Load image, retrying with PNM extensions (annotation sets list JPEG files)
+bool loadImage(const std::string& path, Image& im)
+{
+    if(loadPNM(path, im))
+        return true;
+
+    size_t dot = path.rfind('.');
+    std::string base = (dot==std::string::npos || dot<path.rfind('/')+1) ? path : path.substr(0, dot);
+    return loadPNM(base + ".ppm", im) || loadPNM(base + ".pgm", im) ||
+           loadPNM(path + ".ppm", im) || loadPNM(path + ".pgm", im);
+}
+
+/** loadAnnotations
+  * Read WIDER FACE or FDDB style annotations and their images
+  * file: annotation file
+  * root: image root directory
+  * fddb: ellipse (FDDB) instead of rectangle (WIDER) faces
+  * samples: loaded images with their faces
+  * Return false if the file cannot be read. Images that cannot be loaded are reported and skipped
+  **/
+bool loadAnnotations(const std::string& file, const std::string& root, bool fddb, std::vector<Sample>& samples)
+{
+    FILE* f = fopen(file.c_str(), "r");
+    if(!f)
+        return false;
+
+    char line[4096];
+    while(fgets(line, sizeof(line), f))
+    {
+        std::string name = line;
+        name.erase(name.find_last_not_of(" \r\n\t")+1);
+        if(name.empty())
+            continue;
+
+        int nFaces = 0;
+        if(!fgets(line, sizeof(line), f) || sscanf(line, "%d", &nFaces)!=1)
+            break;
+
+        Sample sample;
+        sample.name = name;
+        // WIDER lists a dummy face line for images without faces
+        if(nFaces==0 && !fddb && !fgets(line, sizeof(line), f))
+            break;
+
+        for(int i=0; i<nFaces && fgets(line, sizeof(line), f); ++i)
+        {
+            double v[5];
+            if(fddb && sscanf(line, "%lf %lf %lf %lf %lf", &v[0], &v[1], &v[2], &v[3], &v[4])==5)
+            {
+                // Bounding box of the rotated ellipse (major/minor semi-axes, angle, center)
+                double hw = sqrt(pow(v[0]*sin(v[2]), 2) + pow(v[1]*cos(v[2]), 2));
+                double hh = sqrt(pow(v[0]*cos(v[2]), 2) + pow(v[1]*sin(v[2]), 2));
+                sample.faces.push_back(Rect(v[3]-hw, v[4]-hh, 2*hw, 2*hh));
+            }
+            else if(!fddb && sscanf(line, "%lf %lf %lf %lf", &v[0], &v[1], &v[2], &v[3])==4)
+                sample.faces.push_back(Rect(v[0], v[1], v[2], v[3]));
+        }
+
+        std::string path = root.empty() ? name : root + "/" + name;
+        if(!loadImage(path, sample.image))
+        {
+            fprintf(stderr, "accuracy: cannot read %s, skipped\n", path.c_str());
+            continue;
+        }
+        samples.push_back(sample);
+    }
+
+    fclose(f);
+    return true;
+}
+
+/** synthesizeSet
+  * Synthetic set: one face per image, random size and position, every SYNTH_EMPTY-th image empty
+  * Faces are annotated by their face box (the oval is a bit taller)
+  **/
+void synthesizeSet(unsigned int n, int w, int h, unsigned int seed, std::vector<Sample>& samples)
+{
+    for(unsigned int i=0; i<n; ++i)
+    {
+        Sample sample;
+        char name[32];
+        snprintf(name, sizeof(name), "synthetic_%03u", i);
+        sample.name = name;
+
+        seed = seed*1664525u + 1013904223u;
+        double r0 = (seed>>8)/16777216.0;
+        seed = seed*1664525u + 1013904223u;
+        double r1 = (seed>>8)/16777216.0;
+        seed = seed*1664525u + 1013904223u;
+        double r2 = (seed>>8)/16777216.0;
+
+        // Empty image: face drawn off frame
+        if(i%SYNTH_EMPTY==SYNTH_EMPTY-1)
+            synthesizeFace(w, h, -w, -h, 1, seed, sample.image);
+        else
+        {
+            int size = static_cast<int>(h*(SYNTH_MIN_FACE + (SYNTH_MAX_FACE-SYNTH_MIN_FACE)*r0));
+            int x = static_cast<int>((w-size)*r1);
+            int y = static_cast<int>((h-size)*r2);
+            synthesizeFace(w, h, x, y, size, seed, sample.image);
+            sample.faces.push_back(Rect(x, y, size, size));
+        }
+        samples.push_back(sample);
+    }
+}
+
+// ***************************************************************
+// ** ENGINES
+// ***************************************************************
+
+// Detection of one image (grey planes) by an engine (fresh detector state for every image)
+typedef std::function<Rect(ViolaJones&, GreyFrame&)> Engine;
+
+/** makeEngine
+  * Engine by name:
+  *   detect       whole frame detection (reference)
+  *   scan         per-scale scan and selection, as spread over threads by facedetect and the service
+  *   budget:MS    budgeted detection with MS milliseconds and no prior
+  * Return false if the name is unknown
+  **/
+bool makeEngine(const std::string& name, Engine& engine)
+{
+    unsigned short rect[4];
+
+    if(name=="detect")
+        engine = [rect](ViolaJones& vj, GreyFrame& grey) mutable { return vj.detect(grey, rect); };
+    else if(name=="scan")
+    {
+        engine = [](ViolaJones& vj, GreyFrame& grey){
+            int w = vj.getW();
+            int h = vj.getH();
+            std::vector<float> intIm(w*h);
+            std::vector<float> sqIntIm(w*h);
+            vj.integrate(grey, &intIm[0], &sqIntIm[0]);
+            Frame frame(&intIm[0], &sqIntIm[0], w, h);
+
+            std::vector<std::pair<Rect,double> > positives;
+            for(unsigned int sc=0; sc<vj.getScales(); ++sc)
+                positives.push_back(vj.scan(frame, sc));
+            return vj.select(positives);
+        };
+    }
+    else if(name.compare(0, 7, "budget:")==0 && atof(name.c_str()+7)>0)
+    {
+        double budget = atof(name.c_str()+7);
+        engine = [rect, budget](ViolaJones& vj, GreyFrame& grey) mutable {
+            bool complete;
+            return vj.detect(grey, rect, budget, complete);
+        };
+    }
+    else
+        return false;
+
+    return true;
+}
+
+// ***************************************************************
+// ** GOLDEN DETECTIONS
+// ***************************************************************
+
+// Golden file: "# comment" lines, then "name x y w h" per image (0 0 0 0: no face)
+bool readGolden(const std::string& file, std::map<std::string, Rect>& golden)
+{
+    FILE* f = fopen(file.c_str(), "r");
+    if(!f)
+        return false;
+
+    char line[4096];
+    char name[4096];
+    while(fgets(line, sizeof(line), f))
+    {
+        int x, y, w, h;
+        if(line[0]!='#' && sscanf(line, "%4095s %d %d %d %d", name, &x, &y, &w, &h)==5)
+            golden[name] = Rect(x, y, w, h);
+    }
+
+    fclose(f);
+    return true;
+}
+
+bool writeGolden(const std::string& file, const std::string& set, const std::string& engine,
+                 const std::vector<Sample>& samples, std::vector<Rect>& detections)
+{
+    FILE* f = fopen(file.c_str(), "w");
+    if(!f)
+        return false;
+
+    fprintf(f, "# Golden detections of engine %s on %s\n", engine.c_str(), set.c_str());
+    fprintf(f, "# name x y w h (0 0 0 0: no face)\n");
+    for(unsigned int i=0; i<samples.size(); ++i)
+        fprintf(f, "%s %d %d %d %d\n", samples[i].name.c_str(), detections[i].getX(), detections[i].getY(),
+                detections[i].getWidth(), detections[i].getHeight());
+
+    fclose(f);
+    return true;
+}
+
+// ***************************************************************
+// ** EVALUATION
+// ***************************************************************
+
+/** evaluate
+  * Run an engine over the set and score it
+  * detections: per image detection (output)
+  **/
+Score evaluate(const std::string& name, Engine& engine, std::vector<Sample>& samples, const Options& opt,
+               const std::map<std::string, Rect>& golden, std::vector<Rect>& detections)
+{
+    Score s;
+    s.engine = name;
+    s.images = samples.size();
+    s.faces = s.detections = s.truePos = 0;
+    s.compared = s.exact = s.drift = s.bothFound = 0;
+    s.sumIoU = s.sumGoldenIoU = 0;
+
+    std::vector<double> times;
+    for(unsigned int i=0; i<samples.size(); ++i)
+    {
+        Sample& sample = samples[i];
+        unsigned char* image = &sample.image.data[0];
+
+        // Median of the timed runs, each on a fresh detector (no state carried between images)
+        std::vector<double> runs;
+        Rect det;
+        for(unsigned int r=0; r<opt.runs; ++r)
+        {
+            ViolaJones vj(sample.image.width, sample.image.height);
+            GreyFrame grey(sample.image.width, sample.image.height);
+            Clock::time_point start = Clock::now();
+            grey.update(image);
+            det = engine(vj, grey);
+            runs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        std::sort(runs.begin(), runs.end());
+        times.push_back(runs[runs.size()/2]);
+        detections.push_back(det);
+
+        // Match against ground truth: best IoU face, ignored faces neither count nor penalize
+        int best = -1;
+        double bestIoU = 0;
+        for(unsigned int f=0; f<sample.faces.size(); ++f)
+        {
+            bool ignored = sample.faces[f].getWidth()<opt.minFace;
+            if(!ignored)
+                s.faces++;
+
+            double iou = found(det) ? intersectionOverUnion(det, sample.faces[f]) : 0;
+            if(iou>=opt.iou && iou>bestIoU)
+            {
+                best = f;
+                bestIoU = iou;
+            }
+        }
+
+        if(found(det))
+        {
+            bool ignored = best>=0 && sample.faces[best].getWidth()<opt.minFace;
+            if(!ignored)
+                s.detections++;
+            if(best>=0 && !ignored)
+            {
+                s.truePos++;
+                s.sumIoU += bestIoU;
+            }
+        }
+
+        // Agreement with the golden detection
+        std::map<std::string, Rect>::const_iterator it = golden.find(sample.name);
+        if(it!=golden.end())
+        {
+            Rect ref = it->second;
+            s.compared++;
+            bool same = ref.getX()==det.getX() && ref.getY()==det.getY() &&
+                        ref.getWidth()==det.getWidth() && ref.getHeight()==det.getHeight();
+            if(same)
+                s.exact++;
+            else
+                s.drift++;
+
+            if(found(ref) && found(det))
+            {
+                s.bothFound++;
+                s.sumGoldenIoU += intersectionOverUnion(ref, det);
+            }
+        }
+    }
+
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    s.ms = 0;
+    for(unsigned int i=0; i<times.size(); ++i)
+        s.ms += times[i]/times.size();
+    s.p90 = sorted.empty() ? 0 : sorted[std::min(sorted.size()-1, (size_t)(0.9*sorted.size()))];
+
+    return s;
+}
+
+void printScore(const Score& s, bool hasGolden)
+{
+    char golden[64] = "-";
+    if(hasGolden && s.compared)
+        snprintf(golden, sizeof(golden), "%u/%u %.3f", s.exact, s.compared,
+                 s.bothFound ? s.sumGoldenIoU/s.bothFound : 0.0);
+
+    printf("%-12s %6u %6u %6u %7.3f %9.3f %8.3f  %-16s %8.2f %8.2f\n", s.engine.c_str(), s.images, s.faces,
+           s.detections, s.faces ? (double)s.truePos/s.faces : 0.0, s.detections ? (double)s.truePos/s.detections : 0.0,
+           s.truePos ? s.sumIoU/s.truePos : 0.0, golden, s.ms, s.p90);
+}
+
+// ***************************************************************
+// ** MAIN
+// ***************************************************************
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    opt.nSynthetic = SYNTH_IMAGES;
+    opt.synthW = 640;
+    opt.synthH = 480;
+    opt.seed = 1;
+    opt.iou = 0.5;
+    opt.minFace = 0;
+    opt.runs = 1;
+    opt.maxDrift = -1;
+    std::string engines = "detect,scan,budget:20";
+
+    for(int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasVal = i+1<argc;
+
+        if(arg=="--wider" && hasVal)
+            opt.wider = argv[++i];
+        else if(arg=="--fddb" && hasVal)
+            opt.fddb = argv[++i];
+        else if(arg=="--images" && hasVal)
+            opt.images = argv[++i];
+        else if(arg=="--synthetic" && hasVal)
+            opt.nSynthetic = atoi(argv[++i]);
+        else if(arg=="--size" && hasVal)
+            sscanf(argv[++i], "%dx%d", &opt.synthW, &opt.synthH);
+        else if(arg=="--seed" && hasVal)
+            opt.seed = atoi(argv[++i]);
+        else if(arg=="--engines" && hasVal)
+            engines = argv[++i];
+        else if(arg=="--iou" && hasVal)
+            opt.iou = atof(argv[++i]);
+        else if(arg=="--min-face" && hasVal)
+            opt.minFace = atoi(argv[++i]);
+        else if(arg=="--runs" && hasVal)
+            opt.runs = std::max(1, atoi(argv[++i]));
+        else if(arg=="--golden" && hasVal)
+            opt.golden = argv[++i];
+        else if(arg=="--max-drift" && hasVal)
+            opt.maxDrift = atof(argv[++i]);
+        else if(arg=="--write-golden" && hasVal)
+            opt.writeGolden = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: accuracy [--wider file | --fddb file] [--images dir] [--synthetic n] [--size WxH] [--seed s]\n"
+                            "                [--engines detect,scan,budget:20] [--iou t] [--min-face px] [--runs n]\n"
+                            "                [--golden file [--max-drift f]] [--write-golden file]\n");
+            return 1;
+        }
+    }
+    opt.engines = splitList(engines);
+
+    std::vector<Engine> engineFns(opt.engines.size());
+    for(unsigned int e=0; e<opt.engines.size(); ++e)
+    {
+        if(!makeEngine(opt.engines[e], engineFns[e]))
+        {
+            fprintf(stderr, "accuracy: unknown engine %s\n", opt.engines[e].c_str());
+            return 1;
+        }
+    }
+
+    // Image set
+    std::vector<Sample> samples;
+    std::string set;
+    if(!opt.wider.empty() || !opt.fddb.empty())
+    {
+        set = opt.wider.empty() ? opt.fddb : opt.wider;
+        if(!loadAnnotations(set, opt.images, opt.wider.empty(), samples))
+        {
+            fprintf(stderr, "accuracy: cannot read %s\n", set.c_str());
+            return 1;
+        }
+    }
+    else
+    {
+        char name[128];
+        snprintf(name, sizeof(name), "synthetic n=%u size=%dx%d seed=%u", opt.nSynthetic, opt.synthW, opt.synthH, opt.seed);
+        set = name;
+        synthesizeSet(opt.nSynthetic, opt.synthW, opt.synthH, opt.seed, samples);
+    }
+
+    if(samples.empty())
+    {
+        fprintf(stderr, "accuracy: empty image set\n");
+        return 1;
+    }
+
+    std::map<std::string, Rect> golden;
+    if(!opt.golden.empty() && !readGolden(opt.golden, golden))
+    {
+        fprintf(stderr, "accuracy: cannot read %s\n", opt.golden.c_str());
+        return 1;
+    }
+
+    printf("set: %s (%u images), IoU >= %.2f\n", set.c_str(), (unsigned int)samples.size(), opt.iou);
+    printf("%-12s %6s %6s %6s %7s %9s %8s  %-16s %8s %8s\n", "engine", "images", "faces", "dets", "recall",
+           "precision", "mean_iou", "golden(=,iou)", "ms", "p90_ms");
+
+    int status = 0;
+    for(unsigned int e=0; e<opt.engines.size(); ++e)
+    {
+        std::vector<Rect> detections;
+        Score s = evaluate(opt.engines[e], engineFns[e], samples, opt, golden, detections);
+        printScore(s, !golden.empty());
+        fflush(stdout);
+
+        // Golden detections are those of the first engine
+        if(e==0 && !opt.writeGolden.empty() && !writeGolden(opt.writeGolden, set, opt.engines[e], samples, detections))
+        {
+            fprintf(stderr, "accuracy: cannot write %s\n", opt.writeGolden.c_str());
+            return 1;
+        }
+
+        if(opt.maxDrift>=0 && s.compared && s.drift>opt.maxDrift*s.compared)
+        {
+            fprintf(stderr, "accuracy: %s differs from golden on %u of %u images\n", s.engine.c_str(), s.drift, s.compared);
+            status = 3;
+        }
+    }
+
+    if(!golden.empty())
+    {
+        unsigned int missing = 0;
+        for(unsigned int i=0; i<samples.size(); ++i)
+            missing += golden.find(samples[i].name)==golden.end();
+        if(missing)
+            printf("%u images without golden detection\n", missing);
+    }
+
+    return status;
+}
@@ -0,0 +1,268 @@
+// ***************************************************************
+// ** BBF parity check: ccv.js against the native port (Node)
+// ***************************************************************
+// Runs the unmodified ccv.js detector with the face.js cascade, as camface.js did, and the native
+// BBF detector (bin/native/facedetect -C, camface.js parameters) on the same frames, and checks
+// that both find the same objects (boxes, neighbors and confidence). ccv.js draws its pyramid on
+// canvases: here they are shimmed with the bilinear resampling of the native port (Resampler), so
+// any difference comes from the detector itself. The cascade goes through Camface.bbfCascadeData,
+// the serialization used in the browser.
+//
+//   node bench/bbf_parity.js [--size WxH] <frame|directory>...
+//
+// Frames are binary PGM/PPM or raw RGBA (.rgba/.raw, size given by --size).
+
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var vm = require('vm');
+var childProcess = require('child_process');
+
+var ROOT = path.join(__dirname, '..');
+var FACEDETECT = path.join(ROOT, 'bin', 'native', 'facedetect');
+var INTERVAL = 5;
+var MIN_NEIGHBORS = 1;
+var TOLERANCE = 1e-3;           // Native output is printed as float with 3 (boxes) or 6 decimals
+
+// ** ARGUMENTS
+// *******************************************
+
+function parseArgs(argv){
+	var args = {width: 0, height: 0, inputs: []};
+
+	for(var i=0;i<argv.length;i++){
+		var arg = argv[i];
+		if(arg == '--size'){
+			var size = argv[++i].split('x');
+			args.width = parseInt(size[0]);
+			args.height = parseInt(size[1]);
+		}
+		else args.inputs.push(arg);
+	}
+
+	if(args.inputs.length == 0){
+		console.error('Usage: node bench/bbf_parity.js [--size WxH] <frame|directory>...');
+		process.exit(1);
+	}
+	return args;
+}
+
+// ** FRAME LOADING
+// *******************************************
+
+// Decode binary PGM (P5) / PPM (P6) to RGBA
+function loadPNM(file){
+	var data = fs.readFileSync(file);
+	var tokens = [], pos = 2;
+
+	while(tokens.length < 3){
+		while(data[pos] == 35 || data[pos] <= 32){   // Comments and whitespace
+			if(data[pos] == 35) while(data[pos] != 10) pos++;
+			pos++;
+		}
+		var start = pos;
+		while(data[pos] > 32) pos++;
+		tokens.push(parseInt(data.toString('ascii', start, pos)));
+	}
+	pos++;
+
+	var nChn = (data[1] == 53) ? 1 : 3;
+	var frame = {width: tokens[0], height: tokens[1], data: new Uint8Array(4*tokens[0]*tokens[1])};
+	for(var i=0;i<frame.width*frame.height;i++){
+		frame.data[4*i]   = data[pos + nChn*i];
+		frame.data[4*i+1] = data[pos + nChn*i + (nChn-1)/2];
+		frame.data[4*i+2] = data[pos + nChn*i + nChn-1];
+		frame.data[4*i+3] = 255;
+	}
+	return frame;
+}
+
+function loadFrame(file, args){
+	var ext = path.extname(file).toLowerCase();
+	if(ext == '.rgba' || ext == '.raw')
+		return {width: args.width, height: args.height, data: new Uint8Array(fs.readFileSync(file))};
+	return loadPNM(file);
+}
+
+function listFrames(inputs){
+	var frames = [];
+	inputs.forEach(function(input){
+		if(fs.statSync(input).isDirectory()){
+			fs.readdirSync(input).sort().forEach(function(name){
+				if(/\.(pgm|ppm|pnm|rgba|raw)$/i.test(name)) frames.push(path.join(input, name));
+			});
+		}
+		else frames.push(input);
+	});
+	return frames;
+}
+
+// ** CANVAS SHIM
+// *******************************************
+
+// Taps of Resampler::computeTaps (BILINEAR): source index and 8 bit weight of every output
+function bilinearTaps(start, length, n, limit){
+	var step = length/n;
+	var taps = [];
+	for(var i=0;i<n;i++){
+		var center = start + (i+0.5)*step - 0.5;
+		var p = Math.floor(center), a = center - p;
+		var raw = [[p, 1-a], [p+1, a]];
+		var q = [Math.floor(raw[0][1]*256 + 0.5), Math.floor(raw[1][1]*256 + 0.5)];
+		q[raw[1][1] > raw[0][1] ? 1 : 0] += 256 - q[0] - q[1];
+
+		var out = [];
+		for(var k=0;k<2;k++)
+			if(q[k] != 0) out.push([Math.max(0, Math.min(raw[k][0], limit-1)), q[k]]);
+		taps.push(out);
+	}
+	return taps;
+}
+
+// 2d canvas holding RGBA pixels. drawImage resamples the red (grey) channel as Resampler::apply
+function Canvas(width, height){
+	this.width = width;
+	this.height = height;
+}
+
+Canvas.prototype.getContext = function(){
+	var canvas = this;
+	return {
+		getImageData: function(x, y, w, h){
+			return {width: w, height: h, data: new Uint8ClampedArray(canvas.pixels)};
+		},
+		putImageData: function(image, x, y){
+			canvas.pixels.set(image.data);
+		},
+		drawImage: function(src, sx, sy, sw, sh, dx, dy, dw, dh){
+			if(dw <= 0 || dh <= 0) return;
+			var hTaps = bilinearTaps(sx, Math.max(1, sw), dw, src.width);
+			var vTaps = bilinearTaps(sy, Math.max(1, sh), dh, src.height);
+
+			// Horizontal pass of every source row, then vertical pass (rounded, 16 bit shift)
+			var rows = {};
+			var row = function(r){
+				if(!(r in rows)){
+					var out = new Uint32Array(dw);
+					for(var i=0;i<dw;i++){
+						var acc = 0;
+						hTaps[i].forEach(function(t){ acc += src.pixels[4*(r*src.width + t[0])]*t[1]; });
+						out[i] = acc;
+					}
+					rows[r] = out;
+				}
+				return rows[r];
+			};
+			for(var j=0;j<dh;j++){
+				for(var i=0;i<dw;i++){
+					var acc = 1<<15;
+					vTaps[j].forEach(function(t){ acc += row(t[0])[i]*t[1]; });
+					var pix = 4*((dy + j)*canvas.width + dx + i);
+					canvas.pixels[pix] = canvas.pixels[pix+1] = canvas.pixels[pix+2] = acc >>> 16;
+					canvas.pixels[pix+3] = 255;
+				}
+			}
+		}
+	};
+};
+
+global.document = {
+	createElement: function(){ return new Canvas(0, 0); }
+};
+
+// Canvas width and height are set after creation: allocate (transparent black) pixels on first use
+Object.defineProperty(Canvas.prototype, 'pixels', {
+	get: function(){
+		if(!this._pixels || this._pixels.length != 4*this.width*this.height) this._pixels = new Uint8ClampedArray(4*this.width*this.height);
+		return this._pixels;
+	},
+	set: function(value){ this._pixels = value; }
+});
+
+// ** DETECTION
+// *******************************************
+
+function loadScript(file){
+	vm.runInThisContext(fs.readFileSync(path.join(ROOT, 'bin', 'js', file), 'utf8'), {filename: file});
+}
+
+function detectJS(frame){
+	var canvas = new Canvas(frame.width, frame.height);
+	canvas.pixels.set(frame.data);
+
+	var start = process.hrtime.bigint();
+	var objects = ccv.detect_objects({
+		"canvas" : ccv.grayscale(canvas),
+		"cascade" : cascade,
+		"interval" : INTERVAL,
+		"min_neighbors" : MIN_NEIGHBORS
+	});
+	var ms = Number(process.hrtime.bigint() - start)/1e6;
+
+	return {ms: ms, objects: objects.map(function(o){ return [o.x, o.y, o.width, o.height, o.neighbors, o.confidence]; })};
+}
+
+function detectNative(frames, args, cascadeFile){
+	var argv = ['-t', '1', '-C', cascadeFile];
+	if(args.width) argv.push('-s', args.width + 'x' + args.height);
+	var run = childProcess.spawnSync(FACEDETECT, argv.concat(frames), {encoding: 'utf8'});
+	if(run.status != 0){
+		console.error('bbf_parity: ' + FACEDETECT + ' failed (make -f ../makefile native)\n' + run.stderr);
+		process.exit(1);
+	}
+
+	var results = [];
+	run.stdout.trim().split('\n').forEach(function(line){
+		var result = JSON.parse(line);
+		results[result.frame] = {ms: result.detect_ms, objects: result.objects};
+	});
+	return results;
+}
+
+function same(a, b){
+	if(a.length != b.length) return false;
+	for(var i=0;i<a.length;i++){
+		for(var c=0;c<6;c++){
+			if(Math.abs(a[i][c] - b[i][c]) > TOLERANCE*Math.max(1, Math.abs(a[i][c]))) return false;
+		}
+	}
+	return true;
+}
+
+// ** MAIN
+// *******************************************
+
+function main(){
+	var args = parseArgs(process.argv.slice(2));
+	var frames = listFrames(args.inputs);
+
+	loadScript('ccv.js');
+	loadScript('face.js');
+	loadScript('camface.js');
+
+	var cascadeFile = path.join(os.tmpdir(), 'bbf_parity_' + process.pid + '.bbf');
+	fs.writeFileSync(cascadeFile, Camface.bbfCascadeData(cascade));
+	var native = detectNative(frames, args, cascadeFile);
+	fs.unlinkSync(cascadeFile);
+
+	var mismatches = 0, jsTotal = 0, nativeTotal = 0;
+	frames.forEach(function(file, f){
+		var js = detectJS(loadFrame(file, args));
+		var ok = same(js.objects, native[f].objects);
+		jsTotal += js.ms;
+		nativeTotal += native[f].ms;
+		if(!ok){
+			mismatches++;
+			console.log(file + ': MISMATCH');
+			console.log('  ccv.js: ' + JSON.stringify(js.objects));
+			console.log('  native: ' + JSON.stringify(native[f].objects));
+		}
+		else console.log(file + ': ' + js.objects.length + ' objects, ccv.js ' + js.ms.toFixed(1) + ' ms, native ' + native[f].ms.toFixed(1) + ' ms');
+	});
+
+	console.log((frames.length - mismatches) + '/' + frames.length + ' frames match; ccv.js ' + (jsTotal/frames.length).toFixed(1) +
+	            ' ms/frame (shimmed canvas), native ' + (nativeTotal/frames.length).toFixed(1) + ' ms/frame');
+	process.exit(mismatches ? 1 : 0);
+}
+
+main();
@@ -0,0 +1,399 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include "violajones.h"
+#include "greyframe.h"
+#include "frameio.h"
+#include "service.h"
+
+//! End-to-end detection benchmark
+//! Runs ViolaJones::detect and track over a frame sequence (Y4M video, raw RGBA dump or a
+//! synthetic moving face) resized to several resolutions, with detect-only, track-only and mixed
+//! schedules, on 1 to N threads (one independent stream per thread). Prints throughput and
+//! per-frame latency as a table, and optionally as CSV.
+//! The service schedule (not run by default) feeds --streams camera-like streams, each submitting
+//! a frame every 1/--fps s with a --deadline, to a DetectionService of 1 to N worker threads, and
+//! also prints the statistics of every stream (latency percentiles, dropped, expired and late).
+//!
+//!   e2ebench [--y4m file | --raw file --size WxH] [--frames n] [--threads n] [--csv file]
+//!            [--resolutions WxH,...] [--schedules detect,track,mixed,service]
+//!            [--streams n] [--fps n] [--deadline ms]
+//!
+//! A Y4M dump of the avatar video can be made with: ffmpeg -i avatarVideo.mp4 -pix_fmt yuv420p avatar.y4m
+
+const unsigned int MIXED_DETECT_PERIOD = 10;    // Mixed schedule: whole frame detection every n frames
+const unsigned int SYNTH_FRAMES = 60;           // Length of the synthetic sequence
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    std::string y4m;
+    std::string raw;
+    int rawW;
+    int rawH;
+    unsigned int nFrames;       // Frames per stream (0: whole sequence)
+    unsigned int maxThreads;
+    std::string csv;
+    std::vector<std::pair<int,int> > resolutions;
+    std::vector<std::string> schedules;
+    unsigned int nStreams;      // Service schedule: streams, frame rate and deadline (ms) of each
+    double streamFps;
+    double deadline;
+};
+
+struct Measure
+{
+    std::string schedule;
+    int width;
+    int height;
+    unsigned int threads;
+    unsigned int frames;        // Frames processed (all threads)
+    double fps;                 // Aggregated throughput
+    double mean;                // Latency (ms)
+    double p50;
+    double p99;
+};
+
+// Split comma separated list
+std::vector<std::string> splitList(const std::string& str)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while(start<=str.size())
+    {
+        size_t end = str.find(',', start);
+        if(end==std::string::npos)
+            end = str.size();
+        if(end>start)
+            items.push_back(str.substr(start, end-start));
+        start = end+1;
+    }
+    return items;
+}
+
+/** synthesizeSequence
+  * Synthetic face moving on a fixed background: the face follows an ellipse around the frame
+  * center and its size oscillates by 10%
+  **/
+void synthesizeSequence(int w, int h, unsigned int n, std::vector<Image>& frames)
+{
+    const double PI = 3.14159265358979;
+    for(unsigned int i=0; i<n; ++i)
+    {
+        double phase = 2*PI*i/n;
+        int size = static_cast<int>(0.55*h*(1 + 0.1*sin(2*phase)));
+        int x = static_cast<int>(w/2 + 0.15*w*cos(phase)) - size/2;
+        int y = static_cast<int>(h/2 + 0.05*h*sin(phase)) - size/2;
+
+        Image im;
+        synthesizeFace(w, h, x, y, size, 1, im);
+        frames.push_back(im);
+    }
+}
+
+// One stream: process frames in order starting at offset, recording per-frame latency (ms)
+void runStream(const std::vector<Image>& frames, const std::string& schedule, unsigned int n, unsigned int offset,
+               std::vector<double>& latencies)
+{
+    int w = frames[0].width;
+    int h = frames[0].height;
+    ViolaJones detector(w, h);
+    GreyFrame grey(w, h);
+    unsigned short rect[4];
+
+    for(unsigned int i=0; i<n; ++i)
+    {
+        unsigned char* image = const_cast<unsigned char*>(&frames[(i+offset)%frames.size()].data[0]);
+
+        Clock::time_point start = Clock::now();
+        grey.update(image);
+        if(schedule=="detect" || (schedule=="mixed" && i%MIXED_DETECT_PERIOD==0))
+            detector.detect(grey, rect);
+        else
+            detector.track(grey, rect);
+        latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+}
+
+Measure run(const std::vector<Image>& frames, const std::string& schedule, unsigned int nThreads, unsigned int nFrames)
+{
+    std::vector<std::vector<double> > latencies(nThreads);
+    std::vector<std::thread> workers;
+
+    // Streams start at different frames so they do not run in lockstep
+    Clock::time_point start = Clock::now();
+    for(unsigned int t=0; t<nThreads; ++t)
+        workers.push_back(std::thread(runStream, std::cref(frames), std::cref(schedule), nFrames,
+                                      t*frames.size()/nThreads, std::ref(latencies[t])));
+    for(unsigned int t=0; t<nThreads; ++t)
+        workers[t].join();
+    double wall = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    for(unsigned int t=0; t<nThreads; ++t)
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    std::sort(all.begin(), all.end());
+
+    Measure m;
+    m.schedule = schedule;
+    m.width = frames[0].width;
+    m.height = frames[0].height;
+    m.threads = nThreads;
+    m.frames = all.size();
+    m.fps = all.size()/wall;
+    m.mean = 0;
+    for(unsigned int i=0; i<all.size(); ++i)
+        m.mean += all[i]/all.size();
+    m.p50 = all[std::min(all.size()-1, all.size()/2)];
+    m.p99 = all[std::min(all.size()-1, (size_t)(0.99*all.size()))];
+
+    return m;
+}
+
+// Submission times of the frames of every service stream, and latencies of the detected ones
+struct ServiceRun
+{
+    std::vector<std::vector<Clock::time_point> > submitted;
+    std::vector<double> latencies;
+    std::mutex lock;
+};
+
+void serviceDone(int stream, unsigned int frameId, unsigned short*, void* user)
+{
+    ServiceRun* run = static_cast<ServiceRun*>(user);
+    Clock::time_point now = Clock::now();
+
+    std::lock_guard<std::mutex> guard(run->lock);
+    run->latencies.push_back(std::chrono::duration<double, std::milli>(now - run->submitted[stream][frameId]).count());
+}
+
+// One service stream: submit n frames starting at offset, one every period (as a camera would)
+void feedStream(DetectionService& service, int stream, const std::vector<Image>& frames, unsigned int n,
+                unsigned int offset, double period, std::vector<Clock::time_point>& submitted)
+{
+    Clock::time_point start = Clock::now();
+    for(unsigned int i=0; i<n; ++i)
+    {
+        std::this_thread::sleep_until(start + std::chrono::microseconds(static_cast<long long>(1000*i*period)));
+
+        // Frame ids of a stream are consecutive from 0
+        submitted[i] = Clock::now();
+        service.submit(stream, const_cast<unsigned char*>(&frames[(i+offset)%frames.size()].data[0]));
+    }
+}
+
+/** runService
+  * Service schedule: nStreams streams fed in parallel to a service of nThreads workers, until
+  * every frame has been detected, dropped or expired. Latency is measured on detected frames, from
+  * submission to result
+  * stats: statistics of every stream
+  **/
+Measure runService(const std::vector<Image>& frames, const Options& opt, unsigned int nThreads, unsigned int nFrames,
+                   std::vector<StreamStats>& stats)
+{
+    int w = frames[0].width;
+    int h = frames[0].height;
+    ServiceRun run;
+    run.submitted.assign(opt.nStreams, std::vector<Clock::time_point>(nFrames));
+
+    DetectionService service(nThreads, serviceDone, &run);
+    std::vector<int> streams;
+    for(unsigned int s=0; s<opt.nStreams; ++s)
+        streams.push_back(service.addStream(w, h, opt.deadline));
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> feeders;
+    for(unsigned int s=0; s<opt.nStreams; ++s)
+        feeders.push_back(std::thread(feedStream, std::ref(service), streams[s], std::cref(frames), nFrames,
+                                      s*frames.size()/opt.nStreams, 1000/opt.streamFps, std::ref(run.submitted[s])));
+    for(unsigned int s=0; s<opt.nStreams; ++s)
+        feeders[s].join();
+
+    // Wait for the last queued frames
+    stats.resize(opt.nStreams);
+    for(unsigned int s=0; s<opt.nStreams; ++s)
+    {
+        while(true)
+        {
+            stats[s] = service.getStats(streams[s]);
+            if(stats[s].completed + stats[s].dropped + stats[s].expired>=stats[s].submitted)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    double wall = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for(unsigned int s=0; s<opt.nStreams; ++s)
+        service.removeStream(streams[s]);
+
+    std::vector<double> all = run.latencies;
+    std::sort(all.begin(), all.end());
+
+    Measure m;
+    m.schedule = "service";
+    m.width = w;
+    m.height = h;
+    m.threads = nThreads;
+    m.frames = all.size();
+    m.fps = all.size()/wall;
+    m.mean = 0;
+    for(unsigned int i=0; i<all.size(); ++i)
+        m.mean += all[i]/all.size();
+    m.p50 = all.empty() ? 0 : all[std::min(all.size()-1, all.size()/2)];
+    m.p99 = all.empty() ? 0 : all[std::min(all.size()-1, (size_t)(0.99*all.size()))];
+
+    return m;
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    opt.rawW = 0;
+    opt.rawH = 0;
+    opt.nFrames = 0;
+    opt.maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    opt.nStreams = 4;
+    opt.streamFps = 30;
+    opt.deadline = 100;
+    // No window of whole frame detection (260 pixels and up) fits below 640x480
+    std::string resolutions = "640x480,1280x720,1920x1080";
+    std::string schedules = "detect,track,mixed";
+
+    for(int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasVal = i+1<argc;
+
+        if(arg=="--y4m" && hasVal)
+            opt.y4m = argv[++i];
+        else if(arg=="--raw" && hasVal)
+            opt.raw = argv[++i];
+        else if(arg=="--size" && hasVal)
+            sscanf(argv[++i], "%dx%d", &opt.rawW, &opt.rawH);
+        else if(arg=="--frames" && hasVal)
+            opt.nFrames = atoi(argv[++i]);
+        else if(arg=="--threads" && hasVal)
+            opt.maxThreads = std::max(1, atoi(argv[++i]));
+        else if(arg=="--csv" && hasVal)
+            opt.csv = argv[++i];
+        else if(arg=="--resolutions" && hasVal)
+            resolutions = argv[++i];
+        else if(arg=="--schedules" && hasVal)
+            schedules = argv[++i];
+        else if(arg=="--streams" && hasVal)
+            opt.nStreams = std::max(1, atoi(argv[++i]));
+        else if(arg=="--fps" && hasVal)
+            opt.streamFps = std::max(1.0, atof(argv[++i]));
+        else if(arg=="--deadline" && hasVal)
+            opt.deadline = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: e2ebench [--y4m file | --raw file --size WxH] [--frames n] [--threads n] [--csv file]\n"
+                            "                [--resolutions WxH,...] [--schedules detect,track,mixed,service]\n"
+                            "                [--streams n] [--fps n] [--deadline ms]\n");
+            return 1;
+        }
+    }
+
+    std::vector<std::string> sizes = splitList(resolutions);
+    for(unsigned int i=0; i<sizes.size(); ++i)
+    {
+        int w, h;
+        if(sscanf(sizes[i].c_str(), "%dx%d", &w, &h)==2)
+            opt.resolutions.push_back(std::pair<int,int>(w, h));
+    }
+    opt.schedules = splitList(schedules);
+
+    // Source sequence (synthetic sequences are drawn at every resolution instead of resized)
+    std::vector<Image> source;
+    std::string sourceName = "synthetic";
+    if(!opt.y4m.empty() || !opt.raw.empty())
+    {
+        bool ok = opt.y4m.empty() ? loadRawSequence(opt.raw, opt.rawW, opt.rawH, opt.nFrames, source)
+                                  : loadY4M(opt.y4m, opt.nFrames, source);
+        sourceName = opt.y4m.empty() ? opt.raw : opt.y4m;
+        if(!ok)
+        {
+            fprintf(stderr, "e2ebench: cannot read %s\n", sourceName.c_str());
+            return 1;
+        }
+    }
+
+    // Thread counts: powers of two up to the maximum, and the maximum
+    std::vector<unsigned int> threadCounts;
+    for(unsigned int t=1; t<opt.maxThreads; t*=2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(opt.maxThreads);
+
+    printf("source: %s\n", sourceName.c_str());
+    printf("%-8s %-10s %7s %7s %9s %9s %9s %9s\n", "schedule", "size", "threads", "frames", "fps", "mean_ms", "p50_ms", "p99_ms");
+
+    std::vector<Measure> measures;
+    for(unsigned int r=0; r<opt.resolutions.size(); ++r)
+    {
+        int w = opt.resolutions[r].first;
+        int h = opt.resolutions[r].second;
+
+        std::vector<Image> frames;
+        if(source.empty())
+            synthesizeSequence(w, h, SYNTH_FRAMES, frames);
+        else
+        {
+            frames.resize(source.size());
+            for(unsigned int i=0; i<source.size(); ++i)
+                resize(source[i], w, h, frames[i]);
+        }
+        unsigned int nFrames = opt.nFrames ? opt.nFrames : frames.size();
+
+        for(unsigned int s=0; s<opt.schedules.size(); ++s)
+        {
+            for(unsigned int t=0; t<threadCounts.size(); ++t)
+            {
+                std::vector<StreamStats> stats;
+                Measure m = opt.schedules[s]=="service" ? runService(frames, opt, threadCounts[t], nFrames, stats)
+                                                        : run(frames, opt.schedules[s], threadCounts[t], nFrames);
+                measures.push_back(m);
+
+                char size[32];
+                snprintf(size, sizeof(size), "%dx%d", w, h);
+                printf("%-8s %-10s %7u %7u %9.1f %9.2f %9.2f %9.2f\n", m.schedule.c_str(), size, m.threads, m.frames,
+                       m.fps, m.mean, m.p50, m.p99);
+
+                // Service streams: DetectionService::getStats
+                for(unsigned int i=0; i<stats.size(); ++i)
+                    printf("  stream %u: submitted %u completed %u dropped %u expired %u late %u p50 %.2f p90 %.2f p99 %.2f ms\n",
+                           i, stats[i].submitted, stats[i].completed, stats[i].dropped, stats[i].expired, stats[i].late,
+                           stats[i].p50, stats[i].p90, stats[i].p99);
+                fflush(stdout);
+            }
+        }
+    }
+
+    if(!opt.csv.empty())
+    {
+        FILE* f = fopen(opt.csv.c_str(), "w");
+        if(!f)
+        {
+            fprintf(stderr, "e2ebench: cannot write %s\n", opt.csv.c_str());
+            return 1;
+        }
+
+        fprintf(f, "schedule,width,height,threads,frames,fps,mean_ms,p50_ms,p99_ms\n");
+        for(unsigned int i=0; i<measures.size(); ++i)
+        {
+            Measure& m = measures[i];
+            fprintf(f, "%s,%d,%d,%u,%u,%.3f,%.4f,%.4f,%.4f\n", m.schedule.c_str(), m.width, m.height, m.threads,
+                    m.frames, m.fps, m.mean, m.p50, m.p99);
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
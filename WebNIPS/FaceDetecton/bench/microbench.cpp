@@ -0,0 +1,711 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <new>
+#include "violajones.h"
+#include "lbp.h"
+#include "bbf.h"
+#include "connected.h"
+#include "resample.h"
+#include "greyframe.h"
+#include "landmarks.h"
+#include "frameio.h"
+
+//! Microbenchmarks of the detector hot kernels
+//! Every kernel is timed on its own, on a synthetic face frame (or a recorded frame resized to
+//! each resolution), and reported as JSON: time per operation, windows per second (for kernels
+//! processing windows) and heap allocations per operation. Grey plane conversions (greyframe.h) are
+//! timed on a new frame, the kernels after them read its planes. Landmarks use a random model of the
+//! usual 68 point size. The face patch resampler is also checked against its scalar reference, on
+//! RGBA and grey sources, and the tilted integral image against direct sums over random rotated
+//! rects (exit code 2 on mismatch). The profile cascade (if readable) is timed alone and in a single
+//! pass with the frontal one (and its mirrored cascade), to compare with separate passes.
+//! Cascades given with --cascade (utils/xml_parser.py output, e.g. a basic and an extended feature
+//! cascade of the same object, or an LBP cascade run by the LBP engine) report their time and
+//! features evaluated per window. A BBF cascade given with --bbf (utils/bbf_parser.py output) times
+//! the ccv detection with the vectorized comparison kernel and its scalar reference (exit code 2 if
+//! they find different objects).
+//!
+//!   microbench [--frame file.ppm] [--min-time s] [--filter name] [--profile cascade.txt]
+//!              [--cascade cascade.txt ...] [--bbf face.bbf]
+
+// Whole frame detection parameters (as in ViolaJones)
+const double DETECT_SCALE = 1.1;
+const double DETECT_SHIFT = 0.02;
+const unsigned int DETECT_WSIZE = 260;
+const unsigned int DETECT_N_SCALES = 5;
+
+// BBF detection parameters (as in camface.js)
+const int BBF_INTERVAL = 5;
+const int BBF_MIN_NEIGHBORS = 1;
+
+const int RESOLUTIONS[3][2] = {{320, 240}, {640, 480}, {1280, 720}};
+const unsigned int N_RECTS = 4096;          // Rects for integral image lookups
+const unsigned int N_WINDOWS = 256;         // Windows for feature extraction
+
+// Landmark model of the usual 68 point size (10 cascades of 500 depth 4 trees, 400 pixels)
+const int LM_LANDMARKS = 68;
+const int LM_CASCADES = 10;
+const int LM_TREES = 500;
+const int LM_DEPTH = 4;
+const int LM_PIXELS = 400;
+
+// ***************************************************************
+// ** ALLOCATION COUNTING
+// ***************************************************************
+
+static unsigned long long nAllocs = 0;
+
+// Resampler outputs where the SIMD kernel differs from the scalar reference
+static unsigned int nMismatches = 0;
+
+void* operator new(size_t size)
+{
+    nAllocs++;
+    void* ptr = malloc(size ? size : 1);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+// ***************************************************************
+// ** HARNESS
+// ***************************************************************
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result
+{
+    std::string name;
+    std::string resolution;
+    unsigned long long iterations;  // Operations timed
+    double nsPerOp;
+    double windowsPerSec;           // Negative if not applicable
+    double allocsPerOp;
+    double featuresPerWindow;       // Negative if not applicable
+};
+
+struct Options
+{
+    std::string frame;              // Recorded frame (empty: synthetic)
+    double minTime;                 // Minimum time per benchmark (s)
+    std::string filter;             // Only benchmarks whose name contains it
+    std::string profile;            // Profile face cascade (utils/xml_parser.py)
+    std::vector<std::string> cascades; // Cascades whose cost per window is reported
+    std::string bbf;                // BBF cascade (utils/bbf_parser.py, empty: none)
+};
+
+class Bench
+{
+public:
+    Bench(const Options& o): opt(o) {}
+
+    /** Bench::run
+      * Time a kernel, calling it until the minimum time is reached
+      * name: benchmark name
+      * fn: kernel call, performing opsPerCall operations
+      * opsPerCall: operations per call (e.g. rects looked up)
+      * windowsPerOp: windows processed per operation (0: not applicable)
+      * featuresPerWindow: features evaluated per window (negative: not applicable)
+      **/
+    void run(const std::string& name, std::function<void()> fn, double opsPerCall, double windowsPerOp, double featuresPerWindow = -1)
+    {
+        if(!this->opt.filter.empty() && name.find(this->opt.filter)==std::string::npos)
+            return;
+
+        // Warm up
+        fn();
+
+        unsigned long long calls = 1;
+        double elapsed = 0;
+        unsigned long long allocs = 0;
+        while(true)
+        {
+            unsigned long long allocStart = nAllocs;
+            Clock::time_point start = Clock::now();
+            for(unsigned long long i=0; i<calls; ++i)
+                fn();
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            allocs = nAllocs - allocStart;
+
+            if(elapsed>=this->opt.minTime)
+                break;
+            calls *= 2;
+        }
+
+        Result res;
+        res.name = name;
+        res.resolution = this->resolution;
+        res.iterations = static_cast<unsigned long long>(calls*opsPerCall);
+        res.nsPerOp = 1e9*elapsed/(calls*opsPerCall);
+        res.windowsPerSec = windowsPerOp>0 ? calls*opsPerCall*windowsPerOp/elapsed : -1;
+        res.allocsPerOp = allocs/(calls*opsPerCall);
+        res.featuresPerWindow = featuresPerWindow;
+        this->results.push_back(res);
+    }
+
+    void print(const std::string& frame)
+    {
+        printf("{\"frame\":\"%s\",\"benchmarks\":[\n", frame.c_str());
+        for(unsigned int i=0; i<this->results.size(); ++i)
+        {
+            Result& res = this->results[i];
+            char windows[32] = "null";
+            if(res.windowsPerSec>=0)
+                snprintf(windows, sizeof(windows), "%.0f", res.windowsPerSec);
+
+            char features[48] = "";
+            if(res.featuresPerWindow>=0)
+                snprintf(features, sizeof(features), ",\"features_per_window\":%.2f", res.featuresPerWindow);
+
+            printf("  {\"name\":\"%s\",\"resolution\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"windows_per_s\":%s,\"allocs_per_op\":%.3f%s}%s\n",
+                   res.name.c_str(), res.resolution.c_str(), res.iterations, res.nsPerOp, windows, res.allocsPerOp, features,
+                   i+1<this->results.size() ? "," : "");
+        }
+        printf("]}\n");
+    }
+
+    std::string resolution;
+
+private:
+    const Options& opt;
+    std::vector<Result> results;
+};
+
+// ***************************************************************
+// ** BENCHMARKS
+// ***************************************************************
+
+// Random landmark model file (landmarks.h format): timing only depends on its size
+void buildLandmarkModel(std::vector<unsigned char>& data)
+{
+    int header[7] = {0, 1, LM_LANDMARKS, LM_CASCADES, LM_TREES, LM_DEPTH, LM_PIXELS};
+    memcpy(header, "FDLM", 4);
+    int nSplits = LM_CASCADES*LM_TREES*((1<<LM_DEPTH) - 1);
+    int nLeaves = LM_CASCADES*LM_TREES*(1<<LM_DEPTH);
+
+    srand(2);
+    std::vector<float> floats;
+    std::vector<unsigned short> anchors;
+    for(int l=0; l<LM_LANDMARKS; ++l)
+    {
+        floats.push_back(0.2f + 0.6f*rand()/RAND_MAX);
+        floats.push_back(0.2f + 0.6f*rand()/RAND_MAX);
+    }
+    for(int i=0; i<LM_CASCADES*LM_PIXELS; ++i)
+        anchors.push_back(rand()%LM_LANDMARKS);
+    for(int i=0; i<2*LM_CASCADES*LM_PIXELS; ++i)
+        floats.push_back(0.1f*rand()/RAND_MAX - 0.05f);
+
+    data.assign((const unsigned char*)header, (const unsigned char*)(header + 7));
+    data.insert(data.end(), (const unsigned char*)&floats[0], (const unsigned char*)(&floats[0] + 2*LM_LANDMARKS));
+    data.insert(data.end(), (const unsigned char*)&anchors[0], (const unsigned char*)(&anchors[0] + anchors.size()));
+    data.insert(data.end(), (const unsigned char*)&floats[2*LM_LANDMARKS], (const unsigned char*)(&floats[0] + floats.size()));
+    for(int i=0; i<nSplits; ++i)
+    {
+        unsigned short pixels[2] = {(unsigned short)(rand()%LM_PIXELS), (unsigned short)(rand()%LM_PIXELS)};
+        float threshold = rand()%128 - 64;
+        data.insert(data.end(), (const unsigned char*)pixels, (const unsigned char*)(pixels + 2));
+        data.insert(data.end(), (const unsigned char*)&threshold, (const unsigned char*)(&threshold + 1));
+    }
+    std::vector<float> leaves(nLeaves*2*LM_LANDMARKS);
+    for(size_t i=0; i<leaves.size(); ++i)
+        leaves[i] = 0.002f*rand()/RAND_MAX - 0.001f;
+    data.insert(data.end(), (const unsigned char*)&leaves[0], (const unsigned char*)(&leaves[0] + leaves.size()));
+}
+
+/** featuresPerWindow
+  * Mean features a cascade evaluates on a set of windows (windows failing the variance test
+  * evaluate none, the others every feature of the stages they reach)
+  **/
+double featuresPerWindow(const Cascade& cascade, std::vector<Rect>& windows, Frame& frame)
+{
+    std::vector<Rect> survivors;
+    for(unsigned int i=0; i<windows.size(); ++i)
+        if(frame.stdDevOver(windows[i])>1)
+            survivors.push_back(windows[i]);
+
+    double features = 0;
+    for(unsigned int s=0; s<cascade.layer.size() && !survivors.empty(); ++s)
+    {
+        features += (double)survivors.size()*cascade.layer[s].feat.size();
+        survivors = cascade.layer[s].apply(survivors, frame);
+    }
+
+    return windows.empty() ? 0 : features/windows.size();
+}
+
+/** featuresPerWindow
+  * Mean features an LBP cascade evaluates on a set of windows (every feature of the stages they
+  * reach, stage survivors found by applying the cascade truncated after every stage)
+  **/
+double featuresPerWindow(const LbpCascade& cascade, Detector& detector, std::vector<Rect>& windows, Frame& frame)
+{
+    LbpCascade truncated;
+    truncated.sizeW = cascade.sizeW;
+    truncated.sizeH = cascade.sizeH;
+
+    double features = 0;
+    unsigned int survivors = windows.size();
+    for(unsigned int s=0; s<cascade.layer.size() && survivors>0; ++s)
+    {
+        features += (double)survivors*cascade.layer[s].feat.size();
+        truncated.layer.push_back(cascade.layer[s]);
+        survivors = detector.step(truncated, windows, frame).size();
+    }
+
+    return windows.empty() ? 0 : features/windows.size();
+}
+
+// Tilted integral image against sums of the frame pixels, on a small odd sized grey frame
+// (r = g = b) where every table value is an integer exact in float:
+//  - every value, the sum of the triangle above its pixel (ViolaJones::generateIntegralImages):
+//    values near the frame edges depend on the values taken for the triangles outside the frame
+//  - Frame::tiltedSumOver on random 45 degree rects (a third touching the left frame edge, a third
+//    the right one): rect x, y, w, h covers the pixels x', y' with x + y < x' + y' <= x + y + 2w
+//    and y - x < y' - x' <= y - x + 2h
+// Return number of mismatches
+unsigned int checkTiltedIntegralImage()
+{
+    const int W = 97;
+    const int H = 61;
+    const int N_RECTS = 3000;
+
+    srand(3);
+    std::vector<unsigned char> image(4*W*H, 255);
+    for(int i=0; i<W*H; ++i)
+        image[4*i] = image[4*i+1] = image[4*i+2] = rand()%256;
+
+    GreyFrame grey(W, H);
+    grey.update(&image[0]);
+    const unsigned short* sum = grey.getSum();
+
+    ViolaJones vj(W, H);
+    std::vector<float> intIm(W*H);
+    std::vector<float> tiltIm(W*H);
+    vj.generateIntegralImages(sum, &intIm[0], &tiltIm[0]);
+    Frame frame(&intIm[0], &intIm[0], W, H, &tiltIm[0]);
+
+    unsigned int mismatches = 0;
+    for(int y=0; y<H; ++y)
+    {
+        for(int x=0; x<W; ++x)
+        {
+            double expected = 0;
+            for(int py=0; py<=y; ++py)
+                for(int px=std::max(0, x-(y-py)); px<=std::min(W-1, x+(y-py)); ++px)
+                    expected += sum[px + py*W]/3;
+
+            if(tiltIm[x + y*W]!=expected)
+            {
+                if(mismatches==0)
+                    fprintf(stderr, "microbench: tilted integral image at %d,%d is %.1f, pixels sum %.1f\n", x, y, tiltIm[x + y*W], expected);
+                mismatches++;
+            }
+        }
+    }
+
+    for(int n=0; n<N_RECTS; ++n)
+    {
+        // Left corner x - h >= 0, right corner x + w <= W-1, bottom corner y + w + h <= H-1
+        int w = 1 + rand()%((H-1)/2);
+        int h = 1 + rand()%(H-1-w);
+        if(w + h>W-1)
+            continue;
+        int y = rand()%(H - w - h);
+        int x = h + rand()%(W - w - h);
+        if(n%3==1)
+            x = h;
+        else if(n%3==2)
+            x = W-1 - w;
+
+        double expected = 0;
+        for(int py=y; py<=y+w+h; ++py)
+        {
+            for(int px=x-h; px<=x+w; ++px)
+            {
+                int u = px + py - (x + y);
+                int v = py - px - (y - x);
+                if(u>0 && u<=2*w && v>0 && v<=2*h)
+                    expected += sum[px + py*W]/3;
+            }
+        }
+
+        Rect r(x, y, w, h);
+        double value = frame.tiltedSumOver(r, 0, 1);
+        if(value!=expected)
+        {
+            if(mismatches==0)
+                fprintf(stderr, "microbench: tilted sum over %d,%d %dx%d is %.1f, pixels sum %.1f\n", x, y, w, h, value, expected);
+            mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+void benchResolution(Bench& bench, Image& im, const LandmarkModel& landmarkModel, const Cascade* profile, const Cascade* mirrored,
+                     const std::vector<std::pair<std::string, const Cascade*> >& cascades,
+                     const std::vector<std::pair<std::string, const LbpCascade*> >& lbpCascades, const BbfCascade& bbf)
+{
+    const Cascade& cascade = Cascade::frontal();
+    int w = im.width;
+    int h = im.height;
+
+    char res[32];
+    snprintf(res, sizeof(res), "%dx%d", w, h);
+    bench.resolution = res;
+
+    // Grey planes (conversion of a new frame) and the luma pyramid down to one pixel high
+    GreyFrame grey(w, h);
+    unsigned char* image = &im.data[0];
+    bench.run("grey_sum", [&](){ grey.update(image); grey.getSum(); }, 1, 0);
+    bench.run("grey_luma", [&](){ grey.update(image); grey.getLuma(); }, 1, 0);
+    bench.run("grey_luma_pyramid", [&](){ grey.update(image); grey.getLuma(grey.getLevels()-1); }, 1, 0);
+
+    grey.update(image);
+    const unsigned short* sum = grey.getSum();
+
+    // Integral images
+    ViolaJones vj(w, h);
+    std::vector<float> intIm(w*h);
+    std::vector<float> sqIntIm(w*h);
+
+    bench.run("integral_image", [&](){ vj.generateIntegralImage(sum, &intIm[0]); }, 1, 0);
+    bench.run("square_integral_image", [&](){ vj.generateSquareIntegralImage(sum, &sqIntIm[0]); }, 1, 0);
+
+    // Upright and tilted integral images in a single pass (cascades with tilted features)
+    std::vector<float> tiltIm(w*h);
+    bench.run("integral_image+tilted", [&](){ vj.generateIntegralImages(sum, &intIm[0], &tiltIm[0]); }, 1, 0);
+
+    // Integer integral image (LBP engine)
+    std::vector<unsigned int> lbpIm(w*h);
+    bench.run("integer_integral_image", [&](){ vj.generateIntegerIntegralImage(sum, &lbpIm[0]); }, 1, 0);
+
+    // Tables used below, filled even if the benchmarks above are filtered out
+    vj.generateIntegralImages(sum, &intIm[0], &tiltIm[0]);
+    vj.generateSquareIntegralImage(sum, &sqIntIm[0]);
+    vj.generateIntegerIntegralImage(sum, &lbpIm[0]);
+
+    Frame frame(&intIm[0], &sqIntIm[0], w, h, &tiltIm[0], &lbpIm[0]);
+
+    // Landmark alignment on the face of the synthetic frame
+    LandmarkDetector landmarkDetector;
+    std::vector<float> points(2*landmarkModel.getLandmarks());
+    Rect faceBox((w - 6*h/10)/2, 2*h/10, 6*h/10, 6*h/10);
+    bench.run("landmarks", [&](){ landmarkDetector.predict(landmarkModel, grey, faceBox, &points[0]); }, 1, 0);
+
+    // Face patch crop and resize (face of the synthetic frame), vectorized and scalar reference
+    const int PATCH = 48;
+    const char* modeNames[3] = {"area", "bilinear", "box"};
+    Resampler::Mode modes[3] = {Resampler::AREA, Resampler::BILINEAR, Resampler::BOX};
+    std::vector<unsigned char> patch(PATCH*PATCH);
+    auto checkResampler = [&](Resampler& resampler, const unsigned char* src, int stride, int channels, Rect box, const std::string& what)
+    {
+        std::vector<unsigned char> out(resampler.getW()*resampler.getH());
+        std::vector<unsigned char> ref(out.size());
+        resampler.apply(src, w, h, stride, channels, box, &out[0], true);
+        resampler.apply(src, w, h, stride, channels, box, &ref[0], false);
+        if(out!=ref)
+        {
+            fprintf(stderr, "microbench: resample_%s %s kernel differs from the scalar reference\n",
+                    what.c_str(), Resampler::simdKernel());
+            nMismatches++;
+        }
+    };
+    for(int m=0; m<3; ++m)
+    {
+        // Face patch of the RGBA frame and of its grey plane, and an odd size patch (vector kernel
+        // tails) of a box past the frame corner (repeated edges)
+        Resampler resampler(PATCH, PATCH, modes[m]);
+        Resampler odd(PATCH-3, PATCH-11, modes[m]);
+        Rect corner(-w/10, -h/10, w/3, h/3);
+        std::string mode = modeNames[m];
+        checkResampler(resampler, image, 4*w, 4, faceBox, mode);
+        checkResampler(resampler, grey.getGrey(), w, 1, faceBox, mode + " (grey)");
+        checkResampler(odd, image, 4*w, 4, corner, mode + " (odd patch at the corner)");
+        checkResampler(odd, grey.getGrey(), w, 1, corner, mode + " (grey, odd patch at the corner)");
+
+        char name[64];
+        snprintf(name, sizeof(name), "resample_%s/%s", modeNames[m], Resampler::simdKernel());
+        bench.run(name, [&](){ resampler.apply(image, w, h, 4*w, 4, faceBox, &patch[0], true); }, 1, 0);
+        snprintf(name, sizeof(name), "resample_%s/scalar_reference", modeNames[m]);
+        bench.run(name, [&](){ resampler.apply(image, w, h, 4*w, 4, faceBox, &patch[0], false); }, 1, 0);
+    }
+
+    // BBF (ccv) detection, vectorized comparison kernel and scalar reference
+    if(bbf.isLoaded())
+    {
+        BbfDetector bbfDetector(w, h);
+        std::vector<BbfDetection> found;
+        std::vector<BbfDetection> reference;
+        bbfDetector.detect(bbf, grey, BBF_INTERVAL, BBF_MIN_NEIGHBORS, found, true);
+        bbfDetector.detect(bbf, grey, BBF_INTERVAL, BBF_MIN_NEIGHBORS, reference, false);
+
+        bool same = found.size()==reference.size();
+        for(unsigned int i=0; same && i<found.size(); ++i)
+            same = found[i].x==reference[i].x && found[i].y==reference[i].y && found[i].width==reference[i].width &&
+                   found[i].neighbors==reference[i].neighbors && found[i].confidence==reference[i].confidence;
+        if(!same)
+        {
+            fprintf(stderr, "microbench: bbf_detect %s kernel differs from the scalar reference\n", BbfDetector::simdKernel());
+            nMismatches++;
+        }
+
+        std::string name = std::string("bbf_detect/") + BbfDetector::simdKernel();
+        // New frame every run, so the luma conversion is timed too
+        bench.run(name, [&](){ grey.update(image); bbfDetector.detect(bbf, grey, BBF_INTERVAL, BBF_MIN_NEIGHBORS, found, true); }, 1, 0);
+        bench.run("bbf_detect/scalar_reference", [&](){ grey.update(image); bbfDetector.detect(bbf, grey, BBF_INTERVAL, BBF_MIN_NEIGHBORS, found, false); }, 1, 0);
+    }
+
+    // Integral image lookups on random rects
+    std::vector<Rect> rects;
+    int maxSize = std::min((int)DETECT_WSIZE, std::min(w, h)-1);
+    srand(1);
+    for(unsigned int i=0; i<N_RECTS; ++i)
+    {
+        int size = 24 + rand()%(maxSize-24);
+        rects.push_back(Rect(rand()%(w-size), rand()%(h-size), size, size));
+    }
+
+    volatile double sink = 0;
+    bench.run("frame_sum_over", [&](){
+        double acc = 0;
+        for(unsigned int i=0; i<rects.size(); ++i)
+            acc += frame.sumOver(rects[i]);
+        sink = acc;
+    }, rects.size(), 0);
+
+    bench.run("frame_std_dev_over", [&](){
+        double acc = 0;
+        for(unsigned int i=0; i<rects.size(); ++i)
+            acc += frame.stdDevOver(rects[i]);
+        sink = acc;
+    }, rects.size(), 0);
+
+    // Window generation per scale
+    Detector detector(DETECT_SCALE, DETECT_SHIFT, DETECT_WSIZE, DETECT_N_SCALES);
+    Rect wholeFrame(0, 0, w, h);
+    std::vector<Rect> windows;
+    for(unsigned int sc=0; sc<DETECT_N_SCALES; ++sc)
+    {
+        unsigned int size = detector.wSize*detector.getScale(sc);
+        Rect refWin(0, 0, size, size);
+        std::vector<Rect> scaleWindows = detector.generateWindows(wholeFrame, refWin);
+        if(sc==0)
+            windows = scaleWindows;
+
+        char name[64];
+        snprintf(name, sizeof(name), "detector_generate_windows/%u", sc);
+        bench.run(name, [&](){
+            Rect win(0, 0, size, size);
+            sink = detector.generateWindows(wholeFrame, win).size();
+        }, 1, scaleWindows.size());
+    }
+
+    if(windows.empty())
+        return;
+
+    // Feature extraction (all features of the cascade on a set of windows)
+    std::vector<Rect> featWindows(windows.begin(), windows.begin() + std::min((size_t)N_WINDOWS, windows.size()));
+    std::vector<double> means(featWindows.size());
+    std::vector<double> stdDevs(featWindows.size());
+    unsigned int nFeatures = 0;
+    for(unsigned int i=0; i<featWindows.size(); ++i)
+    {
+        means[i] = frame.sumOver(featWindows[i])/featWindows[i].area();
+        stdDevs[i] = frame.stdDevOver(featWindows[i]);
+    }
+    for(unsigned int s=0; s<cascade.layer.size(); ++s)
+        nFeatures += cascade.layer[s].feat.size();
+
+    bench.run("feature_extract", [&](){
+        double acc = 0;
+        for(unsigned int s=0; s<cascade.layer.size(); ++s)
+            for(unsigned int f=0; f<cascade.layer[s].feat.size(); ++f)
+                for(unsigned int i=0; i<featWindows.size(); ++i)
+                    acc += cascade.layer[s].feat[f].extract(featWindows[i], frame, means[i], stdDevs[i]);
+        sink = acc;
+    }, (double)nFeatures*featWindows.size(), 0);
+
+    // Stages, each on the windows that reach it (scale 0)
+    const double CONFIDENCE = 10;
+    std::vector<Rect> survivors = windows;
+    std::vector<Rect> mergeInput;
+    for(unsigned int s=0; s<cascade.layer.size() && !survivors.empty(); ++s)
+    {
+        const Stage& stage = cascade.layer[s];
+
+        char name[64];
+        snprintf(name, sizeof(name), "stage_apply/%02u", s);
+        bench.run(name, [&](){ sink = stage.apply(survivors, frame).size(); }, survivors.size(), 1);
+
+        survivors = stage.apply(survivors, frame);
+
+        // Merger input: output of the deepest stage still passing enough windows to form a face
+        if(survivors.size()>CONFIDENCE)
+            mergeInput = survivors;
+    }
+
+    // Whole cascade on the windows of scale 0: frontal, profile, and both in a single pass
+    bench.run("detector_step/frontal", [&](){ sink = detector.step(cascade, windows, frame).size(); }, 1, windows.size(),
+              featuresPerWindow(cascade, windows, frame));
+    if(profile)
+    {
+        std::vector<const Cascade*> both;
+        both.push_back(&cascade);
+        both.push_back(profile);
+
+        bench.run("detector_step/profile", [&](){ sink = detector.step(*profile, windows, frame).size(); }, 1, windows.size());
+        bench.run("detector_step/frontal+profile", [&](){ sink = detector.step(both, windows, frame).size(); }, 1, windows.size());
+
+        // Profile faces facing either way (mirrored features, same pass)
+        both.push_back(mirrored);
+        bench.run("detector_step/frontal+profile+mirrored", [&](){ sink = detector.step(both, windows, frame).size(); }, 1, windows.size());
+    }
+
+    // Given cascades on the windows of scale 0: time and features evaluated per window
+    for(unsigned int c=0; c<cascades.size(); ++c)
+    {
+        const Cascade& other = *cascades[c].second;
+        bench.run("cascade/" + cascades[c].first, [&](){ sink = detector.step(other, windows, frame).size(); }, 1, windows.size(),
+                  featuresPerWindow(other, windows, frame));
+    }
+    for(unsigned int c=0; c<lbpCascades.size(); ++c)
+    {
+        const LbpCascade& other = *lbpCascades[c].second;
+        bench.run("cascade/" + lbpCascades[c].first, [&](){ sink = detector.step(other, windows, frame).size(); }, 1, windows.size(),
+                  featuresPerWindow(other, detector, windows, frame));
+    }
+
+    // Merging
+    unsigned int pixShift = static_cast<int>(DETECT_SHIFT*DETECT_WSIZE);
+    Merger merger(CONFIDENCE);
+    if(!mergeInput.empty())
+        bench.run("merger_apply", [&](){ sink = merger.apply(frame, mergeInput, pixShift).second; }, 1, mergeInput.size());
+
+    // Connected components on the merger grid
+    int gridW = w/pixShift;
+    int gridH = h/pixShift;
+    std::vector<unsigned int> in(gridW*gridH, 0);
+    std::vector<unsigned int> out(gridW*gridH, 0);
+    for(unsigned int i=0; i<mergeInput.size(); ++i)
+        in[(mergeInput[i].getY()/pixShift)*gridW + mergeInput[i].getX()/pixShift] = 1;
+
+    bench.run("connected_components", [&](){
+        const unsigned int N_LABELS = 100;
+        ConnectedComponents cc(N_LABELS);
+        sink = cc.connected(&in[0], &out[0], gridW, gridH, std::equal_to<unsigned char>(), false);
+    }, 1, 0);
+}
+
+// ***************************************************************
+// ** MAIN
+// ***************************************************************
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    opt.minTime = 0.2;
+    opt.profile = "utils/cascade.txt";
+
+    for(int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg=="--frame" && i+1<argc)
+            opt.frame = argv[++i];
+        else if(arg=="--min-time" && i+1<argc)
+            opt.minTime = atof(argv[++i]);
+        else if(arg=="--filter" && i+1<argc)
+            opt.filter = argv[++i];
+        else if(arg=="--profile" && i+1<argc)
+            opt.profile = argv[++i];
+        else if(arg=="--cascade" && i+1<argc)
+            opt.cascades.push_back(argv[++i]);
+        else if(arg=="--bbf" && i+1<argc)
+            opt.bbf = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: microbench [--frame file.ppm] [--min-time s] [--filter name] [--profile cascade.txt]\n"
+                            "                  [--cascade cascade.txt ...] [--bbf face.bbf]\n");
+            return 1;
+        }
+    }
+
+    Image recorded;
+    if(!opt.frame.empty() && !loadPNM(opt.frame, recorded))
+    {
+        fprintf(stderr, "microbench: cannot read %s\n", opt.frame.c_str());
+        return 1;
+    }
+
+    std::vector<unsigned char> modelData;
+    LandmarkModel landmarkModel;
+    buildLandmarkModel(modelData);
+    landmarkModel.load(&modelData[0], modelData.size());
+
+    const Cascade* profile = Cascade::fromFile(opt.profile);
+    const Cascade* mirrored = Cascade::fromFile(opt.profile, true);
+    if(!profile)
+        fprintf(stderr, "microbench: cannot read %s, profile cascade skipped\n", opt.profile.c_str());
+
+    std::vector<std::pair<std::string, const Cascade*> > cascades;
+    std::vector<std::pair<std::string, const LbpCascade*> > lbpCascades;
+    for(unsigned int c=0; c<opt.cascades.size(); ++c)
+    {
+        std::string name = opt.cascades[c].substr(opt.cascades[c].find_last_of('/') + 1);
+        const Cascade* cascade = Cascade::fromFile(opt.cascades[c]);
+        const LbpCascade* lbpCascade = cascade ? 0 : LbpCascade::fromFile(opt.cascades[c]);
+        if(cascade)
+            cascades.push_back(std::pair<std::string, const Cascade*>(name, cascade));
+        else if(lbpCascade)
+            lbpCascades.push_back(std::pair<std::string, const LbpCascade*>(name, lbpCascade));
+        else
+        {
+            fprintf(stderr, "microbench: cannot read %s\n", opt.cascades[c].c_str());
+            return 1;
+        }
+    }
+
+    BbfCascade bbf;
+    if(!opt.bbf.empty() && !bbf.load(opt.bbf))
+    {
+        fprintf(stderr, "microbench: cannot read %s\n", opt.bbf.c_str());
+        return 1;
+    }
+
+    if(unsigned int mismatches = checkTiltedIntegralImage())
+    {
+        fprintf(stderr, "microbench: tilted integral image differs from the pixel sums (%u mismatches)\n", mismatches);
+        nMismatches += mismatches;
+    }
+
+    Bench bench(opt);
+    for(int r=0; r<3; ++r)
+    {
+        int w = RESOLUTIONS[r][0];
+        int h = RESOLUTIONS[r][1];
+
+        // Face covering 60% of the frame height, centered
+        Image im;
+        if(opt.frame.empty())
+            synthesizeFace(w, h, (w - 6*h/10)/2, 2*h/10, 6*h/10, 1, im);
+        else
+            resize(recorded, w, h, im);
+
+        benchResolution(bench, im, landmarkModel, profile, mirrored, cascades, lbpCascades, bbf);
+    }
+
+    bench.print(opt.frame.empty() ? "synthetic" : opt.frame);
+    return nMismatches>0 ? 2 : 0;
+}
@@ -0,0 +1,164 @@
+// ***************************************************************
+// ** Headless facelib benchmark (Node)
+// ***************************************************************
+// Compares per-frame latency of the facelib builds (asm.js, scalar wasm, wasm SIMD+threads) on
+// recorded frames. Builds that are missing or not supported by this Node version are skipped.
+//
+//   node bench/wasm_bench.js [--mode detect|track] [--runs n] [--size WxH] [--builds simd,wasm,asmjs] <frame|directory>...
+//
+// Frames are binary PGM/PPM or raw RGBA (.rgba/.raw, size given by --size), all of the same size.
+
+var fs = require('fs');
+var path = require('path');
+var FaceLib = require('../bin/js/facelib.js');
+
+var BUILD_DIR = path.join(__dirname, '..', 'bin', 'js') + path.sep;
+
+// ** ARGUMENTS
+// *******************************************
+
+function parseArgs(argv){
+	var args = {mode: 'detect', runs: 3, width: 0, height: 0, builds: ['asmjs', 'wasm', 'simd'], inputs: []};
+
+	for(var i=0;i<argv.length;i++){
+		var arg = argv[i];
+		if(arg == '--mode') args.mode = argv[++i];
+		else if(arg == '--runs') args.runs = parseInt(argv[++i]);
+		else if(arg == '--size'){
+			var size = argv[++i].split('x');
+			args.width = parseInt(size[0]);
+			args.height = parseInt(size[1]);
+		}
+		else if(arg == '--builds') args.builds = argv[++i].split(',');
+		else args.inputs.push(arg);
+	}
+
+	if(args.inputs.length == 0 || (args.mode != 'detect' && args.mode != 'track')){
+		console.error('Usage: node bench/wasm_bench.js [--mode detect|track] [--runs n] [--size WxH] [--builds simd,wasm,asmjs] <frame|directory>...');
+		process.exit(1);
+	}
+	return args;
+}
+
+// ** FRAME LOADING
+// *******************************************
+
+// Decode binary PGM (P5) / PPM (P6) to RGBA
+function loadPNM(file){
+	var data = fs.readFileSync(file);
+	var tokens = [], pos = 2;
+
+	while(tokens.length < 3){
+		while(data[pos] == 35 || data[pos] <= 32){   // Comments and whitespace
+			if(data[pos] == 35) while(data[pos] != 10) pos++;
+			pos++;
+		}
+		var start = pos;
+		while(data[pos] > 32) pos++;
+		tokens.push(parseInt(data.toString('ascii', start, pos)));
+	}
+	pos++;
+
+	var nChn = (data[1] == 53) ? 1 : 3;
+	var frame = {width: tokens[0], height: tokens[1], data: new Uint8Array(4*tokens[0]*tokens[1])};
+	for(var i=0;i<frame.width*frame.height;i++){
+		frame.data[4*i]   = data[pos + nChn*i];
+		frame.data[4*i+1] = data[pos + nChn*i + (nChn-1)/2];
+		frame.data[4*i+2] = data[pos + nChn*i + nChn-1];
+		frame.data[4*i+3] = 255;
+	}
+	return frame;
+}
+
+function loadFrame(file, args){
+	var ext = path.extname(file).toLowerCase();
+	if(ext == '.rgba' || ext == '.raw')
+		return {width: args.width, height: args.height, data: new Uint8Array(fs.readFileSync(file))};
+	return loadPNM(file);
+}
+
+function listFrames(inputs){
+	var files = [];
+	inputs.forEach(function(input){
+		if(!fs.statSync(input).isDirectory()){
+			files.push(input);
+			return;
+		}
+		fs.readdirSync(input).sort().forEach(function(name){
+			if(/\.(pgm|ppm|pnm|rgba|raw)$/i.test(name)) files.push(path.join(input, name));
+		});
+	});
+	return files;
+}
+
+// ** BENCHMARK
+// *******************************************
+
+function percentile(sorted, p){
+	return sorted[Math.min(sorted.length-1, Math.floor(p*sorted.length))];
+}
+
+// Run all frames through a build, return per-frame latencies (ms)
+function runBuild(module, frames, args){
+	var width = frames[0].width, height = frames[0].height;
+	var fd = module._fd_create ? module._fd_create(width, height) : 0;
+	var bufferPtr = fd ? module._fd_frame_buffer(fd) : module._capture_buffer(width, height);
+	var latencies = [];
+
+	for(var run=0;run<args.runs;run++){
+		frames.forEach(function(frame){
+			module.HEAPU8.set(frame.data, bufferPtr);
+
+			var start = process.hrtime();
+			if(fd) (args.mode == 'track') ? module._fd_track(fd) : module._fd_detect(fd);
+			else (args.mode == 'track') ? module._track_face() : module._detect_face();
+			var time = process.hrtime(start);
+
+			latencies.push(1000*time[0] + time[1]/1e6);
+		});
+	}
+
+	if(fd) module._fd_destroy(fd);
+	return latencies;
+}
+
+function report(name, latencies){
+	var sorted = latencies.slice().sort(function(a, b){ return a-b; });
+	var mean = latencies.reduce(function(a, b){ return a+b; }, 0)/latencies.length;
+	console.log([name, latencies.length, mean.toFixed(2), percentile(sorted, 0.5).toFixed(2),
+	             percentile(sorted, 0.9).toFixed(2), percentile(sorted, 0.99).toFixed(2), (1000/mean).toFixed(1)]
+	             .map(function(col){ return String(col).padStart(8); }).join(' '));
+}
+
+function main(){
+	var args = parseArgs(process.argv.slice(2));
+	var frames = listFrames(args.inputs).map(function(file){ return loadFrame(file, args); });
+	if(frames.length == 0){
+		console.error('No frames found');
+		process.exit(1);
+	}
+
+	console.log(frames.length + ' frames ' + frames[0].width + 'x' + frames[0].height + ', mode ' + args.mode + ', ' + args.runs + ' runs');
+	console.log(['build', 'frames', 'mean', 'p50', 'p90', 'p99', 'fps'].map(function(col){ return col.padStart(8); }).join(' '));
+
+	var supported = {asmjs: true, wasm: FaceLib.hasWasm(), simd: FaceLib.hasSimd() && FaceLib.hasThreads()};
+	var builds = args.builds.filter(function(name){
+		var file = BUILD_DIR + FaceLib.builds[name].file;
+		if(!fs.existsSync(file)) console.log(name.padStart(8) + '  skipped (' + path.basename(file) + ' not built)');
+		else if(!supported[name]) console.log(name.padStart(8) + '  skipped (not supported)');
+		else return true;
+		return false;
+	});
+
+	var next = function(i){
+		if(i >= builds.length) process.exit(0);   // Also stops pthread workers
+
+		FaceLib.load({path: BUILD_DIR, build: builds[i], fallback: false, global: false}, function(module){
+			report(builds[i], runBuild(module, frames, args));
+			next(i+1);
+		});
+	};
+	next(0);
+}
+
+main();
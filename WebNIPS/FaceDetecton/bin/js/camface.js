@@ -18,6 +18,7 @@ function Camface(args){
 	this.height = ('height' in args) ? args['height'] : 480;
 	this.callback = ('callback' in args) ? args['callback'] : undefined;
 	this.source = ('source' in args) ? args['source'] : undefined;
+	this.pipeline = ('pipeline' in args) ? args['pipeline'] : Camface.hasPipeline();
 	
 	// Prepare video source
 	if(this.source == undefined){
@@ -30,10 +31,18 @@ function Camface(args){
 	this._canvas.width = this.width;
 	this._canvas.height = this.height;
 
-	// Prepare context and asm.js buffer
+	// Prepare context and asm.js buffer (grey conversion and pyramids are done by the library)
 	this._stream = undefined;
 	this._context = this._canvas.getContext('2d');
 	this._buffer = this._captureBuffer();
+	this._display = this._context.createImageData(this.width, this.height);
+
+	// Detect video frames in the background (library pipeline) instead of between captures
+	if(this.source != undefined) this.pipeline = false;
+	if(this.pipeline) _start_pipeline();
+
+	// Load the face cascade (face.js) into the library once
+	if(!Camface._cascadeLoaded) Camface._cascadeLoaded = Camface.loadCascade(cascade);
 
 	// Prepare history of detected faces
 	this._history_faces = [];
@@ -41,6 +50,65 @@ function Camface(args){
 	return this;
 }
 
+// Face detection parameters (ccv.detect_objects): pyramid levels per octave, windows per face
+Camface.INTERVAL = 5;
+Camface.MIN_NEIGHBORS = 1;
+
+// Whether the loaded library build runs its detection pipeline on threads (FaceLib simd build).
+// Other builds run it in place, so frames are detected between captures as without it
+Camface.hasPipeline = function(){
+	return typeof FaceLib !== 'undefined' && FaceLib.build === 'simd';
+};
+
+// ** CASCADE LOADING
+// *******************************************
+
+// Serialize a ccv BBF cascade (face.js) in the binary format of BbfCascade (inc/bbf.h), as
+// utils/bbf_parser.py does
+Camface.bbfCascadeData = function(cascade){
+	var stages = cascade.stage_classifier;
+	var i, j, k, c, size = 20;
+	for(i=0;i<stages.length;i++){
+		size += 12;
+		for(j=0;j<stages[i].orig_feature.length;j++) size += 20 + 24*stages[i].orig_feature[j].size;
+	}
+
+	var data = new Uint8Array(size);
+	var view = new DataView(data.buffer);
+	var pos = 4;
+	var keys = ['px', 'py', 'pz', 'nx', 'ny', 'nz'];
+	data.set([70, 68, 66, 66]); // FDBB
+	[1, cascade.width, cascade.height, stages.length].forEach(function(v){ view.setInt32(pos, v, true); pos += 4; });
+	for(i=0;i<stages.length;i++){
+		var features = stages[i].orig_feature;
+		view.setInt32(pos, features.length, true);
+		view.setFloat64(pos+4, stages[i].threshold, true);
+		pos += 12;
+		for(j=0;j<features.length;j++){
+			view.setInt32(pos, features[j].size, true);
+			pos += 4;
+			for(c=0;c<keys.length;c++){
+				for(k=0;k<features[j].size;k++){
+					view.setInt32(pos, features[j][keys[c]][k], true);
+					pos += 4;
+				}
+			}
+			view.setFloat64(pos, stages[i].alpha[2*j], true);
+			view.setFloat64(pos+8, stages[i].alpha[2*j+1], true);
+			pos += 16;
+		}
+	}
+	return data;
+};
+
+// Load a ccv BBF cascade (face.js) into the library, used by every instance. Return false on error
+Camface.loadCascade = function(cascade){
+	var data = Camface.bbfCascadeData(cascade);
+	var ptr = _bbf_cascade_buffer(data.length);
+	Module.HEAPU8.set(data, ptr);
+	return _load_bbf_cascade(ptr, data.length) > 0;
+};
+
 // ** LIBRARY MANAGEMENT CALLS
 // *******************************************
 
@@ -74,15 +142,14 @@ Camface.prototype.setCallback = function(callback){
 // ** PIPELINE FOR THE LIBRARY
 // *******************************************
 
-// Process initial frame (detect face and expressions)
+// Process initial frame (detect face)
 Camface.prototype._processFirstFrame = function(){
 	if(!this._captureData()) return false;
 	
-	// Detect face and facial expressions, callback
+	// Detect face, callback
 	this.bounding_box = this._detectFace();
-	this.expressions  = this._recognizeExpression();
 	this._fillCanvasWithArray(this._buffer); // TODO: Bullshit, only used to test input
-	if(this.callback != undefined) this.callback(this.bounding_box, this.expressions);
+	if(this.callback != undefined) this.callback(this.bounding_box);
 	
 	// Schedule next execution
 	var self = this;
@@ -91,26 +158,28 @@ Camface.prototype._processFirstFrame = function(){
 	}, 100);
 };
 
-// Process a frame (track face and detect expressions)
+// Process a frame (track face)
 Camface.prototype._processFrame = function(){
 	if(!this._captureData()) return false;
 	
-	// Track face and facial expressions, callback
-	this.bounding_box = this._trackFace();
-	this.expressions  = this._recognizeExpression();
+	// Track face, callback (with the pipeline, only once a newer frame has been detected)
+	var box = this._trackFace();
 	this._fillCanvasWithArray(this._buffer); // TODO: Bullshit, only used to test input
-	if(this.callback != undefined) this.callback(this.bounding_box, this.expressions);
+	if(box != null){
+		this.bounding_box = box;
+		if(this.callback != undefined) this.callback(this.bounding_box);
+	}
 
-	// Schedule next execution
+	// Schedule next execution (the pipeline detects while next frames are captured)
 	var self = this;
-	setTimeout(function(){ self._processFrame(); }, 100);
+	var next = function(){ self._processFrame(); };
+	if(this.pipeline) requestAnimationFrame(next);
+	else setTimeout(next, 100);
 };
 
 Camface.prototype._fillCanvasWithArray = function(arr){
-	var imgData = this._context.getImageData(0, 0, this.width, this.height);
-	var data = imgData.data;
-	data.set(arr);
-	this._context.putImageData(imgData, 0, 0);
+	this._display.data.set(arr);
+	this._context.putImageData(this._display, 0, 0);
 };
 
 // ** CALLS TO ASM.JS
@@ -134,48 +203,57 @@ Camface.prototype._captureData = function(){
 	return true;
 };
 
-// Detect face
+// Detect face (BBF cascade of face.js, on the frame already in the asm.js buffer)
 Camface.prototype._detectFace = function(){
-	var i;
+	var ptr = _detect_face_bbf(Camface.INTERVAL, Camface.MIN_NEIGHBORS);
+	if(!ptr) return this._recover_missing();
 
-	var detections = ccv.detect_objects({
-		"canvas" : ccv.grayscale(this._canvas),
-		"cascade" : cascade,
-		"interval" : 5,
-		"min_neighbors" : 1
-	});
+	// Objects: count, then x, y, width, height, neighbors, confidence each
+	var objects = Module.HEAPF32;
+	var first = (ptr>>2) + 1;
+	var count = objects[ptr>>2];
 
-	// Discard regions below threshold size
+	// Highest confidence detection, discarding regions below threshold size
 	var threshold = this.width / 10;
-	for(i=detections.length-1;i>=0;i--){
-		if(detections[i].width < threshold) detections.splice(i, 1);
+	var best = -1;
+	for(var i=0;i<count;i++){
+		var obj = first + 6*i;
+		if(objects[obj+2] < threshold) continue;
+		if(best < 0 || objects[obj+5] > objects[best+5]) best = obj;
 	}
 
 	// If no face found, return whole image
-	if(detections.length == 0) return this._recover_missing();
-
-	// Find highest confidence detection
-	var best = detections[0];
-	for(i=0;i<detections.length;i++){
-		if(detections[i].confidence > best.confidence) best = detections[i];
-	}
+	if(best < 0) return this._recover_missing();
 
-	var ret = [best.x-0.075*best.width, best.y+0.04*best.height, 1.15 * best.width, 1.15 * best.height];
+	var x = objects[best], y = objects[best+1], width = objects[best+2], height = objects[best+3];
+	var ret = [x-0.075*width, y+0.04*height, 1.15 * width, 1.15 * height];
 	this._history_faces.push(ret);
 	if(this._history_faces.length > 100) this._history_faces.splice(0, 1);
 	return ret;
 };
 
-// Track face (knowing its previous location)
+// Track face (knowing its previous location). With the pipeline, face of the latest detected
+// frame, null if no frame has been detected since last call
 Camface.prototype._trackFace = function(){
+	if(this.pipeline) return this._pollFace();
 	return this._detectFace();
 };
 
-// Recognize facial expression
-// Internally (asm.js) it crops and resizes the facial region before processing
-Camface.prototype._recognizeExpression = function(){
-	var ptr = _recognize_expression();
-	return Module.HEAPF32.subarray(ptr>>4, (ptr>>4)+7);
+// Queue the frame in the asm.js buffer for detection (library pipeline, Haar cascade of the
+// library) and return the face of the latest frame detected since last call, null if none
+Camface.prototype._pollFace = function(){
+	_submit_frame();
+	var ptr = _poll_face();
+	if(!ptr) return null;
+
+	// Rect: x, y, width, height (width 0 if no face found)
+	var rect = Module.HEAPU16.subarray(ptr>>1, (ptr>>1)+4);
+	if(rect[2] == 0) return this._recover_missing();
+
+	var ret = [rect[0], rect[1], rect[2], rect[3]];
+	this._history_faces.push(ret);
+	if(this._history_faces.length > 100) this._history_faces.splice(0, 1);
+	return ret;
 };
 
 // ** WEBCAM ADQUISITION CALLBACKS
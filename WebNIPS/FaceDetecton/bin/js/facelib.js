@@ -0,0 +1,156 @@
+// ***************************************************************
+// ** FaceLib: facelib build loader
+// ***************************************************************
+// Loads the fastest build of the facial analysis library supported by the platform:
+//   simd:  facelib.simd.js  (wasm, SIMD128 and pthreads, needs SharedArrayBuffer)
+//   wasm:  facelib.wasm.js  (scalar wasm)
+//   asmjs: facelib.asm.js   (asm.js)
+// Once loaded, the exported functions (_capture_buffer, _detect_face...) and Module are installed
+// as globals, so camface.js works the same with any build:
+//
+//   FaceLib.load({path: 'FaceDetection/bin/js/'}, function(){ new Camface({...}).start(); });
+
+var FaceLib = {
+	builds: {
+		simd:  {file: 'facelib.simd.js', factory: 'FaceLibSimd'},
+		wasm:  {file: 'facelib.wasm.js', factory: 'FaceLibWasm'},
+		asmjs: {file: 'facelib.asm.js'}
+	},
+
+	// Functions exported by every build (EXP in the makefile, checked by make check-exports)
+	exports: ['fd_create', 'fd_frame_buffer', 'fd_detect', 'fd_detect_budget', 'fd_detect_complete', 'fd_track', 'fd_add_cascade', 'fd_add_lbp_cascade', 'fd_add_part', 'fd_parts', 'fd_landmarks', 'fd_detect_bbf',
+	          'fd_heatmap_enable', 'fd_heatmap', 'fd_heatmap_write', 'fd_destroy',
+	          'capture_buffer', 'detect_face', 'detect_face_budget', 'detect_complete', 'track_face',
+	          'detect_parts', 'load_landmark_model', 'load_landmark_model_file', 'detect_landmarks', 'detect_face_bbf', 'load_bbf_cascade', 'load_bbf_cascade_file', 'bbf_cascade_buffer',
+	          'capture_buffers', 'acquire_buffer', 'release_buffer', 'detect_buffer',
+	          'start_pipeline', 'submit_buffer', 'submit_frame', 'poll_face',
+	          'get_stats', 'reset_stats', 'trace_enable', 'get_trace', 'reset_trace'],
+
+	// Build currently loaded
+	build: undefined,
+	module: undefined
+};
+
+// ** FEATURE DETECTION
+// *******************************************
+
+FaceLib.isNode = function(){
+	return typeof process === 'object' && typeof require === 'function' && typeof window === 'undefined';
+};
+
+FaceLib.hasWasm = function(){
+	return typeof WebAssembly === 'object' && typeof WebAssembly.validate === 'function';
+};
+
+// Validate a module using a SIMD128 instruction (i8x16.splat, i8x16.popcnt)
+FaceLib.hasSimd = function(){
+	if(!FaceLib.hasWasm()) return false;
+	return WebAssembly.validate(new Uint8Array([0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0,
+	                                             10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11]));
+};
+
+// Shared wasm memory (browsers only allow it on cross-origin isolated pages)
+FaceLib.hasThreads = function(){
+	if(!FaceLib.hasWasm() || typeof SharedArrayBuffer === 'undefined') return false;
+	if(typeof crossOriginIsolated !== 'undefined' && !crossOriginIsolated) return false;
+	try{
+		var mem = new WebAssembly.Memory({initial: 1, maximum: 1, shared: true});
+		return mem.buffer instanceof SharedArrayBuffer;
+	}
+	catch(e){
+		return false;
+	}
+};
+
+// Best build for the platform
+FaceLib.select = function(){
+	if(FaceLib.hasSimd() && FaceLib.hasThreads()) return 'simd';
+	if(FaceLib.hasWasm()) return 'wasm';
+	return 'asmjs';
+};
+
+// ** LOADING
+// *******************************************
+
+// Load a build and call callback(module, build) once it is ready
+// args: path (directory of the builds, with trailing slash), build (force a build), global (install
+// globals, default true), fallback (try the next build if loading fails, default true)
+FaceLib.load = function(args, callback){
+	if(arguments.length == 0) args = {};
+	var path = ('path' in args) ? args['path'] : '';
+	var install = ('global' in args) ? args['global'] : true;
+	var fallback = ('fallback' in args) ? args['fallback'] : true;
+	var order = ['simd', 'wasm', 'asmjs'];
+	var first = ('build' in args) ? args['build'] : FaceLib.select();
+
+	var candidates = order.slice(order.indexOf(first));
+	if(!fallback) candidates = [first];
+
+	var attempt = function(i){
+		if(i >= candidates.length){
+			console.log('ERROR: No facelib build could be loaded!');
+			return;
+		}
+
+		FaceLib._loadBuild(path, candidates[i], function(module){
+			FaceLib.build = candidates[i];
+			FaceLib.module = module;
+			if(install) FaceLib._install(module);
+			if(callback != undefined) callback(module, candidates[i]);
+		}, function(e){
+			console.log('WARNING: facelib ' + candidates[i] + ' build failed to load (' + e + ')');
+			attempt(i+1);
+		});
+	};
+	attempt(0);
+};
+
+FaceLib._loadBuild = function(path, name, onReady, onError){
+	var build = FaceLib.builds[name];
+
+	// Modularized wasm builds: instantiate factory
+	var instantiate = function(factory){
+		factory({
+			locateFile: function(file){ return path + file; }
+		}).then(onReady, onError);
+	};
+
+	// asm.js build: runtime is ready once the script has run (or when initialized)
+	var ready = function(module){
+		if(module['calledRun']) onReady(module);
+		else module['onRuntimeInitialized'] = function(){ onReady(module); };
+	};
+
+	if(FaceLib.isNode()){
+		try{
+			var loaded = require(require('path').resolve(path + build.file));
+			if(build.factory) instantiate(loaded);
+			else ready(loaded);
+		}
+		catch(e){
+			onError(e);
+		}
+		return;
+	}
+
+	var script = document.createElement('script');
+	script.src = path + build.file;
+	script.onload = function(){
+		if(build.factory) instantiate(window[build.factory]);
+		else ready(window['Module']);
+	};
+	script.onerror = function(){ onError('cannot fetch ' + script.src); };
+	document.head.appendChild(script);
+};
+
+// Expose module and its exported functions as globals (as the asm.js build does)
+FaceLib._install = function(module){
+	var root = (typeof window !== 'undefined') ? window : global;
+	root['Module'] = module;
+	for(var i=0;i<FaceLib.exports.length;i++){
+		var name = '_' + FaceLib.exports[i];
+		if(name in module) root[name] = module[name];
+	}
+};
+
+if(typeof module === 'object' && module.exports) module.exports = FaceLib;
@@ -0,0 +1,139 @@
+#ifndef BBF_H
+#define BBF_H
+
+#include <vector>
+#include <string>
+#include "resample.h"
+#include "greyframe.h"
+
+//! Brightness binary feature (BBF) cascades: the ccv detector (bin/js/ccv.js, cascade of
+//! bin/js/face.js) that camface.js ran in JavaScript, ported with the same scan and grouping.
+//! Windows are searched on a grey pyramid (grey = 0.3r + 0.59g + 0.11b, octaves split in interval
+//! steps) at three octaves: z 0 is the window scale, 1 half and 2 a quarter of it. A feature
+//! compares up to BBF_MAX_POINTS pixels: it is true if its darkest positive pixel is brighter than
+//! its brightest negative one. A stage passes a window if the alpha values chosen by its features
+//! add up to at least the stage threshold. Pyramid levels are resampled bilinearly (Resampler),
+//! where ccv.js relied on the browser canvas: the frame and its octaves are the luma pyramid of
+//! the GreyFrame shared with the other engines.
+//!
+//! Binary file (utils/bbf_parser.py, or Camface.bbfCascadeData in camface.js), little endian:
+//!   char[4] "FDBB", int32 version, width, height, stages
+//!   per stage: int32 features, float64 threshold
+//!   per feature: int32 size, int32 px[size], py[size], pz[size], nx[size], ny[size], nz[size],
+//!                float64 alpha[2] (feature false, true)
+//! z -1 marks an unused point (never the first positive or negative one)
+
+const int BBF_MAX_POINTS = 8;
+
+class BbfFeature
+{
+public:
+    int size;                       // Points used (positive or negative)
+    int px[BBF_MAX_POINTS];         // Positive points (octave z pixels from the window origin)
+    int py[BBF_MAX_POINTS];
+    int pz[BBF_MAX_POINTS];         // Octave (-1: unused)
+    int nx[BBF_MAX_POINTS];         // Negative points
+    int ny[BBF_MAX_POINTS];
+    int nz[BBF_MAX_POINTS];
+    double alpha[2];                // Value to accumulate if false, if true
+};
+
+class BbfStage
+{
+public:
+    std::vector<BbfFeature> feat;   // Collection of features
+    double T;                       // Threshold
+};
+
+class BbfCascade
+{
+public:
+    int width;                      // Reference size (pixels)
+    int height;
+    std::vector<BbfStage> stage;
+
+    // Empty cascade
+    BbfCascade(): width(0), height(0) {}
+
+    // Load cascade from a file or from memory. Return false on error (the cascade is kept)
+    bool load(const std::string& path);
+    bool load(const unsigned char* data, unsigned int size);
+
+    bool isLoaded() const {return !stage.empty();}
+};
+
+// Object found (ccv.js detect_objects output: averaged box, boxes grouped, best stage sum)
+struct BbfDetection
+{
+    double x;
+    double y;
+    double width;
+    double height;
+    int neighbors;
+    double confidence;
+};
+
+class BbfDetector
+{
+public:
+    // Constructor (w x h frames)
+    BbfDetector(int w, int h);
+
+    /** Detect objects of a cascade in a frame (w x h grey planes)
+      * interval: pyramid levels per octave, minNeighbors: fewest boxes per group (0: no grouping)
+      * simd: compare pixels of 16 windows at once if available (false: scalar reference)
+      **/
+    void detect(const BbfCascade& cascade, GreyFrame& grey, int interval, int minNeighbors,
+                std::vector<BbfDetection>& found, bool simd = true);
+
+    // Name of the vectorized comparison kernel used by detect ("sse2", "wasm-simd128" or "scalar")
+    static const char* simdKernel();
+
+    // Feature point at a pyramid level: pixel of the first window of row 0 and octave
+    struct Point
+    {
+        const unsigned char* base;
+        int z;
+    };
+
+private:
+    // Grey image of the pyramid, rows of w pixels (padded so 16 window reads never leave it)
+    struct Plane
+    {
+        int w;
+        int h;
+        const unsigned char* data;      // Storage, or a luma plane of the frame
+        std::vector<unsigned char> storage;
+    };
+
+    void layout(const BbfCascade& cascade, int interval);
+    void buildPyramid(GreyFrame& grey);
+    void resample(const Plane& src, Rect box, Plane& dst, unsigned int r);
+    void split(const Plane& src, int phases, std::vector<unsigned char>& dst, int& stride);
+    void scan(const BbfCascade& cascade, bool simd);
+    void group(int minNeighbors, std::vector<BbfDetection>& found);
+
+    int w;
+    int h;
+    int cascadeW;                   // Pyramid layout (cascade size and interval), 0: none yet
+    int cascadeH;
+    int interval;
+    int scaleUpto;                  // Levels searched: [4, scaleUpto)
+    double scale;                   // Scale between levels
+
+    std::vector<Plane> pyr;         // Levels as ccv.js: 4 planes per level (shifted by 0/1 pixel)
+    std::vector<Resampler> resamplers;  // One per plane
+    std::vector<unsigned char> shifted; // Shifted plane before its 2 pixel wide zero border
+    std::vector<unsigned char> phases0; // Window octave in 4 column phases (windows 4 pixels apart)
+    std::vector<unsigned char> phases1; // Half octave in 2 column phases
+    std::vector<Point> points;      // Positive then negative points of every feature
+    std::vector<int> counts;        // Positive and negative point counts of every feature
+    std::vector<BbfDetection> seq;  // Windows accepted, before grouping
+    std::vector<int> parent;        // Grouping forest
+    std::vector<int> rank;
+    std::vector<int> index;
+    std::vector<BbfDetection> comps;
+    std::vector<BbfDetection> averaged;
+};
+
+#endif // BBF_H
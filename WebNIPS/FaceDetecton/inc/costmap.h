@@ -0,0 +1,53 @@
+#ifndef COST_MAP_H
+#define COST_MAP_H
+
+#include <vector>
+#include <string>
+
+class Rect;
+
+//! Detector cost heatmap
+//! Features evaluated by the cascade, accumulated per scale over a grid of cell x cell pixel cells
+//! holding the windows anchored (top left corner) there. A window costs the features of every
+//! stage it reaches until its early exit, so the map shows where cascade work concentrates.
+//! A map is filled by one detector at a time and accumulates over frames until reset.
+
+class CostMap
+{
+public:
+    // Constructor (w, h: frame size, cell: cell size, wSize/scale/nScales: windows of scale index
+    // sc are wSize*scale^sc pixels wide)
+    CostMap(int w, int h, unsigned int cell, unsigned int wSize, double scale, unsigned int nScales);
+
+    // Add features evaluated on a window
+    void add(Rect& window, unsigned int features);
+
+    // Clear all cells
+    void reset();
+
+    // Cells of scale sc (gridW*gridH, row major)
+    float* getPlane(unsigned int sc) {return &data[sc*gridW*gridH];}
+
+    // Cells of every scale (nScales planes)
+    float* getData() {return &data[0];}
+
+    unsigned int getGridW() {return gridW;}
+    unsigned int getGridH() {return gridH;}
+    unsigned int getScales() {return nScales;}
+    unsigned int getCell() {return cell;}
+
+    // Write scale sc (or the sum of all scales if sc<0) as a binary PGM, scaled so the costliest
+    // cell is white. Return false on error
+    bool writePGM(const std::string& path, int sc);
+
+private:
+    unsigned int cell;
+    unsigned int gridW;
+    unsigned int gridH;
+    unsigned int wSize;
+    double scale;
+    unsigned int nScales;
+    std::vector<float> data;    // nScales planes of gridW*gridH cells
+};
+
+#endif // COST_MAP_H
@@ -0,0 +1,123 @@
+#ifndef FACELIB_H
+#define FACELIB_H
+
+//! Reentrant C interface of the face analysis library
+//! Every handle holds its own frame buffer, integral images and tracking state, while the
+//! cascade is shared (read-only) by all of them. Different handles can be used concurrently
+//! from different threads; a single handle must not.
+//! The frame buffer is converted to grey on demand, into the planes of greyframe.h shared by every
+//! engine: fd_detect, fd_detect_budget, fd_track, fd_detect_bbf and fd_landmarks read the frame in
+//! the buffer, while fd_parts analyses the frame of the last fd_detect, fd_detect_budget or fd_track
+//! call.
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+typedef struct FaceHandle FaceHandle;
+
+// Create a face analysis instance for w x h frames
+FaceHandle* fd_create(int w, int h);
+
+// RGBA frame buffer (w*h*4 bytes) to write frames into
+unsigned char* fd_frame_buffer(FaceHandle* fd);
+
+// Detect face on the frame buffer. Return bounding box (left, top, width, height)
+unsigned short* fd_detect(FaceHandle* fd);
+
+// Detect face on the frame buffer within budget ms, most likely windows first. Return bounding box
+unsigned short* fd_detect_budget(FaceHandle* fd, double budget);
+
+// Whether the last budgeted detection scanned every window (1) or ran out of time (0)
+int fd_detect_complete(FaceHandle* fd);
+
+// Track face on the frame buffer. Return bounding box (left, top, width, height)
+unsigned short* fd_track(FaceHandle* fd);
+
+// Detect faces with a second Haar cascade of a text file converted by utils/xml_parser.py (e.g.
+// utils/cascade.txt, profile faces) besides the frontal one. All face models share the windows,
+// integral images and variance test of a single scan, and a window is dropped once all of them
+// have rejected it. both: also add the mirrored cascade (features reflected once at load), e.g.
+// profile faces facing either way without scanning a flipped frame. Return face model count, 0 if
+// the cascade cannot be read
+int fd_add_cascade(FaceHandle* fd, const char* cascade, int both);
+
+// Detect faces with the LBP engine instead: multi-block LBP cascade of a text file converted by
+// utils/xml_parser.py from an OpenCV LBP cascade, evaluated on an integer integral image without
+// variance normalization (no squared integral image). Once one is added the Haar face models are
+// not applied; several LBP cascades share a single pass. Facial parts keep their Haar cascades.
+// Return LBP face model count, 0 if the cascade cannot be read
+int fd_add_lbp_cascade(FaceHandle* fd, const char* cascade);
+
+// Search a facial part (e.g. an eye or the mouth) with the Haar cascade of a text file converted by
+// utils/xml_parser.py, inside a region of the face box (x, y, w, h as fractions of its size) at
+// window widths minSize to maxSize (fractions of the face width). Cascades are loaded once and
+// shared. Return part index, -1 if the cascade cannot be read
+int fd_add_part(FaceHandle* fd, const char* cascade, float x, float y, float w, float h, float minSize, float maxSize);
+
+// Detect the facial parts inside the face of the last fd_detect, fd_detect_budget or fd_track call,
+// on its integral images (no extra preprocessing). Return part count n then n boxes (left, top,
+// width, height; all 0 if not found), valid until next call
+unsigned short* fd_parts(FaceHandle* fd);
+
+// Fit the landmarks of the loaded model (load_landmark_model) to the face in box (left, top, width,
+// height) of the frame in the buffer. Return landmark count n then 2n coordinates (x0, y0, x1, y1, ...),
+// valid until next call. Null if no model is loaded or box is empty
+float* fd_landmarks(FaceHandle* fd, int x, int y, int w, int h);
+
+// Detect objects on the frame buffer with the BBF cascade (load_bbf_cascade) of ccv, as
+// ccv.detect_objects does in ccv.js: grey pyramid of interval levels per octave, windows grouped
+// and groups of fewer than minNeighbors windows dropped (0: every window, ungrouped). Return object
+// count n then n x (x, y, width, height, neighbors, confidence), valid until next call. Null if no
+// cascade is loaded
+float* fd_detect_bbf(FaceHandle* fd, int interval, int minNeighbors);
+
+// Start accumulating the detector cost heatmap (features evaluated by the cascade for the windows
+// anchored in each cell x cell pixel cell, per scale) over the next detections. cell 0 stops it
+void fd_heatmap_enable(FaceHandle* fd, int cell);
+
+// Cost heatmap as floats: grid width, grid height, number of scales, then one row major plane of
+// cells per scale. Valid until next call. Null if not enabled
+float* fd_heatmap(FaceHandle* fd);
+
+// Write cost heatmap of scale sc (sum of all scales if sc<0) as binary PGM. Return 0 on error
+int fd_heatmap_write(FaceHandle* fd, const char* path, int sc);
+
+// Free instance
+void fd_destroy(FaceHandle* fd);
+
+// Per-scale, per-stage cascade statistics of all instances since last reset, as JSON (valid until
+// next call). Only counted in FD_STATS builds, otherwise {"enabled":false,"scales":[]}
+const char* get_stats(void);
+
+// Clear cascade statistics
+void reset_stats(void);
+
+// Start (on != 0) or stop recording phase spans (integral images, per-scale windows, cascade and
+// merge, final selection) of all instances into per-thread ring buffers. Off by default
+void trace_enable(int on);
+
+// Recorded spans as Chrome trace_event JSON, to be opened in chrome://tracing or Perfetto (valid
+// until next call)
+const char* get_trace(void);
+
+// Forget recorded spans
+void reset_trace(void);
+
+// Load the landmark model (utils/train_landmarks.py format) used by every instance, from memory or
+// a file. Load before fitting landmarks, not concurrently. Return landmark count, 0 on error (the
+// previous model is kept)
+int load_landmark_model(const unsigned char* data, int size);
+int load_landmark_model_file(const char* path);
+
+// Load the BBF cascade (utils/bbf_parser.py format, e.g. from bin/js/face.js) used by every
+// instance, from memory or a file. Load before detecting, not concurrently. Return stage count, 0
+// on error (the previous cascade is kept)
+int load_bbf_cascade(const unsigned char* data, int size);
+int load_bbf_cascade_file(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FACELIB_H
@@ -0,0 +1,48 @@
+#ifndef FRAME_IO_H
+#define FRAME_IO_H
+
+#include <string>
+#include <vector>
+
+//! Frame input for native tools (facedetect, benchmarks)
+//! Frames are decoded to RGBA, the layout expected by ViolaJones.
+
+struct Image
+{
+    int width;
+    int height;
+    std::vector<unsigned char> data;    // RGBA
+
+    Image(): width(0), height(0) {}
+};
+
+// Load binary PGM (P5) or PPM (P6) file with 8 bit samples. Return false on error
+bool loadPNM(const std::string& path, Image& im);
+
+// Load raw RGBA frame of known size. Return false on error
+bool loadRaw(const std::string& path, int w, int h, Image& im);
+
+// Load frame by extension (.pgm/.ppm/.pnm or .rgba/.raw of size rawW x rawH). Return false on error
+bool loadFrame(const std::string& path, int rawW, int rawH, Image& im);
+
+// Load up to maxFrames frames (0: all) of a YUV4MPEG2 (.y4m) video, 8 bit. Only luma is kept (grey
+// frames). Return false on error
+bool loadY4M(const std::string& path, unsigned int maxFrames, std::vector<Image>& frames);
+
+// Load up to maxFrames frames (0: all) of concatenated w x h raw RGBA frames. Return false on error
+bool loadRawSequence(const std::string& path, int w, int h, unsigned int maxFrames, std::vector<Image>& frames);
+
+// Whether path has a frame extension
+bool isFrame(const std::string& path);
+
+// Append path to frames, or its frames (sorted by name) if it is a directory
+void listFrames(const std::string& path, std::vector<std::string>& frames);
+
+// Nearest neighbour resize
+void resize(const Image& in, int w, int h, Image& out);
+
+// Draw a w x h grey frame with a smooth random background and a cartoon frontal face at box
+// (x, y, size: face width; the face oval is a bit taller). Deterministic for a given seed
+void synthesizeFace(int w, int h, int x, int y, int size, unsigned int seed, Image& out);
+
+#endif // FRAME_IO_H
@@ -0,0 +1,79 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <vector>
+
+// Threads are not available on asm.js/wasm builds without pthreads
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define PIPELINE_THREADS 0
+#else
+#define PIPELINE_THREADS 1
+#include <mutex>
+#include <condition_variable>
+#endif
+
+//! Pool of frame slots
+//! Every slot holds an RGBA frame, its grey planes and its own integral images, so a frame can be
+//! captured into one slot while others are being preprocessed or scanned, without copies.
+
+class GreyFrame;
+
+struct FrameSlot
+{
+    unsigned char* image;       // RGBA frame
+    GreyFrame* grey;            // Grey planes of image
+    float* intIm;               // Integral image
+    float* sqIntIm;             // Squared integral image
+    float* tiltIm;              // Tilted integral image (allocated on first use, else null)
+    unsigned int* lbpIm;        // Integer integral image (allocated on first use, else null)
+    unsigned int id;            // Frame id (set on submission)
+    bool acquired;              // Held by the caller: acquired, not yet released nor handed over
+};
+
+class FramePool
+{
+public:
+    // Constructor (w, h: frame size, n: number of slots)
+    FramePool(unsigned int w, unsigned int h, unsigned int n);
+    ~FramePool();
+
+    // Get a free slot, waiting for one to be released (threaded builds). Return 0 if none
+    FrameSlot* acquire();
+
+    // Get a free slot without waiting. Return 0 if none
+    FrameSlot* tryAcquire();
+
+    // Give slot back to the pool. Return false (and keep the pool unchanged) if slot is null, not
+    // a slot of this pool or already in the pool
+    bool release(FrameSlot*);
+
+    // Pass an acquired slot on to a consumer (e.g. a pipeline), which releases it when done.
+    // Return false if slot is not held by the caller
+    bool handOver(FrameSlot*);
+
+    // Give a handed over slot, not released yet, back to the caller
+    void takeBack(FrameSlot*);
+
+    // Whether slot is held by the caller (acquired, neither released nor handed over)
+    bool isAcquired(FrameSlot*);
+
+    // Find slot owning a frame buffer. Return 0 if not found
+    FrameSlot* find(unsigned char* image);
+
+    unsigned int getSize() {return static_cast<unsigned int>(slots.size());}
+    unsigned int getW() {return width;}
+    unsigned int getH() {return height;}
+
+private:
+    unsigned int width;
+    unsigned int height;
+    std::vector<FrameSlot> slots;       // All slots
+    std::vector<FrameSlot*> available;  // Free slots
+
+#if PIPELINE_THREADS
+    std::mutex lock;
+    std::condition_variable released;
+#endif
+};
+
+#endif // FRAME_POOL_H
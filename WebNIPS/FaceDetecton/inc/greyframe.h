@@ -0,0 +1,59 @@
+#ifndef GREY_FRAME_H
+#define GREY_FRAME_H
+
+#include <vector>
+#include "resample.h"
+
+//! Grey planes of a frame, shared by every engine
+//! The RGBA frame is converted once, on first use after update, into the plane an engine reads:
+//!  - sum: r+g+b of every pixel (16 bit), three times the grey of the integral images, so the
+//!    Haar and LBP integral images (and the tracker reading them) stay exact
+//!  - grey: (r+g+b)/3, the landmark pixels
+//!  - luma: 0.3r + 0.59g + 0.11b (as ccv.grayscale), the BBF cascade was trained on it
+//! Grey and luma also have an octave pyramid, built on demand: level l is level l-1 halved
+//! (w>>l x h>>l, bilinear as Resampler). Every buffer is allocated by the constructor, and every
+//! plane is followed by PAD zero bytes, so vector loads past its last pixel stay inside.
+
+class GreyFrame
+{
+public:
+    static const int PAD = 32;          // Zero bytes after every plane
+
+    // Constructor (w x h RGBA frames)
+    GreyFrame(int w, int h);
+
+    // New frame: planes are converted from image (RGBA, kept by the caller) when next read
+    void update(const unsigned char* image);
+
+    // Planes of the current frame, rows of getW(level) pixels
+    const unsigned short* getSum();
+    const unsigned char* getGrey(int level = 0);
+    const unsigned char* getLuma(int level = 0);
+
+    int getW(int level = 0) const {return w>>level;}
+    int getH(int level = 0) const {return h>>level;}
+    int getLevels() const {return static_cast<int>(resamplers.size()) + 1;}
+
+private:
+    // Octave pyramid of a grey plane: levels [0, built) are of the current frame
+    struct Pyramid
+    {
+        std::vector<std::vector<unsigned char> > level;
+        int built;
+    };
+
+    void convertSum();
+    void convertLuma();
+    const unsigned char* build(Pyramid& pyr, int level);
+
+    int w;
+    int h;
+    const unsigned char* image;         // Current RGBA frame
+    std::vector<unsigned short> sum;
+    bool sumBuilt;
+    Pyramid grey;
+    Pyramid luma;
+    std::vector<Resampler> resamplers;  // Halving into level l+1, one per level
+};
+
+#endif // GREY_FRAME_H
@@ -0,0 +1,73 @@
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include <vector>
+#include <string>
+#include "violajones.h"
+#include "greyframe.h"
+
+//! Facial landmark alignment with an ensemble of regression trees (Kazemi and Sullivan, 2014)
+//! Starting from the mean shape placed in the face box, every cascade level samples a fixed set
+//! of pixels (each anchored to a landmark and moved with the current shape by a similarity
+//! transform) and adds the leaf offsets of its trees, chosen by pixel difference splits.
+//! Shapes are normalized to the face box ([0, 1] on both axes).
+//!
+//! Model file (little endian, trained by utils/train_landmarks.py):
+//!   "FDLM", int32 version (1), int32 landmarks L, cascades C, trees per cascade T, tree depth D,
+//!   pixels per cascade P
+//!   float32 mean shape[2L]                            x0 y0 x1 y1 ...
+//!   uint16  anchor[C][P]                              landmark of every pixel
+//!   float32 offset[C][P][2]                           pixel offset from its anchor (mean shape)
+//!   split   splits[C][T][2^D-1]                       uint16 pixel1, uint16 pixel2, float32 threshold
+//!   float32 leaves[C][T][2^D][2L]                     shape increments
+//! A split sends a shape to child 2n+1 if pixel1 - pixel2 > threshold, else to child 2n+2. All
+//! arrays are kept as read, so the splits and leaves of a tree are contiguous.
+
+class LandmarkModel
+{
+public:
+    LandmarkModel();
+
+    // Load model from a file or memory. Return false (and keep the previous model) on error
+    bool load(const std::string& path);
+    bool load(const unsigned char* data, unsigned int size);
+
+    bool isLoaded() const {return nLandmarks>0;}
+    int getLandmarks() const {return nLandmarks;}
+
+private:
+    friend class LandmarkDetector;
+
+    struct Split
+    {
+        unsigned short pixel1;
+        unsigned short pixel2;
+        float threshold;
+    };
+
+    int nLandmarks;
+    int nCascades;
+    int nTrees;
+    int depth;
+    int nPixels;
+    std::vector<float> meanShape;
+    std::vector<unsigned short> anchor;
+    std::vector<float> offset;
+    std::vector<Split> splits;
+    std::vector<float> leaves;
+};
+
+class LandmarkDetector
+{
+public:
+    /** Fit the landmarks of model to the face in box of a frame (pixels read from its grey plane)
+      * points: 2*getLandmarks() image coordinates (x0, y0, x1, y1, ...) (output)
+      **/
+    void predict(const LandmarkModel& model, GreyFrame& grey, Rect& box, float* points);
+
+private:
+    std::vector<float> shape;       // Current normalized shape
+    std::vector<float> intensity;   // Grey level of the pixels of a cascade level
+};
+
+#endif // LANDMARKS_H
@@ -0,0 +1,145 @@
+#ifndef LBP_H
+#define LBP_H
+
+#include <vector>
+#include <string>
+#include "violajones.h"
+
+//! Multi-block LBP cascades (Liao et al., 2007; OpenCV LBP cascades), the second detector engine.
+//! A feature compares the sums of a 3x3 grid of blocks with the central one: the 8 bits (clockwise
+//! from the top left block, most significant first; set if the block is not darker) form a code
+//! whose bit in a 256-bit mask chooses the leaf. Sums are compared, never normalized, so windows
+//! need no variance test and the integral image is integer (grey r+g+b, exact; modular sums stay
+//! exact for blocks under 2^32/765 pixels). A stage passes a window if its leaves add up to at
+//! least the stage threshold (OpenCV semantics).
+//!
+//! Text file (utils/xml_parser.py), one line per weak classifier after the reference window size:
+//!   lbp W H
+//!   StageNumber StageT x y w h lVal rVal subset0 ... subset7
+//! x y w h: top left block (reference window pixels), subset: mask words (bit c of word c/32)
+
+class LbpFeature
+{
+public:
+    Rect block;                 // Top left block of the 3x3 grid (reference window pixels)
+    int subset[8];              // Codes giving lVal (bit c&31 of word c>>5)
+    double lVal;                // Value to accumulate if the code is in the subset
+    double rVal;                // Value to accumulate otherwise
+
+    // Constructor
+    LbpFeature(Rect& b, const int* s, double lV, double rV);
+};
+
+class LbpStage
+{
+public:
+    std::vector<LbpFeature> feat;   // Collection of features
+    double T;                       // Threshold
+
+    // Stage constructor
+    LbpStage(std::vector<LbpFeature> f, double t): feat(f), T(t) {}
+};
+
+class LbpCascade
+{
+public:
+    unsigned int sizeH;         // Reference height (pixels)
+    unsigned int sizeW;         // Reference width (pixels)
+    std::vector<LbpStage> layer;
+
+    typedef ScaledLbpCascade Scaled;
+
+    // Cascade default constructor
+    LbpCascade(): sizeH(0), sizeW(0), layer() {}
+
+    // Constructor from file (empty if not an LBP cascade)
+    LbpCascade(std::string& file);
+
+    // Cascade of a text file, loaded once and shared by all detectors. Null if the file cannot be
+    // read or is not an LBP cascade
+    static const LbpCascade* fromFile(const std::string& path);
+};
+
+// Features of an LBP cascade scaled to a window size once, shared by all windows of that size. The
+// 4x4 corners of every block grid become offsets into the integer integral image
+class ScaledLbpCascade
+{
+public:
+    ScaledLbpCascade(const LbpCascade& c): cascade(c), winW(-1), winH(-1) {}
+
+    // Scale features to the window size (integer scale, as Haar features), if not already done
+    void scaleTo(int w, int h, int stride)
+    {
+        if (w==this->winW && h==this->winH)
+            return;
+
+        this->winW = w;
+        this->winH = h;
+        this->corners.clear();
+        this->feats.clear();
+        this->stageEnd.clear();
+
+        int scaleX = w/this->cascade.sizeW;
+        int scaleY = h/this->cascade.sizeH;
+        for (std::vector<LbpStage>::const_iterator lyr = this->cascade.layer.begin(); lyr!=this->cascade.layer.end(); ++lyr)
+        {
+            for (std::vector<LbpFeature>::const_iterator f = lyr->feat.begin(); f!=lyr->feat.end(); ++f)
+            {
+                Rect block = f->block;
+                int x = block.getX()*scaleX;
+                int y = block.getY()*scaleY;
+                int bw = block.getWidth()*scaleX;
+                int bh = block.getHeight()*scaleY;
+
+                for (int k=0; k<16; ++k)
+                    this->corners.push_back(x + (k%4)*bw + (y + (k/4)*bh)*stride);
+                this->feats.push_back(&*f);
+            }
+            this->stageEnd.push_back(this->feats.size());
+        }
+    }
+
+    unsigned int getStages() const {return stageEnd.size();}
+    unsigned int getFeatures(unsigned int s) const {return stageEnd[s] - (s>0 ? stageEnd[s-1] : 0);}
+
+    // Test stage s on the window at integer integral image position origin
+    bool passes(unsigned int s, const unsigned int* data, unsigned int origin) const
+    {
+        const unsigned int* win = data + origin;
+
+        double val = 0;
+        for (unsigned int f = s>0 ? this->stageEnd[s-1] : 0; f<this->stageEnd[s]; ++f)
+        {
+            const int* c = &this->corners[16*f];
+            unsigned int p[16];
+            for (int k=0; k<16; ++k)
+                p[k] = win[c[k]];
+
+            // Block sums (modular, exact) around the central one, clockwise from top left
+            unsigned int center = p[5] - p[6] - p[9] + p[10];
+            int code = (p[0] - p[1] - p[4] + p[5]>=center ? 128 : 0) |
+                       (p[1] - p[2] - p[5] + p[6]>=center ? 64 : 0) |
+                       (p[2] - p[3] - p[6] + p[7]>=center ? 32 : 0) |
+                       (p[6] - p[7] - p[10] + p[11]>=center ? 16 : 0) |
+                       (p[10] - p[11] - p[14] + p[15]>=center ? 8 : 0) |
+                       (p[9] - p[10] - p[13] + p[14]>=center ? 4 : 0) |
+                       (p[8] - p[9] - p[12] + p[13]>=center ? 2 : 0) |
+                       (p[4] - p[5] - p[8] + p[9]>=center ? 1 : 0);
+
+            const LbpFeature& feat = *this->feats[f];
+            val += (unsigned int)feat.subset[code>>5] & (1u<<(code&31)) ? feat.lVal : feat.rVal;
+        }
+
+        return val>=this->cascade.layer[s].T;
+    }
+
+private:
+    const LbpCascade& cascade;
+    int winW;                   // Window size the features are scaled to (-1: none)
+    int winH;
+    std::vector<int> corners;   // 16 corner offsets per feature (row major grid)
+    std::vector<const LbpFeature*> feats;
+    std::vector<unsigned int> stageEnd;  // Features [stageEnd[s-1], stageEnd[s]) form stage s
+};
+
+#endif // LBP_H
@@ -0,0 +1,85 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "violajones.h"
+#include "framepool.h"
+
+#if PIPELINE_THREADS
+#include <thread>
+#endif
+
+//! Asynchronous two-stage detection pipeline
+//! Stage 1 computes the integral images of the latest submitted frame while stage 2 runs the
+//! cascade on the previous one. Queues between stages hold a single frame: a frame that has
+//! not been picked up when a newer one arrives is dropped (latest frame wins).
+//! Frames live in slots of a FramePool: the caller acquires a slot, writes the frame and
+//! submits it; the slot is released back to the pool once the cascade is done with it.
+
+// Called from the detection thread when a result is ready
+typedef void (*DetectionCallback)(unsigned int frameId, unsigned short* rect, void* user);
+
+class DetectionPipeline
+{
+public:
+    // Constructor (detector and frame pool are not owned, callback is optional)
+    DetectionPipeline(ViolaJones* detector, FramePool* pool, DetectionCallback cb = 0, void* user = 0);
+    ~DetectionPipeline();
+
+    // Get a slot to write the next frame into. A queued frame is dropped if no slot is free
+    FrameSlot* acquire();
+
+    // Queue a frame written into an acquired slot. Return frame id
+    unsigned int submit(FrameSlot*);
+
+    // Queue a copy of the frame for detection. Return frame id
+    unsigned int submit(unsigned char* image);
+
+    // Get latest result. Return false if there is no new result since last poll
+    bool poll(unsigned short* rect, unsigned int& frameId);
+
+    // Number of frames dropped before reaching the cascade
+    unsigned int getDropped();
+
+    // Integral images of a slot, with the tilted and integer ones if the detector needs them
+    // (allocated with the slot on first use), so slots are detected as detector.detect would
+    static void integrate(ViolaJones* detector, FrameSlot* slot);
+
+    // Integral images of an integrated slot
+    static Frame frameOf(ViolaJones* detector, FrameSlot* slot);
+
+private:
+    // Run cascade on a slot, publish result and release slot
+    void detect(FrameSlot*);
+
+    // Stage loops (threaded builds)
+    void integrateLoop();
+    void detectLoop();
+
+    ViolaJones* detector;
+    FramePool* pool;
+    DetectionCallback callback;
+    void* user;
+
+    // Queues
+    FrameSlot* pendingInput;        // Submitted, waiting for integral images
+    FrameSlot* pendingReady;        // Integral images computed, waiting for the cascade
+
+    // Results
+    unsigned short result[4];
+    unsigned int resultId;
+    bool resultPending;
+
+    unsigned int nextId;
+    unsigned int dropped;
+    bool running;
+
+#if PIPELINE_THREADS
+    std::mutex lock;
+    std::condition_variable inputCond;
+    std::condition_variable readyCond;
+    std::thread integrateThread;
+    std::thread detectThread;
+#endif
+};
+
+#endif // PIPELINE_H
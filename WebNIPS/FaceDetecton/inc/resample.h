@@ -0,0 +1,70 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <vector>
+#include "violajones.h"
+
+//! Crop and resize into a fixed size grey patch
+//! A box of an RGBA frame (grey = (r+g+b)/3, as the integral images) or of a grey plane is
+//! resampled separably in fixed point: a horizontal pass (grey conversion and tap gathers) into
+//! 16 bit rows, then a vertical pass (weighted row sums). Both are vectorized with AVX2 (chosen at
+//! run time on x86) or WASM SIMD128 (-msimd128 builds), and integer exact, so the SIMD and scalar
+//! kernels give identical output. Box pixels outside the source repeat its edge.
+
+class Resampler
+{
+public:
+    enum Mode
+    {
+        AREA,       // Average of the covered source area (fractional coverage at the borders)
+        BILINEAR,   // Bilinear interpolation at output pixel centers
+        BOX         // Average of whole source pixels (box bounds rounded down)
+    };
+
+    // Constructor (dstW x dstH: output size)
+    Resampler(int dstW, int dstH, Mode mode);
+
+    /** Resample box of a source image into dst (dstW*dstH grey, row major)
+      * src: source, channels 4 (RGBA) or 1 (grey), rows of stride bytes
+      * simd: use the vectorized kernels if available (false: scalar reference)
+      **/
+    void apply(const unsigned char* src, int srcW, int srcH, int stride, int channels, Rect box,
+               unsigned char* dst, bool simd = true);
+
+    // Name of the vectorized kernel used by apply ("avx2", "wasm-simd128" or "scalar")
+    static const char* simdKernel();
+
+    int getW() {return dstW;}
+    int getH() {return dstH;}
+
+private:
+    static const int WEIGHT_BITS = 8;   // Weights of a pixel's taps sum to 1<<WEIGHT_BITS
+
+    // Taps of every output pixel along one axis: src [first, first+count) with weights
+    struct Taps
+    {
+        std::vector<int> first;
+        std::vector<int> count;
+        std::vector<int> index;         // Source index of every tap
+        std::vector<int> weight;
+    };
+
+    // Compute taps of n outputs over source range [start, start+length) of an axis of size limit
+    void computeTaps(double start, double length, int n, int limit, Taps& taps);
+
+    int dstW;
+    int dstH;
+    Mode mode;
+    Taps hTaps;
+    Taps vTaps;
+    std::vector<int> hIndex;            // Horizontal taps by tap (k*dstW + i), hCount per output,
+    std::vector<int> hWeight;           // relative to the grey row (null taps pad shorter outputs)
+    int hCount;
+    std::vector<unsigned char> grey;    // Grey source row
+    std::vector<unsigned short> rows;   // Horizontal pass output, one row per source row used
+    std::vector<const unsigned short*> rowPtrs; // Rows of the taps of one output row
+    std::vector<std::pair<int,double> > raw;    // Taps of one output before quantization
+    std::vector<int> quantized;
+};
+
+#endif // RESAMPLE_H
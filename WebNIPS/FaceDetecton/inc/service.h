@@ -0,0 +1,131 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "violajones.h"
+#include "greyframe.h"
+
+//! Multi-stream detection service (native builds)
+//! Frames from many streams are processed by one pool of worker threads sharing the built-in
+//! cascade. Every frame is split into tasks (integral images, then one task per scale) and
+//! workers take tasks from streams in round-robin order, so a busy stream cannot starve the
+//! others and the scales of one frame run in parallel. Each stream keeps a single queued frame
+//! (latest frame wins); a queued frame whose deadline has passed before processing starts is
+//! discarded.
+
+// Called from a worker thread when the detection of a frame is done
+typedef void (*StreamCallback)(int stream, unsigned int frameId, unsigned short* rect, void* user);
+
+// Per-stream counters and latency percentiles (ms, from submission to result)
+struct StreamStats
+{
+    unsigned int submitted;     // Frames submitted
+    unsigned int completed;     // Frames detected
+    unsigned int dropped;       // Frames replaced by a newer one before processing started
+    unsigned int expired;       // Frames discarded because their deadline passed while queued
+    unsigned int late;          // Frames detected after their deadline
+    double p50;
+    double p90;
+    double p99;
+};
+
+class DetectionService
+{
+public:
+    // Constructor (nThreads: worker threads, callback is optional)
+    DetectionService(unsigned int nThreads, StreamCallback cb = 0, void* user = 0);
+    ~DetectionService();
+
+    // Register a stream of w x h RGBA frames with a per-frame deadline (ms). Return stream id
+    int addStream(unsigned int w, unsigned int h, double deadline);
+
+    // Unregister stream (waits for its frame in progress)
+    void removeStream(int stream);
+
+    // Queue a copy of a frame (frames of one stream are submitted by one thread at a time). Return
+    // frame id
+    unsigned int submit(int stream, unsigned char* image);
+
+    // Get latest result of a stream. Return false if there is no new result since last poll
+    bool poll(int stream, unsigned short* rect, unsigned int& frameId);
+
+    // Get stream statistics
+    StreamStats getStats(int stream);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static const unsigned int N_LATENCIES = 512;   // Latencies kept for percentiles
+
+    struct Stream
+    {
+        ViolaJones* detector;
+        unsigned int nPixels;
+        double deadline;            // ms
+
+        // Frame being copied by submit (outside the lock)
+        unsigned char* staging;
+
+        // Queued frame
+        unsigned char* input;
+        bool inputPending;
+        unsigned int inputId;
+        Clock::time_point inputTime;
+
+        // Frame in progress
+        unsigned char* working;
+        GreyFrame* grey;            // Grey planes of working
+        float* intIm;
+        float* sqIntIm;
+        bool active;
+        bool scanning;              // Integral images ready
+        unsigned int id;
+        Clock::time_point time;
+        unsigned int nextScale;     // Next scale to hand out
+        unsigned int remaining;     // Scales not finished yet
+        std::vector<std::pair<Rect,double> > positives;
+
+        // Results
+        unsigned short result[4];
+        unsigned int resultId;
+        bool resultPending;
+
+        StreamStats stats;
+        std::vector<double> latencies;  // Ring buffer
+        unsigned int nextId;
+    };
+
+    struct Task
+    {
+        Stream* stream;
+        int streamId;
+        int scale;                  // -1: integral images
+    };
+
+    // Pick next task in round-robin order (lock held). Return false if none
+    bool nextTask(Task&);
+
+    // Run task (lock not held)
+    void run(Task&);
+
+    void workerLoop();
+
+    void freeStream(Stream*);
+
+    StreamCallback callback;
+    void* user;
+    std::vector<Stream*> streams;
+    unsigned int cursor;            // Next stream in round-robin order
+    bool running;
+
+    std::mutex lock;
+    std::condition_variable work;   // Tasks available
+    std::condition_variable idle;   // A stream finished a frame
+    std::vector<std::thread> workers;
+};
+
+#endif // SERVICE_H
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <vector>
+#include <string>
+
+//! Cascade rejection statistics
+//! Built with FD_STATS (make STATS=1), Detector::step and Stage::apply count, per scale and per
+//! stage, the windows entered, rejected by the variance test and passed, the features evaluated
+//! and the time spent. Without FD_STATS nothing is counted and the hot loops are unchanged.
+
+#ifdef FD_STATS
+#define FD_STAT(code) code
+#else
+#define FD_STAT(code)
+#endif
+
+struct StageStats
+{
+    unsigned long long entered;             // Windows the stage was applied to
+    unsigned long long varianceRejected;    // Windows rejected by the variance test (flat windows)
+    unsigned long long passed;              // Windows passed to the next stage
+    unsigned long long features;            // Features evaluated
+    double ms;                              // Time spent (ms)
+
+    StageStats(): entered(0), varianceRejected(0), passed(0), features(0), ms(0) {}
+
+    void add(const StageStats& other);
+};
+
+//! Statistics accumulated by every detector of the process (thread safe)
+class CascadeStats
+{
+public:
+    // Whether the library was built with FD_STATS
+    static bool enabled();
+
+    // Accumulate the per-stage statistics of one Detector::step call at scale index sc
+    static void add(unsigned int sc, const std::vector<StageStats>& stages);
+
+    // Statistics per scale index and stage since last reset
+    static std::vector<std::vector<StageStats> > get();
+
+    // Clear statistics
+    static void reset();
+
+    // Statistics as JSON: {"enabled":..., "scales":[{"scale":sc, "stages":[{...}, ...]}, ...]}
+    static std::string toJson();
+};
+
+#endif // STATS_H
@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <atomic>
+
+//! Phase tracing
+//! Spans (name, start, duration and an optional integer argument such as the scale index) are
+//! recorded into a fixed size ring buffer per thread, without locks, and dumped as Chrome
+//! trace_event JSON (chrome://tracing, Perfetto). Tracing is off by default: a disabled span costs
+//! one relaxed atomic load. When a ring is full the oldest spans are overwritten.
+
+struct TraceEvent
+{
+    const char* name;           // Static string
+    const char* argName;        // Static string, 0 if no argument
+    int arg;
+    long long start;            // ns since trace epoch
+    long long end;
+};
+
+class Trace
+{
+public:
+    // Start or stop recording
+    static void enable(bool on);
+
+    static bool enabled() {return active.load(std::memory_order_relaxed);}
+
+    // Time since trace epoch (ns)
+    static long long now();
+
+    // Record a span into the calling thread's ring
+    static void record(const char* name, const char* argName, int arg, long long start, long long end);
+
+    // Forget spans recorded so far
+    static void reset();
+
+    // Spans of every thread as Chrome trace_event JSON. Spans being overwritten while dumping
+    // are left out
+    static std::string toJson();
+
+private:
+    static std::atomic<bool> active;
+};
+
+//! Span covering the lifetime of the object
+class TraceSpan
+{
+public:
+    TraceSpan(const char* n, const char* aN = 0, int a = 0):
+        name(n), argName(aN), arg(a), start(Trace::enabled() ? Trace::now() : -1) {}
+
+    ~TraceSpan()
+    {
+        if(this->start>=0)
+            Trace::record(this->name, this->argName, this->arg, this->start, Trace::now());
+    }
+
+private:
+    const char* name;
+    const char* argName;
+    int arg;
+    long long start;            // -1 if tracing was off when the span began
+};
+
+#endif // TRACE_H
@@ -0,0 +1,46 @@
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include "violajones.h"
+
+//! Normalized cross-correlation template tracker
+//! The face box is split into a grid of cells whose mean values are read from the
+//! integral image (4 lookups per cell), so matching cost does not depend on face size.
+
+class TemplateTracker
+{
+public:
+    static const int N_CELLS = 16;      // Template grid size (cells per side)
+
+    // Constructor (search: search radius relative to box size, rate: template update rate)
+    TemplateTracker(double search, double rate): searchRadius(search), updateRate(rate), valid(false) {}
+
+    // Take template from box
+    void init(Frame&, Rect&);
+
+    // Find box in frame starting from given guess (box is updated). Return NCC score [-1, 1]
+    double update(Frame&, Rect&);
+
+    // Forget template
+    void invalidate() {valid = false;}
+
+    bool isValid() {return valid;}
+
+private:
+    // Sample normalized (zero mean, unit norm) grid of cell means inside box. Return false if flat
+    bool sample(Frame&, Rect&, double* out);
+
+    // Correlate template with box
+    double match(Frame&, Rect&);
+
+    // Search displacements on a square grid around box (box is updated to best match)
+    double search(Frame&, Rect&, int radius, int step);
+
+    double searchRadius;                // Search radius (relative to box size)
+    double updateRate;                  // Template blending factor on every match
+    bool valid;                         // Template has been initialized
+    double templ[N_CELLS*N_CELLS];      // Normalized template
+    double patch[N_CELLS*N_CELLS];      // Scratch normalized patch
+};
+
+#endif // TRACKER_H
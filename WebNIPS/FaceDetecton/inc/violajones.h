@@ -2,6 +2,14 @@
 #define VIOLA_JONES_H
 
 #include <vector>
+#include <string>
+#include <chrono>
+#include "stats.h"
+
+class CostMap;
+class LbpCascade;
+class ScaledCascade;
+class ScaledLbpCascade;
 
 class Rect
 {
@@ -58,14 +66,18 @@ std::vector<double> split(std::string str, char delimiter);
 class Frame
 {
 public:
-    // Frame constructor
-    Frame(float* dt, float* sqDt, unsigned int w, unsigned int h): data(dt), sqData(sqDt), width(w), height(h) {}
+    // Frame constructor (tilted integral image optional, needed by tilted features; integer
+    // integral image optional, needed by LBP cascades)
+    Frame(float* dt, float* sqDt, unsigned int w, unsigned int h, float* tiltDt = 0, unsigned int* intDt = 0):
+          data(dt), sqData(sqDt), tiltData(tiltDt), intData(intDt), width(w), height(h) {}
 
     //Getters
     unsigned int getWidth() {return width;}
     unsigned int getHeight() {return height;}
     float* getData() {return data;}
     float* getsqData() {return sqData;}
+    float* getTiltData() {return tiltData;}
+    unsigned int* getIntData() {return intData;}
 
     // Access data
     double get(unsigned int x, unsigned int y);
@@ -88,9 +100,15 @@ public:
     // Compute standard deviation
     double stdDevOver(Rect&);
 
+    // Extract mean, divide by standard deviation and get sum over 45 degree rotated Rect (top
+    // corner at x, y; width along the down right diagonal, height along the down left one)
+    double tiltedSumOver(Rect&, double, double);
+
 private:
     float* data;    // Pointer to data
     float* sqData;  // Pointer to squared data
+    float* tiltData;// Pointer to tilted data (null if not computed)
+    unsigned int* intData; // Pointer to integer data (grey r+g+b, null if not computed)
     unsigned int width;     // Frame width
     unsigned int height;    // Frame height
 };
@@ -103,13 +121,17 @@ public:
     double lVal;                                   // Value to accumulate if <T
     double rVal;                                   // Value to accumulate if >T
     std::pair<unsigned int, unsigned int> refSize; // Reference window size (pixels)
+    bool tilted;                                   // Rects rotated 45 degrees (Lienhart extended set)
 
     // Constructor
-    Feature(std::vector<std::pair<Rect,double> >& r, double t, double lV, double rV, std::pair<unsigned int, unsigned int> rfSz):
-            rect(r), T(t), lVal(lV), rVal(rV), refSize(rfSz) {}
+    Feature(std::vector<std::pair<Rect,double> >& r, double t, double lV, double rV, std::pair<unsigned int, unsigned int> rfSz, bool tlt = false):
+            rect(r), T(t), lVal(lV), rVal(rV), refSize(rfSz), tilted(tlt) {}
 
     // Extract feature from frame
-    double extract(Rect&, Frame&, double mean, double stdDev);
+    double extract(Rect&, Frame&, double mean, double stdDev) const;
+
+    // Feature of the horizontally mirrored window (rects reflected within the reference window)
+    Feature mirror() const;
 };
 
 class Stage
@@ -121,8 +143,12 @@ public:
     // Stage constructor
     Stage(std::vector<Feature> f, double t): feat(f), T(t) {}
 
-    // Apply stage to frame
-    std::vector<Rect> apply(std::vector<Rect>, Frame&);
+    // Apply stage to frame (FD_STATS: accumulating its statistics into stats, if given)
+#ifdef FD_STATS
+    std::vector<Rect> apply(std::vector<Rect>, Frame&, StageStats* stats = 0) const;
+#else
+    std::vector<Rect> apply(std::vector<Rect>, Frame&) const;
+#endif
 };
 
 class Cascade
@@ -131,15 +157,146 @@ public:
     unsigned int sizeH;         // Reference height (pixels)
     unsigned int sizeW;         // Reference width (pixels)
     std::vector<Stage> layer;
+    bool tilted;                // Some feature is tilted (needs the tilted integral image)
+
+    typedef ScaledCascade Scaled;
 
     //Cascade default constructor
-    Cascade():sizeH(0),sizeW(0),layer(){}
+    Cascade():sizeH(0),sizeW(0),layer(),tilted(false){}
 
     // Constructor from file
     Cascade(std::string& file);
 
     // Constructor from specific data array
     Cascade(const int W, const int H, double haar1[2912][20]);
+
+    // Cascade of the horizontally mirrored object (e.g. profile faces facing the other way)
+    Cascade mirror() const;
+
+    // Built-in frontal face cascade (haar.h), shared by all detectors
+    static const Cascade& frontal();
+
+    // Cascade of a text file (see utils/xml_parser.py), loaded once and shared by all detectors,
+    // mirrored if requested. Null if the file cannot be read
+    static const Cascade* fromFile(const std::string& path, bool mirrored = false);
+};
+
+// Features of a cascade scaled to a window size once, shared by all windows of that size. Feature
+// rects become corner offsets into the integral image (tilted one for tilted features), evaluated
+// as Feature::extract does (same operations in the same order, so results are identical)
+class ScaledCascade
+{
+public:
+    ScaledCascade(const Cascade& c): cascade(c), winW(-1), winH(-1) {}
+
+    // Scale features to the window size, if not already done
+    void scaleTo(int w, int h, int stride)
+    {
+        if (w==this->winW && h==this->winH)
+            return;
+
+        this->winW = w;
+        this->winH = h;
+        this->boxes.clear();
+        this->feats.clear();
+        this->stageEnd.clear();
+
+        for (std::vector<Stage>::const_iterator lyr = this->cascade.layer.begin(); lyr!=this->cascade.layer.end(); ++lyr)
+        {
+            for (std::vector<Feature>::const_iterator f = lyr->feat.begin(); f!=lyr->feat.end(); ++f)
+            {
+                double scaleX = w/f->refSize.first;
+                double scaleY = h/f->refSize.second;
+
+                ScaledFeature feat = {(unsigned int)this->boxes.size(), 0, f->T, f->lVal, f->rVal, f->tilted};
+                for (std::vector<std::pair<Rect,double> >::const_iterator r = f->rect.begin(); r!=f->rect.end(); ++r)
+                {
+                    Rect scaled = r->first;
+                    scaled.scale(scaleX, scaleY);
+
+                    int x = scaled.getX();
+                    int y = scaled.getY();
+                    int rw = scaled.getWidth();
+                    int rh = scaled.getHeight();
+                    if (f->tilted)
+                    {
+                        // Top, left, right and bottom corners (see Frame::tiltedSumOver)
+                        ScaledBox box = {x + y*stride, x - rh + (y + rh)*stride, x + rw + (y + rw)*stride,
+                                         x + rw - rh + (y + rw + rh)*stride, rw, 2*rh, r->second};
+                        this->boxes.push_back(box);
+                    }
+                    else
+                    {
+                        ScaledBox box = {x + y*stride, x + rw + y*stride, x + (y + rh)*stride, x + rw + (y + rh)*stride,
+                                         rw, rh, r->second};
+                        this->boxes.push_back(box);
+                    }
+                }
+                feat.last = this->boxes.size();
+                this->feats.push_back(feat);
+            }
+            this->stageEnd.push_back(this->feats.size());
+        }
+    }
+
+    unsigned int getStages() const {return stageEnd.size();}
+    unsigned int getFeatures(unsigned int s) const {return stageEnd[s] - (s>0 ? stageEnd[s-1] : 0);}
+
+    // Test stage s on the window at integral image position origin (tilt: tilted integral image)
+    bool passes(unsigned int s, const float* data, const float* tilt, unsigned int origin, double mean, double stdDev) const
+    {
+        double val = 0;
+        for (unsigned int f = s>0 ? this->stageEnd[s-1] : 0; f<this->stageEnd[s]; ++f)
+        {
+            const ScaledFeature& feat = this->feats[f];
+            const float* win = (feat.tilted ? tilt : data) + origin;
+
+            double featVal = 0;
+            for (unsigned int b=feat.first; b<feat.last; ++b)
+            {
+                const ScaledBox& box = this->boxes[b];
+                double curVal = win[box.bottomRight];
+                double upVal = win[box.topRight];
+                double leftVal = win[box.bottomLeft];
+                double diagVal = win[box.topLeft];
+
+                featVal += box.weight*((curVal - upVal - leftVal + diagVal)/stdDev - mean*box.height*box.width);
+            }
+
+            val += featVal>feat.T ? feat.lVal : feat.rVal;
+        }
+
+        return val<this->cascade.layer[s].T;
+    }
+
+private:
+    struct ScaledBox
+    {
+        int topLeft;            // Corner offsets from the window origin (integral image elements;
+        int topRight;           // top, left, right and bottom corners of tilted rects)
+        int bottomLeft;
+        int bottomRight;
+        int width;
+        int height;             // Twice the height of tilted rects (2*w*h pixels)
+        double weight;
+    };
+
+    struct ScaledFeature
+    {
+        unsigned int first;     // Boxes [first, last)
+        unsigned int last;
+        double T;
+        double lVal;
+        double rVal;
+        bool tilted;
+    };
+
+    const Cascade& cascade;
+    int winW;                   // Window size the features are scaled to (-1: none)
+    int winH;
+    std::vector<ScaledBox> boxes;
+    std::vector<ScaledFeature> feats;
+    std::vector<unsigned int> stageEnd;  // Features [stageEnd[s-1], stageEnd[s]) form stage s
 };
 
 class Detector
@@ -148,17 +305,64 @@ public:
     const double scale;         // Control scaling during application (1: no scaling)
     const double shift;         // Control shifting during application (in %)
     const unsigned int wSize;   // Reference square window size during application (pixels)
+    const unsigned int nScales; // Number of scales applied, starting at wSize
+    CostMap* costMap;           // Cost heatmap to accumulate into (optional)
+    double aspect;              // Window height relative to its width (cascade reference size)
+    double confidence;          // Merged windows needed for a detection
 
-    Detector(double sc, double sh, const unsigned int sz): scale(sc), shift(sh), wSize(sz){}
+    Detector(double sc, double sh, const unsigned int sz, const unsigned int nSc = 5): scale(sc), shift(sh), wSize(sz), nScales(nSc), costMap(0), aspect(1), confidence(10){}
 
     // Apply cascaded detector to image
-    Rect apply(Cascade&, Rect&, Frame&);
+    Rect apply(const Cascade&, Rect&, Frame&);
+
+    // Apply several cascades to image in a single pass (same window aspect ratio expected). Return
+    // the best detection of all of them
+    Rect apply(const std::vector<const Cascade*>&, Rect&, Frame&);
+
+    // Apply cascaded detector to image until deadline, most likely windows first (prior: last face,
+    // empty if none). complete is false if the deadline stopped the scan
+    Rect apply(const Cascade&, Rect& roi, Frame&, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete);
+    Rect apply(const std::vector<const Cascade*>&, Rect& roi, Frame&, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete);
+
+    // Apply cascaded detector at a single scale (0: wSize). Return merged positive and its confidence
+    std::pair<Rect,double> scan(const Cascade&, Rect&, Frame&, unsigned int sc);
+
+    // Apply several cascades at a single scale. Return merged positive and confidence of each one
+    std::vector<std::pair<Rect,double> > scan(const std::vector<const Cascade*>&, Rect&, Frame&, unsigned int sc);
+
+    // Choose final detection among per-scale positives (positives are reordered)
+    Rect select(std::vector<std::pair<Rect,double> >&);
 
     // Apply detector to set of windows in image
-    std::vector<Rect> step(Cascade&, std::vector<Rect>, Frame&);
+    std::vector<Rect> step(const Cascade&, std::vector<Rect>, Frame&);
+
+    // Apply several cascades to set of windows in image. Return positive windows of each one
+    std::vector<std::vector<Rect> > step(const std::vector<const Cascade*>&, std::vector<Rect>&, Frame&);
+
+    // As above, with the features of every cascade scaled by a previous step (scaled[m] of
+    // cascades[m]), e.g. for successive chunks of windows of one scale
+    std::vector<std::vector<Rect> > step(const std::vector<const Cascade*>&, std::vector<ScaledCascade>& scaled, std::vector<Rect>&, Frame&);
+
+    // LBP engine (lbp.h): the same applications with LBP cascades, on the integer integral image of
+    // the frame
+    Rect apply(const std::vector<const LbpCascade*>&, Rect&, Frame&);
+    Rect apply(const std::vector<const LbpCascade*>&, Rect& roi, Frame&, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete);
+    std::vector<std::pair<Rect,double> > scan(const std::vector<const LbpCascade*>&, Rect&, Frame&, unsigned int sc);
+    std::vector<Rect> step(const LbpCascade&, std::vector<Rect>&, Frame&);
+    std::vector<std::vector<Rect> > step(const std::vector<const LbpCascade*>&, std::vector<Rect>&, Frame&);
+    std::vector<std::vector<Rect> > step(const std::vector<const LbpCascade*>&, std::vector<ScaledLbpCascade>& scaled, std::vector<Rect>&, Frame&);
 
     // Generate set of windows in ROI
     std::vector<Rect> generateWindows(Rect& roi, Rect& win);
+
+    // Window scale factor at scale index sc
+    double getScale(unsigned int sc);
+
+private:
+    // Applications shared by both engines (Model: Cascade or LbpCascade)
+    template<class Model> Rect applyModels(const std::vector<const Model*>&, Rect&, Frame&);
+    template<class Model> Rect applyModels(const std::vector<const Model*>&, Rect& roi, Frame&, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete);
+    template<class Model> std::vector<std::pair<Rect,double> > scanModels(const std::vector<const Model*>&, Rect&, Frame&, unsigned int sc);
 };
 
 // Merge overlapped windows
@@ -171,6 +375,9 @@ public:
     // Apply merging to set of windows according to criteria
     std::pair<Rect,double> apply(Frame&, std::vector<Rect>&, unsigned int);
 
+    // Apply merging to set of windows found in roi (smaller grid, same result)
+    std::pair<Rect,double> apply(Rect& roi, std::vector<Rect>&, unsigned int);
+
     // Get cluster representatnt as mean of all members of the cluster
     std::pair<int, int> getClusterRepresentant(std::vector<std::pair<int, int> >& in);
 
@@ -178,26 +385,147 @@ private:
     double confidence;               // Merger parameter
 };
 
+// Constant velocity model of the face box (alpha-beta filter, i.e. steady-state Kalman)
+class MotionModel
+{
+public:
+    // Constructor (alpha: position gain, beta: velocity gain)
+    MotionModel(double a, double b): alpha(a), beta(b), valid(false) {}
+
+    // Restart the model at a given box with null velocity
+    void reset(Rect&);
+
+    // Advance the model one frame and return the predicted box
+    Rect predict();
+
+    // Correct the last prediction with a measured box
+    void correct(Rect&);
+
+    // Keep the last prediction when no measurement is available
+    void coast();
+
+    // Forget the face
+    void invalidate() {valid = false;}
+
+    bool isValid() {return valid;}
+
+private:
+    double alpha;               // Position gain
+    double beta;                // Velocity gain
+    bool valid;                 // A face is being followed
+    double state[3];            // Center x, center y, size (pixels)
+    double velocity[3];         // Change of state per frame
+    double predicted[3];        // State predicted for the current frame
+};
+
+// Facial part searched inside the face box with its own cascade (e.g. eyes, mouth)
+struct FacePart
+{
+    const Cascade* cascade;     // Shared, read-only
+    double x;                   // Search region, relative to the face box (fractions of its size)
+    double y;
+    double w;
+    double h;
+    double minSize;             // Part window widths searched, relative to the face width
+    double maxSize;
+};
+
+class TemplateTracker;
+class GreyFrame;
+
 class ViolaJones
 {
 float* integralImage;
 float* sqIntegralImage;
-Cascade cascade;
+float* tiltIntegralImage;       // Computed with the integral image if a cascade needs it (else null)
+unsigned int* lbpIntegralImage; // Integer integral image of the LBP engine (else null)
+std::vector<const Cascade*> cascades; // Face models, frontal first (shared, read-only)
+std::vector<const LbpCascade*> lbpCascades; // LBP face models, replacing the Haar ones if any
 int    imW;
 int    imH;
-static const int nChn = 4;
+
+// Tracking state
+MotionModel  motion;
+TemplateTracker* tracker;       // Inter-frame tracker used between cascade runs
+unsigned int misses;            // Consecutive frames tracked without detection
+unsigned int sinceDetect;       // Frames tracked since last whole frame detection
+unsigned int sinceValidate;     // Frames followed by the tracker since last cascade detection
+Rect         lastFace;          // Last face found (prior of budgeted detection)
+CostMap*     costMap;           // Cost heatmap (optional)
+bool         squareCurrent;     // Squared integral image is of the last frame (tracking may skip it)
+std::vector<FacePart> parts;    // Facial parts searched by detectParts
 
 public:
     ViolaJones(int w, int h);
     ~ViolaJones();
-    Rect detect(unsigned char* image, unsigned short* rect);
-    Rect track(unsigned char* image, unsigned short* rect, unsigned short* roi);
+    Rect detect(GreyFrame& grey, unsigned short* rect);
+    Rect detect(Frame& frame, unsigned short* rect);
+    Rect detect(GreyFrame& grey, unsigned short* rect, double budget, bool& complete);
+    Rect track(GreyFrame& grey, unsigned short* rect);
+    void integrate(GreyFrame& grey, float* intIm, float* sqIntIm, float* tiltIm = 0, unsigned int* lbpIm = 0);
+
+    // Tables integrate has to build for frames detected with detect(Frame&): tilted integral image
+    // (tilted features), integer integral image (LBP engine)
+    bool needsTilted() {return tiltIntegralImage!=0;}
+    bool needsInteger() {return lbpIntegralImage!=0;}
+
+    // Integral images of the sum plane of a frame (GreyFrame::getSum)
+    void generateIntegralImage(const unsigned short* sum, float* intIm);
+    void generateIntegralImages(const unsigned short* sum, float* intIm, float* tiltIm);
+    void generateIntegerIntegralImage(const unsigned short* sum, unsigned int* intIm);
+    void generateSquareIntegralImage(const unsigned short* sum, float* intIm);
+
+    // Whole frame detection split by scale, so one frame can be spread over several threads
+    unsigned int getScales();
+    std::pair<Rect,double> scan(Frame& frame, unsigned int sc);
+    Rect select(std::vector<std::pair<Rect,double> >& positives);
     int getW() {return imW;}
     int getH() {return imH;}
 
+    // Additional face model (e.g. profile faces), applied with the frontal one in the same pass.
+    // Windows are shared, so its reference window should be square too. Return model count
+    unsigned int addCascade(const Cascade* cascade);
+    unsigned int getCascades() {return cascades.size();}
+
+    // Switch face detection to the LBP engine (lbp.h), applying the LBP cascades added instead of the
+    // Haar ones. Return LBP model count
+    unsigned int addLbpCascade(const LbpCascade* cascade);
+    unsigned int getLbpCascades() {return lbpCascades.size();}
+
+    // Facial parts, searched inside a face on the integral images of the last frame detected or
+    // tracked. Return part index
+    unsigned int addPart(const FacePart& part);
+    unsigned int getParts() {return parts.size();}
+
+    // Detect every part inside face, on the integral images of grey (the frame last passed to
+    // detect or track) or of frame. found: one box per part, empty if not found
+    void detectParts(GreyFrame& grey, Rect& face, std::vector<Rect>& found);
+    void detectParts(Frame& frame, Rect& face, std::vector<Rect>& found);
+
+    // Build the integral images detectParts still needs from grey (the frame last passed to
+    // detect or track), before grey is updated to another frame
+    void keepFrame(GreyFrame& grey);
+
+    // Cost heatmap of the detections (cell: cell size in pixels, 0 disables). Null if disabled
+    void enableCostMap(unsigned int cell);
+    CostMap* getCostMap() {return costMap;}
+
 private:
-    void generateIntegralImage(unsigned char* image);
-    void generateSquareIntegralImage(unsigned char* image);
+    // Apply cascade to the whole frame (integral images already computed)
+    Rect detectFrame(Frame&);
+
+    // Integral image of a frame, with the tilted one if a cascade needs it and the integer one if
+    // the LBP engine is used
+    void integrateFrame(GreyFrame& grey);
+
+    // Squared integral image of a frame, if the Haar cascades are used
+    void squareFrame(GreyFrame& grey);
+
+    // Faces of frame are detected with the LBP cascades
+    bool lbpEngine(Frame& frame);
+
+    // Face models usable on frame (cascades with tilted features need its tilted integral image)
+    std::vector<const Cascade*> usableCascades(Frame& frame);
 };
 
 #endif
@@ -0,0 +1,690 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "../inc/bbf.h"
+#include "../inc/trace.h"
+
+#if defined(__wasm_simd128__)
+#define BBF_WASM_SIMD 1
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#define BBF_SSE2 1
+#include <emmintrin.h>
+#endif
+
+const char BBF_MAGIC[4] = {'F', 'D', 'B', 'B'};
+const int BBF_VERSION = 1;
+
+const int BBF_LANES = 16;       // Windows compared at once (adjacent in a row)
+const int BBF_PAD = GreyFrame::PAD;  // Bytes after every plane row set, read by the last windows' lanes
+const int BBF_START = 4;        // First level searched (as ccv.js)
+
+
+// ***************************************************************
+// ** BBF CASCADE
+// ***************************************************************
+
+bool BbfCascade::load(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+
+    std::vector<unsigned char> data;
+    unsigned char chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f))>0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(f);
+
+    return !data.empty() && this->load(&data[0], data.size());
+}
+
+/** BbfCascade::load
+  * Load a cascade from memory (format in bbf.h, host assumed little endian)
+  * data: cascade file contents
+  * size: bytes
+  **/
+bool BbfCascade::load(const unsigned char* data, unsigned int size)
+{
+    int header[5];
+    if(size<sizeof(header) || memcmp(data, BBF_MAGIC, 4)!=0)
+        return false;
+    memcpy(header, data, sizeof(header));
+
+    int width = header[2];
+    int height = header[3];
+    int nStages = header[4];
+    if(header[1]!=BBF_VERSION || width<4 || height<4 || nStages<=0)
+        return false;
+
+    // Read into a new cascade, replacing this one only if valid. Points are checked to lie inside
+    // the window at their octave, so scanning needs no checks
+    const unsigned char* p = data + sizeof(header);
+    const unsigned char* end = data + size;
+    std::vector<BbfStage> stages(nStages);
+    for(int s=0; s<nStages; ++s)
+    {
+        int nFeatures;
+        if(end - p<static_cast<long>(sizeof(int) + sizeof(double)))
+            return false;
+        memcpy(&nFeatures, p, sizeof(int));
+        memcpy(&stages[s].T, p + sizeof(int), sizeof(double));
+        p += sizeof(int) + sizeof(double);
+        if(nFeatures<=0)
+            return false;
+
+        stages[s].feat.resize(nFeatures);
+        for(int k=0; k<nFeatures; ++k)
+        {
+            BbfFeature& f = stages[s].feat[k];
+            if(end - p<static_cast<long>(sizeof(int)))
+                return false;
+            memcpy(&f.size, p, sizeof(int));
+            p += sizeof(int);
+            if(f.size<=0 || f.size>BBF_MAX_POINTS ||
+               end - p<static_cast<long>(6*f.size*sizeof(int) + 2*sizeof(double)))
+                return false;
+
+            int* fields[6] = {f.px, f.py, f.pz, f.nx, f.ny, f.nz};
+            for(int c=0; c<6; ++c)
+            {
+                memcpy(fields[c], p, f.size*sizeof(int));
+                p += f.size*sizeof(int);
+            }
+            memcpy(f.alpha, p, 2*sizeof(double));
+            p += 2*sizeof(double);
+
+            if(f.pz[0]<0 || f.nz[0]<0)
+                return false;
+            for(int i=0; i<f.size; ++i)
+            {
+                if(f.pz[i]>2 || (f.pz[i]>=0 && (f.px[i]<0 || f.px[i]>=width>>f.pz[i] || f.py[i]<0 || f.py[i]>=height>>f.pz[i])))
+                    return false;
+                if(f.nz[i]>2 || (f.nz[i]>=0 && (f.nx[i]<0 || f.nx[i]>=width>>f.nz[i] || f.ny[i]<0 || f.ny[i]>=height>>f.nz[i])))
+                    return false;
+            }
+        }
+    }
+    if(p!=end)
+        return false;
+
+    this->stage.swap(stages);
+    this->width = width;
+    this->height = height;
+    return true;
+}
+
+// ***************************************************************
+// ** COMPARISON KERNELS
+// ***************************************************************
+
+// Comparison kernels test one feature on the BBF_LANES windows of a row starting at x: bit l of the
+// result is set if the feature is true for window x+l. A point's pixel for window x is at
+// base + rowOff[z] + x. Accumulation kernels then add the value chosen by every window to its sum
+// (double, as ccv.js: alpha values are selected, never combined, so sums are exact)
+
+static inline const unsigned char* pixel(const BbfDetector::Point& p, const int* rowOff, int x)
+{
+    return p.base + rowOff[p.z] + x;
+}
+
+// Windows of lanes only (the others are left out, clear)
+static unsigned int compareScalar(const BbfDetector::Point* p, int nP, int nN, const int* rowOff, int x, unsigned int lanes)
+{
+    unsigned int mask = 0;
+    for(int l=0; l<BBF_LANES; ++l)
+    {
+        if(!(lanes & (1u<<l)))
+            continue;
+
+        int pmin = 255;
+        for(int k=0; k<nP; ++k)
+            pmin = std::min(pmin, (int)pixel(p[k], rowOff, x)[l]);
+        int nmax = 0;
+        for(int k=nP; k<nP+nN; ++k)
+            nmax = std::max(nmax, (int)pixel(p[k], rowOff, x)[l]);
+
+        if(pmin>nmax)
+            mask |= 1u<<l;
+    }
+    return mask;
+}
+
+// Lanes 2j, 2j+1 choosing alpha[1] for bits 2j, 2j+1 (all bits set)
+alignas(16) static const unsigned long long PAIR_MASKS[4][2] = {{0, 0}, {~0ull, 0}, {0, ~0ull}, {~0ull, ~0ull}};
+
+static void accumulateScalar(double* sum, unsigned int bits, const double* alpha, unsigned int lanes)
+{
+    for(unsigned int m=lanes; m; m&=m-1)
+    {
+        int l = __builtin_ctz(m);
+        sum[l] += alpha[(bits>>l) & 1];
+    }
+}
+
+#ifdef BBF_SSE2
+static void accumulateSse2(double* sum, unsigned int bits, const double* alpha)
+{
+    __m128d a0 = _mm_set1_pd(alpha[0]);
+    __m128d a1 = _mm_set1_pd(alpha[1]);
+    for(int j=0; j<BBF_LANES; j+=2, bits>>=2)
+    {
+        __m128d mask = _mm_castsi128_pd(_mm_load_si128((const __m128i*)PAIR_MASKS[bits & 3]));
+        __m128d v = _mm_or_pd(_mm_and_pd(mask, a1), _mm_andnot_pd(mask, a0));
+        _mm_store_pd(sum + j, _mm_add_pd(_mm_load_pd(sum + j), v));
+    }
+}
+
+static unsigned int compareSse2(const BbfDetector::Point* p, int nP, int nN, const int* rowOff, int x)
+{
+    __m128i pmin = _mm_loadu_si128((const __m128i*)pixel(p[0], rowOff, x));
+    for(int k=1; k<nP; ++k)
+        pmin = _mm_min_epu8(pmin, _mm_loadu_si128((const __m128i*)pixel(p[k], rowOff, x)));
+    __m128i nmax = _mm_loadu_si128((const __m128i*)pixel(p[nP], rowOff, x));
+    for(int k=nP+1; k<nP+nN; ++k)
+        nmax = _mm_max_epu8(nmax, _mm_loadu_si128((const __m128i*)pixel(p[k], rowOff, x)));
+
+    // pmin > nmax where the saturated difference is not null
+    __m128i none = _mm_cmpeq_epi8(_mm_subs_epu8(pmin, nmax), _mm_setzero_si128());
+    return ~_mm_movemask_epi8(none) & 0xffff;
+}
+#endif
+
+#ifdef BBF_WASM_SIMD
+static void accumulateWasm(double* sum, unsigned int bits, const double* alpha)
+{
+    v128_t a0 = wasm_f64x2_splat(alpha[0]);
+    v128_t a1 = wasm_f64x2_splat(alpha[1]);
+    for(int j=0; j<BBF_LANES; j+=2, bits>>=2)
+    {
+        v128_t v = wasm_v128_bitselect(a1, a0, wasm_v128_load(PAIR_MASKS[bits & 3]));
+        wasm_v128_store(sum + j, wasm_f64x2_add(wasm_v128_load(sum + j), v));
+    }
+}
+
+static unsigned int compareWasm(const BbfDetector::Point* p, int nP, int nN, const int* rowOff, int x)
+{
+    v128_t pmin = wasm_v128_load(pixel(p[0], rowOff, x));
+    for(int k=1; k<nP; ++k)
+        pmin = wasm_u8x16_min(pmin, wasm_v128_load(pixel(p[k], rowOff, x)));
+    v128_t nmax = wasm_v128_load(pixel(p[nP], rowOff, x));
+    for(int k=nP+1; k<nP+nN; ++k)
+        nmax = wasm_u8x16_max(nmax, wasm_v128_load(pixel(p[k], rowOff, x)));
+
+    return wasm_i8x16_bitmask(wasm_u8x16_gt(pmin, nmax));
+}
+#endif
+
+static unsigned int compare(const BbfDetector::Point* p, int nP, int nN, const int* rowOff, int x, unsigned int lanes, bool simd)
+{
+#if defined(BBF_SSE2)
+    if(simd)
+        return compareSse2(p, nP, nN, rowOff, x) & lanes;
+#elif defined(BBF_WASM_SIMD)
+    if(simd)
+        return compareWasm(p, nP, nN, rowOff, x) & lanes;
+#endif
+    return compareScalar(p, nP, nN, rowOff, x, lanes);
+}
+
+// Sums of windows out of lanes are left undefined
+static void accumulate(double* sum, unsigned int bits, const double* alpha, unsigned int lanes, bool simd)
+{
+#if defined(BBF_SSE2)
+    if(simd)
+    {
+        accumulateSse2(sum, bits, alpha);
+        return;
+    }
+#elif defined(BBF_WASM_SIMD)
+    if(simd)
+    {
+        accumulateWasm(sum, bits, alpha);
+        return;
+    }
+#endif
+    accumulateScalar(sum, bits, alpha, lanes);
+}
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+BbfDetector::BbfDetector(int w, int h): w(w), h(h), cascadeW(0), cascadeH(0), interval(0), scaleUpto(0), scale(1)
+{
+}
+
+const char* BbfDetector::simdKernel()
+{
+#if defined(BBF_SSE2)
+    return "sse2";
+#elif defined(BBF_WASM_SIMD)
+    return "wasm-simd128";
+#else
+    return "scalar";
+#endif
+}
+
+/** BbfDetector::detect
+  * Detect the objects of a cascade in a frame, as ccv.detect_objects on its grey canvas
+  * cascade: BBF cascade
+  * grey: grey planes of the frame (w x h), the pyramid starts from its luma ones
+  * interval: pyramid levels per octave (besides the octave itself)
+  * minNeighbors: fewest windows of a group to report it (0: every window, ungrouped)
+  * found: objects found
+  * simd: use the vectorized comparison kernel if available
+  **/
+void BbfDetector::detect(const BbfCascade& cascade, GreyFrame& grey, int interval, int minNeighbors,
+                         std::vector<BbfDetection>& found, bool simd)
+{
+    found.clear();
+    if(!cascade.isLoaded() || interval<0)
+        return;
+
+    this->layout(cascade, interval);
+    {
+        TraceSpan span("bbf_pyramid");
+        this->buildPyramid(grey);
+    }
+    {
+        TraceSpan span("bbf_scan");
+        this->scan(cascade, simd);
+    }
+    TraceSpan span("bbf_group");
+    this->group(minNeighbors, found);
+}
+
+// ***************************************************************
+// ** PRIVATE CLASS METHODS
+// ***************************************************************
+
+/** BbfDetector::layout
+  * Size the pyramid planes (as ccv.js, for the cascade size and interval) and allocate them and
+  * their resamplers, unless already done. Later frames reuse them. The frame and its octaves
+  * (planes 4*next*m) are the luma pyramid of the frame: they only get a zero plane, used if empty
+  **/
+void BbfDetector::layout(const BbfCascade& cascade, int interval)
+{
+    if(cascade.width==this->cascadeW && cascade.height==this->cascadeH && interval==this->interval)
+        return;
+
+    this->cascadeW = cascade.width;
+    this->cascadeH = cascade.height;
+    this->interval = interval;
+    this->scale = pow(2.0, 1.0/(interval + 1));
+    int next = interval + 1;
+
+    double fit = std::min((double)this->w/cascade.width, (double)this->h/cascade.height);
+    this->scaleUpto = std::max(0, static_cast<int>(floor(log(fit)/log(this->scale))));
+    int nLevels = this->scaleUpto + 2*next;
+
+    this->pyr.assign(4*nLevels, Plane());
+    this->pyr[0].w = this->w;
+    this->pyr[0].h = this->h;
+    for(int i=1; i<=interval && i<nLevels; ++i)
+    {
+        this->pyr[4*i].w = static_cast<int>(floor(this->w/pow(this->scale, i)));
+        this->pyr[4*i].h = static_cast<int>(floor(this->h/pow(this->scale, i)));
+    }
+    for(int i=next; i<nLevels; ++i)
+    {
+        // Octave below, then its copies shifted by one pixel right, down and both (2 pixel border)
+        for(int q=0; q<4; ++q)
+        {
+            this->pyr[4*i+q].w = this->pyr[4*(i-next)].w/2;
+            this->pyr[4*i+q].h = this->pyr[4*(i-next)].h/2;
+        }
+    }
+
+    this->resamplers.clear();
+    for(unsigned int k=0; k<this->pyr.size(); ++k)
+    {
+        Plane& plane = this->pyr[k];
+        bool octave = k%(4*next)==0;
+        plane.storage.assign(octave ? BBF_PAD : plane.w*plane.h + BBF_PAD, 0);
+        plane.data = &plane.storage[0];
+        int dstW = std::max(0, plane.w - (k%2 ? 2 : 0));
+        int dstH = std::max(0, plane.h - (k%4>=2 ? 2 : 0));
+        this->resamplers.push_back(Resampler(dstW, dstH, Resampler::BILINEAR));
+    }
+}
+
+/** BbfDetector::buildPyramid
+  * Luma frame and its octaves (GreyFrame), interval levels and their octaves (ccv.js pre).
+  * Shifted planes are only built for the levels searched
+  **/
+void BbfDetector::buildPyramid(GreyFrame& grey)
+{
+    int next = this->interval + 1;
+    int nLevels = this->pyr.size()/4;
+    for(int i=0; i<nLevels; i+=next)
+    {
+        // Octave i/next of the frame, halved as ccv.js does (null only if empty)
+        const unsigned char* octave = grey.getLuma(i/next);
+        if(octave)
+            this->pyr[4*i].data = octave;
+    }
+
+    const Plane& frame = this->pyr[0];
+    for(int i=1; i<=this->interval && i<nLevels; ++i)
+        this->resample(frame, Rect(0, 0, frame.w, frame.h), this->pyr[4*i], 4*i);
+
+    for(int i=next; i<nLevels; ++i)
+    {
+        const Plane& src = this->pyr[4*(i-next)];
+        if(i%next!=0)
+            this->resample(src, Rect(0, 0, src.w, src.h), this->pyr[4*i], 4*i);
+        if(i<2*next + BBF_START)
+            continue;
+
+        this->resample(src, Rect(1, 0, src.w-1, src.h), this->pyr[4*i+1], 4*i+1);
+        this->resample(src, Rect(0, 1, src.w, src.h-1), this->pyr[4*i+2], 4*i+2);
+        this->resample(src, Rect(1, 1, src.w-1, src.h-1), this->pyr[4*i+3], 4*i+3);
+    }
+}
+
+/** BbfDetector::resample
+  * Resample box of src into the top left of dst with resampler r (size of the area drawn). The
+  * rest of dst stays black, as the canvas ccv.js draws on
+  **/
+void BbfDetector::resample(const Plane& src, Rect box, Plane& dst, unsigned int r)
+{
+    Resampler& resampler = this->resamplers[r];
+    int dstW = resampler.getW();
+    int dstH = resampler.getH();
+    if(dstW<=0 || dstH<=0 || box.getWidth()<=0 || box.getHeight()<=0)
+        return;
+
+    if(dstW==dst.w)
+    {
+        resampler.apply(src.data, src.w, src.h, src.w, 1, box, &dst.storage[0]);
+        return;
+    }
+
+    this->shifted.resize(dstW*dstH);
+    resampler.apply(src.data, src.w, src.h, src.w, 1, box, &this->shifted[0]);
+    for(int y=0; y<dstH; ++y)
+        memcpy(&dst.storage[y*dst.w], &this->shifted[y*dstW], dstW);
+}
+
+/** BbfDetector::split
+  * Deinterleave the columns of a plane into phases planes (column c into plane c%phases at c/phases),
+  * so windows sampling every phases-th pixel read adjacent bytes
+  * stride: row size of every phase plane (padded for the last windows' lanes)
+  **/
+void BbfDetector::split(const Plane& src, int phases, std::vector<unsigned char>& dst, int& stride)
+{
+    stride = (src.w + phases - 1)/phases + BBF_PAD;
+    dst.assign(phases*stride*src.h + BBF_PAD, 0);
+
+    for(int y=0; y<src.h; ++y)
+    {
+        const unsigned char* row = src.data + y*src.w;
+        for(int r=0; r<phases; ++r)
+        {
+            unsigned char* out = &dst[(r*src.h + y)*stride];
+            for(int c=r, i=0; c<src.w; c+=phases, ++i)
+                out[i] = row[c];
+        }
+    }
+}
+
+/** BbfDetector::scan
+  * Test every window of the levels searched (ccv.js core), BBF_LANES adjacent windows at a time,
+  * into seq in the order of ccv.js. A window at (x, y) of level i and shift q samples octave 0
+  * at (4x+2dx, 4y+2dy) of plane 4i, octave 1 at (2x+dx, 2y+dy) of plane 4(i+next) and octave 2
+  * at (x, y) of plane 4(i+2next)+q
+  **/
+void BbfDetector::scan(const BbfCascade& cascade, bool simd)
+{
+    static const int dx[4] = {0, 1, 0, 1};
+    static const int dy[4] = {0, 0, 1, 1};
+
+    this->seq.clear();
+    int next = this->interval + 1;
+    double scaleFac = pow(this->scale, BBF_START);
+    for(int i=BBF_START; i<this->scaleUpto; ++i, scaleFac *= this->scale)
+    {
+        const Plane& level0 = this->pyr[4*i];
+        const Plane& level1 = this->pyr[4*(i+next)];
+        int qw = this->pyr[4*(i+2*next)].w - cascade.width/4;
+        int qh = this->pyr[4*(i+2*next)].h - cascade.height/4;
+        if(qw<=0 || qh<=0)
+            continue;
+
+        int stride0, stride1;
+        this->split(level0, 4, this->phases0, stride0);
+        this->split(level1, 2, this->phases1, stride1);
+
+        for(int q=0; q<4; ++q)
+        {
+            const Plane& level2 = this->pyr[4*(i+2*next)+q];
+
+            // Points of every feature, for the first window of row 0
+            this->points.clear();
+            this->counts.clear();
+            for(std::vector<BbfStage>::const_iterator stg = cascade.stage.begin(); stg!=cascade.stage.end(); ++stg)
+            {
+                for(std::vector<BbfFeature>::const_iterator f = stg->feat.begin(); f!=stg->feat.end(); ++f)
+                {
+                    for(int sign=0; sign<2; ++sign)
+                    {
+                        const int* px = sign ? f->nx : f->px;
+                        const int* py = sign ? f->ny : f->py;
+                        const int* pz = sign ? f->nz : f->pz;
+                        int count = 0;
+                        for(int k=0; k<f->size; ++k)
+                        {
+                            Point p;
+                            p.z = pz[k];
+                            if(p.z==0)
+                            {
+                                int c = 2*dx[q] + px[k];
+                                p.base = &this->phases0[((c&3)*level0.h + 2*dy[q] + py[k])*stride0 + (c>>2)];
+                            }
+                            else if(p.z==1)
+                            {
+                                int c = dx[q] + px[k];
+                                p.base = &this->phases1[((c&1)*level1.h + dy[q] + py[k])*stride1 + (c>>1)];
+                            }
+                            else if(p.z==2)
+                                p.base = level2.data + py[k]*level2.w + px[k];
+                            else
+                                continue;
+
+                            this->points.push_back(p);
+                            count++;
+                        }
+                        this->counts.push_back(count);
+                    }
+                }
+            }
+
+            for(int y=0; y<qh; ++y)
+            {
+                int rowOff[3] = {4*y*stride0, 2*y*stride1, y*level2.w};
+                for(int x=0; x<qw; x+=BBF_LANES)
+                {
+                    unsigned int lanes = qw - x>=BBF_LANES ? (1u<<BBF_LANES) - 1 : (1u<<(qw - x)) - 1;
+                    alignas(16) double sum[BBF_LANES];
+
+                    const Point* p = &this->points[0];
+                    const int* count = &this->counts[0];
+                    for(unsigned int s=0; s<cascade.stage.size() && lanes; ++s)
+                    {
+                        const BbfStage& stg = cascade.stage[s];
+                        std::fill(sum, sum + BBF_LANES, 0.0);
+                        for(unsigned int k=0; k<stg.feat.size(); ++k)
+                        {
+                            unsigned int bits = compare(p, count[0], count[1], rowOff, x, lanes, simd);
+                            accumulate(sum, bits, stg.feat[k].alpha, lanes, simd);
+                            p += count[0] + count[1];
+                            count += 2;
+                        }
+
+                        for(unsigned int m=lanes; m; m&=m-1)
+                        {
+                            int l = __builtin_ctz(m);
+                            if(sum[l]<stg.T)
+                                lanes &= ~(1u<<l);
+                        }
+                    }
+
+                    // Accepted windows, with the sum of the last stage as confidence
+                    for(unsigned int m=lanes; m; m&=m-1)
+                    {
+                        int l = __builtin_ctz(m);
+                        BbfDetection d;
+                        d.x = (4*(x+l) + 2*dx[q])*scaleFac;
+                        d.y = (4*y + 2*dy[q])*scaleFac;
+                        d.width = cascade.width*scaleFac;
+                        d.height = cascade.height*scaleFac;
+                        d.neighbors = 1;
+                        d.confidence = sum[l];
+                        this->seq.push_back(d);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Whether window b is close to window a (ccv.js grouping predicate)
+static bool similar(const BbfDetection& a, const BbfDetection& b)
+{
+    double distance = floor(a.width*0.25 + 0.5);
+    return b.x<=a.x + distance && b.x>=a.x - distance &&
+           b.y<=a.y + distance && b.y>=a.y - distance &&
+           b.width<=floor(a.width*1.5 + 0.5) && b.width*1.5 + 0.5>=a.width;
+}
+
+/** BbfDetector::group
+  * Group similar windows (union-find of ccv.array_group), average the groups of minNeighbors
+  * windows or more and drop those inside a better supported one (ccv.js post)
+  **/
+void BbfDetector::group(int minNeighbors, std::vector<BbfDetection>& found)
+{
+    if(minNeighbors<=0)
+    {
+        found = this->seq;
+        return;
+    }
+
+    std::vector<BbfDetection>& seq = this->seq;
+    std::vector<int>& parent = this->parent;
+    std::vector<int>& rank = this->rank;
+    int n = seq.size();
+    parent.assign(n, -1);
+    rank.assign(n, 0);
+
+    for(int i=0; i<n; ++i)
+    {
+        int root = i;
+        while(parent[root]!=-1)
+            root = parent[root];
+
+        for(int j=0; j<n; ++j)
+        {
+            if(i==j || !similar(seq[i], seq[j]))
+                continue;
+
+            int root2 = j;
+            while(parent[root2]!=-1)
+                root2 = parent[root2];
+            if(root2==root)
+                continue;
+
+            if(rank[root]>rank[root2])
+                parent[root2] = root;
+            else
+            {
+                parent[root] = root2;
+                if(rank[root]==rank[root2])
+                    rank[root2]++;
+                root = root2;
+            }
+
+            // Compress the paths of both windows to the root
+            int ends[2] = {j, i};
+            for(int e=0; e<2; ++e)
+            {
+                int node = ends[e];
+                while(parent[node]!=-1)
+                {
+                    int temp = node;
+                    node = parent[node];
+                    parent[temp] = root;
+                }
+            }
+        }
+    }
+
+    // Number groups in order of their first window
+    int nGroups = 0;
+    this->index.resize(n);
+    for(int i=0; i<n; ++i)
+    {
+        int root = i;
+        while(parent[root]!=-1)
+            root = parent[root];
+        if(rank[root]>=0)
+            rank[root] = ~nGroups++;
+        this->index[i] = ~rank[root];
+    }
+
+    // Sum every group, keeping its best confidence
+    BbfDetection empty = {0, 0, 0, 0, 0, 0};
+    this->comps.assign(nGroups, empty);
+    for(int i=0; i<n; ++i)
+    {
+        BbfDetection& comp = this->comps[this->index[i]];
+        if(comp.neighbors==0)
+            comp.confidence = seq[i].confidence;
+        comp.neighbors++;
+        comp.x += seq[i].x;
+        comp.y += seq[i].y;
+        comp.width += seq[i].width;
+        comp.height += seq[i].height;
+        comp.confidence = std::max(comp.confidence, seq[i].confidence);
+    }
+
+    this->averaged.clear();
+    for(int g=0; g<nGroups; ++g)
+    {
+        const BbfDetection& comp = this->comps[g];
+        int k = comp.neighbors;
+        if(k<minNeighbors)
+            continue;
+
+        BbfDetection d;
+        d.x = (comp.x*2 + k)/(2*k);
+        d.y = (comp.y*2 + k)/(2*k);
+        d.width = (comp.width*2 + k)/(2*k);
+        d.height = (comp.height*2 + k)/(2*k);
+        d.neighbors = k;
+        d.confidence = comp.confidence;
+        this->averaged.push_back(d);
+    }
+
+    // Drop objects inside another one with more support (or with fewer than 3 windows)
+    for(unsigned int i=0; i<this->averaged.size(); ++i)
+    {
+        const BbfDetection& r1 = this->averaged[i];
+        bool inside = false;
+        for(unsigned int j=0; j<this->averaged.size() && !inside; ++j)
+        {
+            const BbfDetection& r2 = this->averaged[j];
+            double distance = floor(r2.width*0.25 + 0.5);
+            inside = i!=j &&
+                     r1.x>=r2.x - distance && r1.y>=r2.y - distance &&
+                     r1.x + r1.width<=r2.x + r2.width + distance &&
+                     r1.y + r1.height<=r2.y + r2.height + distance &&
+                     (r2.neighbors>std::max(3, r1.neighbors) || r1.neighbors<3);
+        }
+
+        if(!inside)
+            found.push_back(r1);
+    }
+}
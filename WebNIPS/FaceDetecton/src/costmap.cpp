@@ -0,0 +1,64 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include "../inc/costmap.h"
+#include "../inc/violajones.h"
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+CostMap::CostMap(int w, int h, unsigned int cell, unsigned int wSize, double scale, unsigned int nScales):
+    cell(std::max(1u, cell)), wSize(wSize), scale(scale), nScales(nScales)
+{
+    this->gridW = (w + this->cell - 1)/this->cell;
+    this->gridH = (h + this->cell - 1)/this->cell;
+    this->data.assign(this->nScales*this->gridW*this->gridH, 0);
+}
+
+void CostMap::add(Rect& window, unsigned int features)
+{
+    // Scale index from window size
+    double ratio = (double)window.getWidth()/this->wSize;
+    int sc = ratio>1 && this->scale>1 ? static_cast<int>(floor(log(ratio)/log(this->scale) + 0.5)) : 0;
+    sc = std::min(sc, (int)this->nScales-1);
+
+    unsigned int x = std::min((unsigned int)std::max(0, window.getX())/this->cell, this->gridW-1);
+    unsigned int y = std::min((unsigned int)std::max(0, window.getY())/this->cell, this->gridH-1);
+    this->data[(sc*this->gridH + y)*this->gridW + x] += features;
+}
+
+void CostMap::reset()
+{
+    std::fill(this->data.begin(), this->data.end(), 0);
+}
+
+bool CostMap::writePGM(const std::string& path, int sc)
+{
+    unsigned int size = this->gridW*this->gridH;
+    std::vector<float> plane(size, 0);
+    for(unsigned int s=0; s<this->nScales; ++s)
+    {
+        if(sc>=0 && (int)s!=sc)
+            continue;
+        for(unsigned int i=0; i<size; ++i)
+            plane[i] += this->data[s*size + i];
+    }
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f)
+        return false;
+
+    float maxVal = std::max(1.0f, *std::max_element(plane.begin(), plane.end()));
+    std::vector<unsigned char> pixels(size);
+    for(unsigned int i=0; i<size; ++i)
+        pixels[i] = static_cast<unsigned char>(255*plane[i]/maxVal + 0.5);
+
+    fprintf(f, "P5\n# features evaluated per %ux%u cell, max %.0f\n%u %u\n255\n", this->cell, this->cell, maxVal,
+            this->gridW, this->gridH);
+    bool ok = fwrite(&pixels[0], 1, size, f)==size;
+
+    fclose(f);
+    return ok;
+}
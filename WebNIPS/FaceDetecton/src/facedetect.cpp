@@ -0,0 +1,528 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include "facelib.h"
+#include "frameio.h"
+
+//! facedetect: native command line face detector
+//! Reads PGM/PPM (binary, 8 bit) or raw RGBA frames, or directories of them, and prints one JSON
+//! line per frame with the face bounding box (and parts and landmarks, given their models) and
+//! timings. Frames are spread over worker threads
+//! (detect mode) or followed in order by a single tracker (track mode).
+
+const int HEATMAP_CELL = 8;     // Cost heatmap cell size (pixels)
+
+// Facial part search regions (x, y, w, h relative to the face box) and window widths (relative to
+// the face width): eyes in image left and right halves of the upper face, mouth in the lower face
+const float EYE_REGIONS[2][4] = {{0.1f, 0.15f, 0.45f, 0.4f}, {0.45f, 0.15f, 0.45f, 0.4f}};
+const float EYE_SIZE[2] = {0.15f, 0.4f};
+const float MOUTH_REGION[4] = {0.2f, 0.55f, 0.6f, 0.45f};
+const float MOUTH_SIZE[2] = {0.25f, 0.6f};
+
+const char* USAGE =
+    "Usage: facedetect [options] <frame|directory>...\n"
+    "  -t <n>      worker threads (default: hardware concurrency)\n"
+    "  -m <mode>   detect (default) or track (frames in order, single thread)\n"
+    "  -b <ms>     time budget per detection (default: none)\n"
+    "  -s <w>x<h>  size of raw RGBA frames (.rgba, .raw)\n"
+    "  -S          print cascade statistics as JSON to stderr (FD_STATS builds)\n"
+    "  -T <file>   write phase trace (Chrome trace_event JSON) to file\n"
+    "  -H <file>   write detector cost heatmap (all scales, 8x8 cells) to file as PGM\n"
+    "  -F <file>   also detect faces with a cascade (utils/xml_parser.py), e.g. utils/cascade.txt\n"
+    "  -P <file>   as -F, with the mirrored cascade too (profile faces facing either way)\n"
+    "  -B <file>   detect faces with an LBP cascade (utils/xml_parser.py) instead of the Haar ones\n"
+    "  -C <file>   detect faces with a ccv BBF cascade (utils/bbf_parser.py) instead, as camface.js\n"
+    "              did with ccv.js (every object found is printed)\n"
+    "  -L <model>  fit landmarks of model (utils/train_landmarks.py) to the faces found\n"
+    "  -E <file>   search both eyes in the faces found with a cascade (utils/xml_parser.py)\n"
+    "  -M <file>   search the mouth in the faces found with a cascade (utils/xml_parser.py)\n";
+
+struct Options
+{
+    unsigned int nThreads;
+    bool track;
+    double budget;              // ms (0: no budget)
+    int rawW;
+    int rawH;
+    bool stats;                 // Print cascade statistics
+    std::string trace;          // Trace file (empty: no tracing)
+    std::string heatmap;        // Heatmap file (empty: no heatmap)
+    std::string landmarks;      // Landmark model file (empty: no landmarks)
+    std::vector<std::pair<std::string, bool> > faces; // Additional face cascade files (mirrored too)
+    std::vector<std::string> lbpFaces; // LBP face cascade files (LBP engine if any)
+    std::string bbf;            // BBF cascade file (empty: no BBF detection)
+    std::string eyes;           // Eye cascade file (empty: no eyes)
+    std::string mouth;          // Mouth cascade file (empty: no mouth)
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsed(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// ***************************************************************
+// ** PROCESSING
+// ***************************************************************
+
+// ccv.detect_objects parameters of camface.js
+const int BBF_INTERVAL = 5;
+const int BBF_MIN_NEIGHBORS = 1;
+
+// Escape file name for JSON output
+std::string quote(const std::string& str)
+{
+    std::string out = "\"";
+    for(size_t i=0; i<str.size(); ++i)
+    {
+        if(str[i]=='"' || str[i]=='\\')
+            out += '\\';
+        out += str[i];
+    }
+    return out + "\"";
+}
+
+class Runner
+{
+public:
+    Runner(const Options& o, const std::vector<std::string>& f): opt(o), frames(f), next(0), failed(0), heatW(0), heatH(0) {}
+
+    // Process all frames. Return number of frames that could not be loaded
+    unsigned int run()
+    {
+        if(this->opt.track)
+            this->work();
+        else
+        {
+            std::vector<std::thread> workers;
+            for(unsigned int i=0; i<this->opt.nThreads; ++i)
+                workers.push_back(std::thread(&Runner::work, this));
+            for(unsigned int i=0; i<workers.size(); ++i)
+                workers[i].join();
+        }
+
+        return this->failed;
+    }
+
+    /** Runner::writeHeatmap
+      * Write the cost heatmap summed over scales and workers as PGM, scaled so the costliest
+      * cell is white. Return false on error
+      **/
+    bool writeHeatmap(const std::string& path)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        if(!f)
+            return false;
+
+        float maxVal = 1;
+        for(unsigned int i=0; i<this->heatmap.size(); ++i)
+            maxVal = std::max(maxVal, this->heatmap[i]);
+
+        std::vector<unsigned char> pixels(this->heatmap.size());
+        for(unsigned int i=0; i<pixels.size(); ++i)
+            pixels[i] = static_cast<unsigned char>(255*this->heatmap[i]/maxVal + 0.5);
+
+        fprintf(f, "P5\n# features evaluated per %dx%d cell, max %.0f\n%d %d\n255\n", HEATMAP_CELL, HEATMAP_CELL,
+                maxVal, this->heatW, this->heatH);
+        bool ok = pixels.empty() || fwrite(&pixels[0], 1, pixels.size(), f)==pixels.size();
+
+        fclose(f);
+        return ok;
+    }
+
+private:
+    // Worker: take frames in order, keep one instance per frame size
+    void work()
+    {
+        FaceHandle* fd = 0;
+        int w = 0, h = 0;
+        Image im;
+
+        while(true)
+        {
+            unsigned int idx;
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                if(this->next>=this->frames.size())
+                    break;
+                idx = this->next++;
+            }
+
+            Clock::time_point start = Clock::now();
+            if(!loadFrame(this->frames[idx], this->opt.rawW, this->opt.rawH, im))
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                fprintf(stderr, "facedetect: cannot read %s\n", this->frames[idx].c_str());
+                this->failed++;
+                continue;
+            }
+            double loadTime = elapsed(start);
+
+            if(!fd || im.width!=w || im.height!=h)
+            {
+                if(fd)
+                    this->release(fd);
+                w = im.width;
+                h = im.height;
+                fd = fd_create(w, h);
+                if(!this->opt.heatmap.empty())
+                    fd_heatmap_enable(fd, HEATMAP_CELL);
+                this->addParts(fd);
+            }
+            memcpy(fd_frame_buffer(fd), &im.data[0], im.data.size());
+
+            start = Clock::now();
+            unsigned short* rect;
+            float* objects = 0;
+            unsigned short best[4] = {0, 0, 0, 0};
+            if(!this->opt.bbf.empty())
+            {
+                objects = fd_detect_bbf(fd, BBF_INTERVAL, BBF_MIN_NEIGHBORS);
+                rect = this->mostConfident(objects, best);
+            }
+            else if(this->opt.track)
+                rect = fd_track(fd);
+            else if(this->opt.budget>0)
+                rect = fd_detect_budget(fd, this->opt.budget);
+            else
+                rect = fd_detect(fd);
+            double detectTime = elapsed(start);
+
+            unsigned short* parts = 0;
+            start = Clock::now();
+            if(!this->opt.eyes.empty() || !this->opt.mouth.empty())
+                parts = fd_parts(fd);
+            double partTime = elapsed(start);
+
+            float* landmarks = 0;
+            start = Clock::now();
+            if(!this->opt.landmarks.empty())
+                landmarks = fd_landmarks(fd, rect[0], rect[1], rect[2], rect[3]);
+            double landmarkTime = elapsed(start);
+
+            this->print(idx, w, h, rect, fd, objects, parts, landmarks, loadTime, detectTime, partTime, landmarkTime);
+        }
+
+        if(fd)
+            this->release(fd);
+    }
+
+    // Box of the most confident object of fd_detect_bbf into rect (all 0 if none)
+    unsigned short* mostConfident(const float* objects, unsigned short* rect)
+    {
+        int n = static_cast<int>(objects[0]);
+        const float* best = 0;
+        for(int i=0; i<n; ++i)
+        {
+            const float* obj = objects + 1 + 6*i;
+            if(!best || obj[5]>best[5])
+                best = obj;
+        }
+
+        for(int c=0; c<4 && best; ++c)
+            rect[c] = static_cast<unsigned short>(std::max(0.0f, best[c]) + 0.5f);
+        return rect;
+    }
+
+    // Add the face models, eyes and mouth given by options (cascades were checked at startup)
+    void addParts(FaceHandle* fd)
+    {
+        for(size_t c=0; c<this->opt.faces.size(); ++c)
+            fd_add_cascade(fd, this->opt.faces[c].first.c_str(), this->opt.faces[c].second);
+        for(size_t c=0; c<this->opt.lbpFaces.size(); ++c)
+            fd_add_lbp_cascade(fd, this->opt.lbpFaces[c].c_str());
+
+        const char* eyes = this->opt.eyes.c_str();
+        const char* mouth = this->opt.mouth.c_str();
+        if(!this->opt.eyes.empty())
+            for(int e=0; e<2; ++e)
+                fd_add_part(fd, eyes, EYE_REGIONS[e][0], EYE_REGIONS[e][1], EYE_REGIONS[e][2], EYE_REGIONS[e][3], EYE_SIZE[0], EYE_SIZE[1]);
+        if(!this->opt.mouth.empty())
+            fd_add_part(fd, mouth, MOUTH_REGION[0], MOUTH_REGION[1], MOUTH_REGION[2], MOUTH_REGION[3], MOUTH_SIZE[0], MOUTH_SIZE[1]);
+    }
+
+    // Destroy instance, adding its heatmap to the heatmap of the first frame size
+    void release(FaceHandle* fd)
+    {
+        float* map = fd_heatmap(fd);
+        if(map)
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            int gridW = static_cast<int>(map[0]);
+            int gridH = static_cast<int>(map[1]);
+            int nScales = static_cast<int>(map[2]);
+
+            if(this->heatmap.empty())
+            {
+                this->heatW = gridW;
+                this->heatH = gridH;
+                this->heatmap.assign(gridW*gridH, 0);
+            }
+
+            if(gridW==this->heatW && gridH==this->heatH)
+                for(int sc=0; sc<nScales; ++sc)
+                    for(int i=0; i<gridW*gridH; ++i)
+                        this->heatmap[i] += map[3 + sc*gridW*gridH + i];
+            else
+                fprintf(stderr, "facedetect: heatmap of %dx%d cells left out (frame size differs)\n", gridW, gridH);
+        }
+
+        fd_destroy(fd);
+    }
+
+    void print(unsigned int idx, int w, int h, unsigned short* rect, FaceHandle* fd, const float* objects, unsigned short* parts,
+               float* landmarks, double loadTime, double detectTime, double partTime, double landmarkTime)
+    {
+        char face[64] = "null";
+        if(rect[2]>0)
+            snprintf(face, sizeof(face), "[%d,%d,%d,%d]", rect[0], rect[1], rect[2], rect[3]);
+
+        char complete[32] = "";
+        if(!this->opt.track && this->opt.budget>0)
+            snprintf(complete, sizeof(complete), ",\"complete\":%s", fd_detect_complete(fd) ? "true" : "false");
+
+        // BBF objects ([[x,y,w,h,neighbors,confidence],...])
+        std::string found;
+        if(objects)
+        {
+            found = ",\"objects\":[";
+            for(int i=0; i<static_cast<int>(objects[0]); ++i)
+            {
+                const float* obj = objects + 1 + 6*i;
+                char object[128];
+                snprintf(object, sizeof(object), "%s[%.3f,%.3f,%.3f,%.3f,%d,%.6f]", i ? "," : "",
+                         obj[0], obj[1], obj[2], obj[3], static_cast<int>(obj[4]), obj[5]);
+                found += object;
+            }
+            found += "]";
+        }
+
+        // Parts ([[x,y,w,h] or null,...], eyes then mouth)
+        std::string boxes;
+        if(parts)
+        {
+            boxes = ",\"parts\":[";
+            for(int p=0; p<parts[0]; ++p)
+            {
+                unsigned short* box = parts + 1 + 4*p;
+                char part[64] = "null";
+                if(box[2]>0)
+                    snprintf(part, sizeof(part), "[%d,%d,%d,%d]", box[0], box[1], box[2], box[3]);
+                boxes += std::string(p ? "," : "") + part;
+            }
+
+            char time[48];
+            snprintf(time, sizeof(time), "],\"parts_ms\":%.3f", partTime);
+            boxes += time;
+        }
+
+        // Landmarks ([[x,y],...], null if no face)
+        std::string points;
+        if(!this->opt.landmarks.empty())
+        {
+            points = ",\"landmarks\":";
+            if(landmarks)
+            {
+                int n = static_cast<int>(landmarks[0]);
+                for(int l=0; l<n; ++l)
+                {
+                    char point[64];
+                    snprintf(point, sizeof(point), "%s[%.1f,%.1f]", l ? "," : "[", landmarks[1+2*l], landmarks[2+2*l]);
+                    points += point;
+                }
+                points += "]";
+            }
+            else
+                points += "null";
+
+            char time[48];
+            snprintf(time, sizeof(time), ",\"landmarks_ms\":%.3f", landmarkTime);
+            points += time;
+        }
+
+        std::lock_guard<std::mutex> guard(this->lock);
+        printf("{\"frame\":%u,\"file\":%s,\"width\":%d,\"height\":%d,\"face\":%s%s%s%s%s,\"load_ms\":%.3f,\"detect_ms\":%.3f}\n",
+               idx, quote(this->frames[idx]).c_str(), w, h, face, complete, found.c_str(), boxes.c_str(), points.c_str(), loadTime, detectTime);
+    }
+
+    const Options& opt;
+    const std::vector<std::string>& frames;
+    unsigned int next;          // Next frame to process
+    unsigned int failed;        // Frames that could not be loaded
+    std::mutex lock;            // Guards frame queue, output and heatmap
+    std::vector<float> heatmap; // Cost heatmap summed over scales and instances
+    int heatW;                  // Heatmap size (cells)
+    int heatH;
+};
+
+// ***************************************************************
+// ** MAIN
+// ***************************************************************
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    opt.nThreads = std::max(1u, std::thread::hardware_concurrency());
+    opt.track = false;
+    opt.budget = 0;
+    opt.rawW = 0;
+    opt.rawH = 0;
+    opt.stats = false;
+
+    std::vector<std::string> frames;
+    for(int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasVal = i+1<argc;
+
+        if(arg=="-t" && hasVal)
+            opt.nThreads = std::max(1, atoi(argv[++i]));
+        else if(arg=="-m" && hasVal)
+        {
+            std::string mode = argv[++i];
+            if(mode!="detect" && mode!="track")
+            {
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            }
+            opt.track = mode=="track";
+        }
+        else if(arg=="-b" && hasVal)
+            opt.budget = atof(argv[++i]);
+        else if(arg=="-s" && hasVal)
+        {
+            if(sscanf(argv[++i], "%dx%d", &opt.rawW, &opt.rawH)!=2)
+            {
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+            }
+        }
+        else if(arg=="-S")
+            opt.stats = true;
+        else if(arg=="-T" && hasVal)
+            opt.trace = argv[++i];
+        else if(arg=="-H" && hasVal)
+            opt.heatmap = argv[++i];
+        else if(arg=="-F" && hasVal)
+            opt.faces.push_back(std::pair<std::string, bool>(argv[++i], false));
+        else if(arg=="-P" && hasVal)
+            opt.faces.push_back(std::pair<std::string, bool>(argv[++i], true));
+        else if(arg=="-B" && hasVal)
+            opt.lbpFaces.push_back(argv[++i]);
+        else if(arg=="-C" && hasVal)
+            opt.bbf = argv[++i];
+        else if(arg=="-L" && hasVal)
+            opt.landmarks = argv[++i];
+        else if(arg=="-E" && hasVal)
+            opt.eyes = argv[++i];
+        else if(arg=="-M" && hasVal)
+            opt.mouth = argv[++i];
+        else if(arg.size()>1 && arg[0]=='-')
+        {
+            fprintf(stderr, "%s", USAGE);
+            return 1;
+        }
+        else
+            listFrames(arg, frames);
+    }
+
+    if(frames.empty())
+    {
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+
+    // Check face and part cascades once (instances share them)
+    for(size_t c=0; c<opt.faces.size(); ++c)
+    {
+        FaceHandle* fd = fd_create(1, 1);
+        int models = fd_add_cascade(fd, opt.faces[c].first.c_str(), opt.faces[c].second);
+        fd_destroy(fd);
+        if(models==0)
+        {
+            fprintf(stderr, "facedetect: cannot load cascade %s\n", opt.faces[c].first.c_str());
+            return 1;
+        }
+    }
+
+    for(size_t c=0; c<opt.lbpFaces.size(); ++c)
+    {
+        FaceHandle* fd = fd_create(1, 1);
+        int models = fd_add_lbp_cascade(fd, opt.lbpFaces[c].c_str());
+        fd_destroy(fd);
+        if(models==0)
+        {
+            fprintf(stderr, "facedetect: cannot load LBP cascade %s\n", opt.lbpFaces[c].c_str());
+            return 1;
+        }
+    }
+
+    const std::string* cascades[2] = {&opt.eyes, &opt.mouth};
+    for(int c=0; c<2; ++c)
+    {
+        if(cascades[c]->empty())
+            continue;
+
+        FaceHandle* fd = fd_create(1, 1);
+        int part = fd_add_part(fd, cascades[c]->c_str(), 0, 0, 1, 1, 0, 1);
+        fd_destroy(fd);
+        if(part<0)
+        {
+            fprintf(stderr, "facedetect: cannot load cascade %s\n", cascades[c]->c_str());
+            return 1;
+        }
+    }
+
+    if(!opt.bbf.empty() && !load_bbf_cascade_file(opt.bbf.c_str()))
+    {
+        fprintf(stderr, "facedetect: cannot load BBF cascade %s\n", opt.bbf.c_str());
+        return 1;
+    }
+
+    if(!opt.landmarks.empty() && !load_landmark_model_file(opt.landmarks.c_str()))
+    {
+        fprintf(stderr, "facedetect: cannot load landmark model %s\n", opt.landmarks.c_str());
+        return 1;
+    }
+
+    if(!opt.trace.empty())
+        trace_enable(1);
+
+    Clock::time_point start = Clock::now();
+    Runner runner(opt, frames);
+    unsigned int failed = runner.run();
+    double total = elapsed(start);
+
+    unsigned int done = frames.size() - failed;
+    fprintf(stderr, "facedetect: %u frames in %.1f ms (%.1f fps, %u threads)\n",
+            done, total, total>0 ? 1000.0*done/total : 0.0, opt.track ? 1 : opt.nThreads);
+    if(opt.stats)
+        fprintf(stderr, "%s\n", get_stats());
+
+    if(!opt.heatmap.empty() && !runner.writeHeatmap(opt.heatmap))
+    {
+        fprintf(stderr, "facedetect: cannot write %s\n", opt.heatmap.c_str());
+        return 1;
+    }
+
+    if(!opt.trace.empty())
+    {
+        FILE* f = fopen(opt.trace.c_str(), "w");
+        if(!f)
+        {
+            fprintf(stderr, "facedetect: cannot write %s\n", opt.trace.c_str());
+            return 1;
+        }
+        fprintf(f, "%s\n", get_trace());
+        fclose(f);
+    }
+
+    return failed ? 2 : 0;
+}
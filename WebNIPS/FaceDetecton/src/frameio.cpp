@@ -0,0 +1,389 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../inc/frameio.h"
+
+
+// Read next header token of a PNM file, skipping comments
+static bool readToken(FILE* f, int& val)
+{
+    int c = fgetc(f);
+    while(c!=EOF && (isspace(c) || c=='#'))
+    {
+        if(c=='#')
+            while(c!=EOF && c!='\n')
+                c = fgetc(f);
+        c = fgetc(f);
+    }
+
+    if(c==EOF || !isdigit(c))
+        return false;
+
+    val = 0;
+    while(c!=EOF && isdigit(c))
+    {
+        val = 10*val + (c-'0');
+        c = fgetc(f);
+    }
+
+    // The whitespace ending the token has been consumed, as PNM requires before pixel data
+    return true;
+}
+
+// Largest frame accepted (pixels): keeps RGBA offsets in int and rejects corrupt headers
+static const size_t MAX_PIXELS = size_t(1)<<26;
+
+// Pixel count of a w x h frame, false if empty or above MAX_PIXELS (computed without overflow)
+static bool frameSize(int w, int h, size_t& pixels)
+{
+    if(w<=0 || h<=0 || static_cast<size_t>(w) > MAX_PIXELS/h)
+        return false;
+
+    pixels = static_cast<size_t>(w)*h;
+    return true;
+}
+
+// Whether at least size bytes are left to read in f
+static bool hasBytes(FILE* f, size_t size)
+{
+    long pos = ftell(f);
+    if(pos<0 || fseek(f, 0, SEEK_END)!=0)
+        return false;
+
+    long end = ftell(f);
+    fseek(f, pos, SEEK_SET);
+    return end>=pos && static_cast<size_t>(end-pos)>=size;
+}
+
+static std::string extension(const std::string& path)
+{
+    size_t dot = path.rfind('.');
+    if(dot==std::string::npos || dot<path.rfind('/')+1)
+        return "";
+
+    std::string ext = path.substr(dot+1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+/** loadPNM
+  * Load binary PGM (P5) or PPM (P6) file with 8 bit samples as RGBA
+  * Return false on error
+  **/
+bool loadPNM(const std::string& path, Image& im)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+
+    char magic[2] = {0, 0};
+    int maxVal;
+    size_t nPixels = 0;
+    bool ok = fread(magic, 1, 2, f)==2 && magic[0]=='P' && (magic[1]=='5' || magic[1]=='6') &&
+              readToken(f, im.width) && readToken(f, im.height) && readToken(f, maxVal) &&
+              maxVal>0 && maxVal<256 && frameSize(im.width, im.height, nPixels);
+
+    // Header size must be backed by the file before allocating
+    int nChn = magic[1]=='5' ? 1 : 3;
+    ok = ok && hasBytes(f, nChn*nPixels);
+
+    if(ok)
+    {
+        std::vector<unsigned char> pixels(nChn*nPixels);
+        ok = fread(&pixels[0], 1, pixels.size(), f)==pixels.size();
+
+        im.data.resize(4*nPixels);
+        for(int i=0; ok && i<static_cast<int>(nPixels); ++i)
+        {
+            im.data[4*i]   = pixels[nChn*i];
+            im.data[4*i+1] = pixels[nChn*i + (nChn-1)/2];
+            im.data[4*i+2] = pixels[nChn*i + nChn-1];
+            im.data[4*i+3] = 255;
+        }
+    }
+
+    fclose(f);
+    return ok;
+}
+
+/** loadRaw
+  * Load raw RGBA frame of known size
+  * Return false on error
+  **/
+bool loadRaw(const std::string& path, int w, int h, Image& im)
+{
+    size_t nPixels;
+    if(!frameSize(w, h, nPixels))
+        return false;
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+
+    bool ok = hasBytes(f, 4*nPixels);
+    if(ok)
+    {
+        im.width = w;
+        im.height = h;
+        im.data.resize(4*nPixels);
+        ok = fread(&im.data[0], 1, im.data.size(), f)==im.data.size();
+    }
+
+    fclose(f);
+    return ok;
+}
+
+bool loadFrame(const std::string& path, int rawW, int rawH, Image& im)
+{
+    std::string ext = extension(path);
+    if(ext=="rgba" || ext=="raw")
+        return loadRaw(path, rawW, rawH, im);
+
+    return loadPNM(path, im);
+}
+
+/** loadY4M
+  * Load frames of a YUV4MPEG2 video (8 bit, any chroma subsampling) as grey RGBA from luma
+  * Return false on error or if no frame could be read
+  **/
+bool loadY4M(const std::string& path, unsigned int maxFrames, std::vector<Image>& frames)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+
+    // Stream header: YUV4MPEG2 W<width> H<height> [C<colorspace>] ...
+    char line[1024];
+    if(!fgets(line, sizeof(line), f) || strncmp(line, "YUV4MPEG2 ", 10)!=0)
+    {
+        fclose(f);
+        return false;
+    }
+
+    int w = 0, h = 0;
+    std::string chroma = "420";
+    for(char* tok = strtok(line+10, " \n"); tok; tok = strtok(0, " \n"))
+    {
+        if(tok[0]=='W')
+            w = atoi(tok+1);
+        else if(tok[0]=='H')
+            h = atoi(tok+1);
+        else if(tok[0]=='C')
+            chroma = tok+1;
+    }
+
+    size_t nPixels;
+    if(!frameSize(w, h, nPixels) || !hasBytes(f, nPixels))
+    {
+        fclose(f);
+        return false;
+    }
+
+    // Bytes per frame after luma
+    long chromaSize;
+    if(chroma.compare(0, 4, "mono")==0)
+        chromaSize = 0;
+    else if(chroma.compare(0, 3, "444")==0)
+        chromaSize = 2L*w*h;
+    else if(chroma.compare(0, 3, "422")==0)
+        chromaSize = 2L*((w+1)/2)*h;
+    else if(chroma.compare(0, 3, "420")==0)
+        chromaSize = 2L*((w+1)/2)*((h+1)/2);
+    else
+    {
+        fclose(f);
+        return false;
+    }
+
+    std::vector<unsigned char> luma(nPixels);
+    while((maxFrames==0 || frames.size()<maxFrames) && fgets(line, sizeof(line), f) && strncmp(line, "FRAME", 5)==0)
+    {
+        if(fread(&luma[0], 1, luma.size(), f)!=luma.size())
+            break;
+        fseek(f, chromaSize, SEEK_CUR);
+
+        Image im;
+        im.width = w;
+        im.height = h;
+        im.data.resize(4*nPixels);
+        for(int i=0; i<static_cast<int>(nPixels); ++i)
+        {
+            im.data[4*i] = im.data[4*i+1] = im.data[4*i+2] = luma[i];
+            im.data[4*i+3] = 255;
+        }
+        frames.push_back(im);
+    }
+
+    fclose(f);
+    return !frames.empty();
+}
+
+/** loadRawSequence
+  * Load concatenated raw RGBA frames of known size
+  * Return false on error or if no frame could be read
+  **/
+bool loadRawSequence(const std::string& path, int w, int h, unsigned int maxFrames, std::vector<Image>& frames)
+{
+    size_t nPixels;
+    if(!frameSize(w, h, nPixels))
+        return false;
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+
+    if(!hasBytes(f, 4*nPixels))
+    {
+        fclose(f);
+        return false;
+    }
+
+    Image im;
+    im.width = w;
+    im.height = h;
+    im.data.resize(4*nPixels);
+    while((maxFrames==0 || frames.size()<maxFrames) && fread(&im.data[0], 1, im.data.size(), f)==im.data.size())
+        frames.push_back(im);
+
+    fclose(f);
+    return !frames.empty();
+}
+
+bool isFrame(const std::string& path)
+{
+    std::string ext = extension(path);
+    return ext=="pgm" || ext=="ppm" || ext=="pnm" || ext=="rgba" || ext=="raw";
+}
+
+void listFrames(const std::string& path, std::vector<std::string>& frames)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st)!=0 || !S_ISDIR(st.st_mode))
+    {
+        frames.push_back(path);
+        return;
+    }
+
+    std::vector<std::string> entries;
+    DIR* dir = opendir(path.c_str());
+    if(!dir)
+        return;
+
+    for(struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+    {
+        std::string name = path + "/" + ent->d_name;
+        if(ent->d_name[0]!='.' && isFrame(name))
+            entries.push_back(name);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    frames.insert(frames.end(), entries.begin(), entries.end());
+}
+
+void resize(const Image& in, int w, int h, Image& out)
+{
+    out.width = w;
+    out.height = h;
+    out.data.resize(4*w*h);
+
+    for(int j=0; j<h; ++j)
+    {
+        int srcY = j*in.height/h;
+        for(int i=0; i<w; ++i)
+        {
+            int srcX = i*in.width/w;
+            std::copy(&in.data[4*(srcX + srcY*in.width)], &in.data[4*(srcX + srcY*in.width)] + 4, &out.data[4*(i + j*w)]);
+        }
+    }
+}
+
+/** synthesizeFace
+  * Draw a synthetic frame: smooth random background (bilinear value noise) and a shaded face oval
+  * with dark eyes, brows and mouth and a bright nose ridge, which the frontal cascade detects
+  * w, h: frame size
+  * x, y, size: face box
+  * seed: background seed
+  * out: RGBA frame (grey)
+  **/
+void synthesizeFace(int w, int h, int x, int y, int size, unsigned int seed, Image& out)
+{
+    out.width = w;
+    out.height = h;
+    out.data.resize(4*w*h);
+
+    // Background noise grid
+    const int CELL = 16;
+    int gridW = w/CELL + 2;
+    int gridH = h/CELL + 2;
+    std::vector<double> grid(gridW*gridH);
+    for(unsigned int i=0; i<grid.size(); ++i)
+    {
+        seed = seed*1664525u + 1013904223u;
+        grid[i] = 60 + 120*((seed>>8)/16777216.0);
+    }
+
+    // Face features (center and radii relative to face box)
+    const int N_PARTS = 7;
+    const double PARTS[N_PARTS][5] = {
+        {0.32, 0.40, 0.10, 0.05, 40},   // Eyes
+        {0.68, 0.40, 0.10, 0.05, 40},
+        {0.32, 0.31, 0.12, 0.025, 70},  // Brows
+        {0.68, 0.31, 0.12, 0.025, 70},
+        {0.50, 0.78, 0.16, 0.04, 60},   // Mouth
+        {0.50, 0.55, 0.05, 0.12, 225},  // Nose ridge
+        {0.50, 0.66, 0.09, 0.03, 110}   // Nostrils
+    };
+
+    double cx = x + size/2.0;
+    double cy = y + size/2.0;
+
+    for(int j=0; j<h; ++j)
+    {
+        for(int i=0; i<w; ++i)
+        {
+            double gx = (double)i/CELL;
+            double gy = (double)j/CELL;
+            int ix = static_cast<int>(gx);
+            int iy = static_cast<int>(gy);
+            double ax = gx - ix;
+            double ay = gy - iy;
+            double val = grid[ix + iy*gridW]*(1-ax)*(1-ay) + grid[ix+1 + iy*gridW]*ax*(1-ay) +
+                         grid[ix + (iy+1)*gridW]*(1-ax)*ay + grid[ix+1 + (iy+1)*gridW]*ax*ay;
+
+            // Face oval
+            double u = (i-cx)/(0.42*size);
+            double v = (j-cy)/(0.55*size);
+            if(u*u + v*v < 1)
+            {
+                double fx = (double)(i-x)/size;
+                double fy = (double)(j-y)/size;
+
+                val = 190;
+                for(int p=0; p<N_PARTS; ++p)
+                {
+                    double a = (fx-PARTS[p][0])/PARTS[p][2];
+                    double b = (fy-PARTS[p][1])/PARTS[p][3];
+                    if(a*a + b*b < 1)
+                    {
+                        val = PARTS[p][4];
+                        break;
+                    }
+                }
+
+                // Shading towards the contour
+                val -= 40*(u*u + v*v);
+            }
+
+            unsigned char grey = static_cast<unsigned char>(std::max(0.0, std::min(255.0, val)));
+            unsigned char* px = &out.data[4*(i + j*w)];
+            px[0] = px[1] = px[2] = grey;
+            px[3] = 255;
+        }
+    }
+}
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include "../inc/framepool.h"
+#include "../inc/greyframe.h"
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+FramePool::FramePool(unsigned int w, unsigned int h, unsigned int n): width(w), height(h), slots(n)
+{
+    // Pre-allocate frames, grey planes and integral images
+    for(unsigned int i=0; i<n; ++i)
+    {
+        this->slots[i].image = (unsigned char *)new unsigned char[4*w*h];
+        this->slots[i].grey = new GreyFrame(w, h);
+        this->slots[i].intIm = (float *)new float[w*h];
+        this->slots[i].sqIntIm = (float *)new float[w*h];
+        this->slots[i].tiltIm = 0;
+        this->slots[i].lbpIm = 0;
+        this->slots[i].id = 0;
+        this->slots[i].acquired = false;
+
+        this->available.push_back(&this->slots[i]);
+    }
+}
+
+FramePool::~FramePool()
+{
+    for(unsigned int i=0; i<this->slots.size(); ++i)
+    {
+        delete[] this->slots[i].image;
+        delete this->slots[i].grey;
+        delete[] this->slots[i].intIm;
+        delete[] this->slots[i].sqIntIm;
+        delete[] this->slots[i].tiltIm;
+        delete[] this->slots[i].lbpIm;
+    }
+}
+
+FrameSlot* FramePool::acquire()
+{
+#if PIPELINE_THREADS
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while(this->available.empty())
+        this->released.wait(guard);
+#else
+    if(this->available.empty())
+        return 0;
+#endif
+
+    FrameSlot* slot = this->available.back();
+    this->available.pop_back();
+    slot->acquired = true;
+    return slot;
+}
+
+FrameSlot* FramePool::tryAcquire()
+{
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+
+    if(this->available.empty())
+        return 0;
+
+    FrameSlot* slot = this->available.back();
+    this->available.pop_back();
+    slot->acquired = true;
+    return slot;
+}
+
+bool FramePool::release(FrameSlot* slot)
+{
+    if(!slot || slot<&this->slots[0] || slot>=&this->slots[0]+this->slots.size())
+        return false;
+
+    {
+#if PIPELINE_THREADS
+        std::lock_guard<std::mutex> guard(this->lock);
+#endif
+        // Released twice
+        if(std::find(this->available.begin(), this->available.end(), slot)!=this->available.end())
+            return false;
+
+        slot->acquired = false;
+        this->available.push_back(slot);
+    }
+
+#if PIPELINE_THREADS
+    this->released.notify_one();
+#endif
+
+    return true;
+}
+
+bool FramePool::handOver(FrameSlot* slot)
+{
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+
+    if(!slot->acquired)
+        return false;
+
+    slot->acquired = false;
+    return true;
+}
+
+void FramePool::takeBack(FrameSlot* slot)
+{
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+
+    slot->acquired = true;
+}
+
+bool FramePool::isAcquired(FrameSlot* slot)
+{
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+
+    return slot->acquired;
+}
+
+FrameSlot* FramePool::find(unsigned char* image)
+{
+    for(unsigned int i=0; i<this->slots.size(); ++i)
+    {
+        if(this->slots[i].image==image)
+            return &this->slots[i];
+    }
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "../inc/greyframe.h"
+#include "../inc/trace.h"
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+GreyFrame::GreyFrame(int w, int h): w(w), h(h), image(0), sumBuilt(false)
+{
+    // Pre-allocate every plane and level (down to one pixel wide or high)
+    this->sum.assign(w*h + PAD, 0);
+
+    int nLevels = 1;
+    while((w>>nLevels)>0 && (h>>nLevels)>0)
+        nLevels++;
+
+    Pyramid* pyramids[2] = {&this->grey, &this->luma};
+    for(int p=0; p<2; ++p)
+    {
+        pyramids[p]->built = 0;
+        pyramids[p]->level.resize(nLevels);
+        for(int l=0; l<nLevels; ++l)
+            pyramids[p]->level[l].assign((w>>l)*(h>>l) + PAD, 0);
+    }
+
+    for(int l=1; l<nLevels; ++l)
+        this->resamplers.push_back(Resampler(w>>l, h>>l, Resampler::BILINEAR));
+}
+
+void GreyFrame::update(const unsigned char* image)
+{
+    this->image = image;
+    this->sumBuilt = false;
+    this->grey.built = 0;
+    this->luma.built = 0;
+}
+
+const unsigned short* GreyFrame::getSum()
+{
+    if(!this->sumBuilt)
+        this->convertSum();
+    return &this->sum[0];
+}
+
+const unsigned char* GreyFrame::getGrey(int level)
+{
+    return this->build(this->grey, level);
+}
+
+const unsigned char* GreyFrame::getLuma(int level)
+{
+    return this->build(this->luma, level);
+}
+
+// ***************************************************************
+// ** PRIVATE CLASS METHODS
+// ***************************************************************
+
+void GreyFrame::convertSum()
+{
+    TraceSpan span("grey_sum");
+
+    const unsigned char* px = this->image;
+    unsigned short* out = &this->sum[0];
+    for(int i=0; i<this->w*this->h; ++i, px+=4)
+        out[i] = px[0] + px[1] + px[2];
+
+    this->sumBuilt = true;
+}
+
+/** GreyFrame::convertLuma
+  * Luma as ccv.grayscale, rounded (ties to even) as the canvas stores it
+  **/
+void GreyFrame::convertLuma()
+{
+    TraceSpan span("grey_luma");
+
+    static struct LumaTables
+    {
+        double r[256], g[256], b[256];
+        LumaTables()
+        {
+            for(int v=0; v<256; ++v)
+            {
+                r[v] = v*0.3;
+                g[v] = v*0.59;
+                b[v] = v*0.11;
+            }
+        }
+    } tables;
+
+    const unsigned char* px = this->image;
+    unsigned char* out = &this->luma.level[0][0];
+    for(int i=0; i<this->w*this->h; ++i, px+=4)
+    {
+        double v = tables.r[px[0]] + tables.g[px[1]] + tables.b[px[2]];
+        int rounded = static_cast<int>(v + 0.5);
+        if(rounded - v==0.5 && (rounded & 1))
+            rounded--;
+        out[i] = static_cast<unsigned char>(rounded<255 ? rounded : 255);
+    }
+}
+
+/** GreyFrame::build
+  * Convert or halve the levels of a pyramid up to level, unless already done for this frame
+  * Return the level, null if out of range
+  **/
+const unsigned char* GreyFrame::build(Pyramid& pyr, int level)
+{
+    if(level<0 || level>=static_cast<int>(pyr.level.size()))
+        return 0;
+
+    if(pyr.built==0)
+    {
+        if(&pyr==&this->luma)
+            this->convertLuma();
+        else
+        {
+            const unsigned short* sum = this->getSum();
+            unsigned char* out = &pyr.level[0][0];
+            for(int i=0; i<this->w*this->h; ++i)
+                out[i] = sum[i]/3;
+        }
+        pyr.built = 1;
+    }
+
+    if(pyr.built<=level)
+    {
+        TraceSpan span("grey_pyramid");
+        for(int l=pyr.built; l<=level; ++l)
+        {
+            int srcW = this->getW(l-1);
+            int srcH = this->getH(l-1);
+            this->resamplers[l-1].apply(&pyr.level[l-1][0], srcW, srcH, srcW, 1, Rect(0, 0, srcW, srcH), &pyr.level[l][0]);
+        }
+        pyr.built = level + 1;
+    }
+
+    return &pyr.level[level][0];
+}
@@ -0,0 +1,224 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include "../inc/landmarks.h"
+#include "../inc/trace.h"
+
+const char LANDMARK_MAGIC[4] = {'F', 'D', 'L', 'M'};
+const int LANDMARK_VERSION = 1;
+const int LANDMARK_MAX_DEPTH = 12;
+
+
+// ***************************************************************
+// ** LANDMARK MODEL
+// ***************************************************************
+
+LandmarkModel::LandmarkModel(): nLandmarks(0), nCascades(0), nTrees(0), depth(0), nPixels(0)
+{
+}
+
+bool LandmarkModel::load(const std::string& path)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if(!f)
+        return false;
+
+    std::vector<unsigned char> data;
+    unsigned char chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f))>0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(f);
+
+    return !data.empty() && this->load(&data[0], data.size());
+}
+
+/** LandmarkModel::load
+  * Load a model from memory (format in landmarks.h, host assumed little endian)
+  * data: model file contents
+  * size: bytes
+  **/
+bool LandmarkModel::load(const unsigned char* data, unsigned int size)
+{
+    int header[7];
+    if(size<sizeof(header) || memcmp(data, LANDMARK_MAGIC, 4)!=0)
+        return false;
+    memcpy(header, data, sizeof(header));
+
+    int version = header[1];
+    int nLandmarks = header[2];
+    int nCascades = header[3];
+    int nTrees = header[4];
+    int depth = header[5];
+    int nPixels = header[6];
+    if(version!=LANDMARK_VERSION || nLandmarks<=0 || nCascades<=0 || nTrees<=0 || depth<=0 ||
+       depth>LANDMARK_MAX_DEPTH || nPixels<=0 || nPixels>65535)
+        return false;
+
+    // Section sizes
+    size_t nSplits = (size_t)nCascades*nTrees*((1<<depth) - 1);
+    size_t nLeaves = (size_t)nCascades*nTrees*(1<<depth)*2*nLandmarks;
+    size_t expected = sizeof(header) + 2*nLandmarks*sizeof(float) + (size_t)nCascades*nPixels*sizeof(unsigned short) +
+                      (size_t)nCascades*nPixels*2*sizeof(float) + nSplits*sizeof(Split) + nLeaves*sizeof(float);
+    if(size!=expected)
+        return false;
+
+    // Read into a new model, replacing this one only if valid
+    LandmarkModel m;
+    m.meanShape.resize(2*nLandmarks);
+    m.anchor.resize(nCascades*nPixels);
+    m.offset.resize(nCascades*nPixels*2);
+    m.splits.resize(nSplits);
+    m.leaves.resize(nLeaves);
+
+    const unsigned char* p = data + sizeof(header);
+    memcpy(&m.meanShape[0], p, m.meanShape.size()*sizeof(float));
+    p += m.meanShape.size()*sizeof(float);
+    memcpy(&m.anchor[0], p, m.anchor.size()*sizeof(unsigned short));
+    p += m.anchor.size()*sizeof(unsigned short);
+    memcpy(&m.offset[0], p, m.offset.size()*sizeof(float));
+    p += m.offset.size()*sizeof(float);
+    memcpy(&m.splits[0], p, m.splits.size()*sizeof(Split));
+    p += m.splits.size()*sizeof(Split);
+    memcpy(&m.leaves[0], p, m.leaves.size()*sizeof(float));
+
+    // Reject out of range indices here so prediction needs no checks
+    for(size_t i=0; i<m.anchor.size(); ++i)
+        if(m.anchor[i]>=nLandmarks)
+            return false;
+    for(size_t i=0; i<m.splits.size(); ++i)
+        if(m.splits[i].pixel1>=nPixels || m.splits[i].pixel2>=nPixels)
+            return false;
+
+    this->meanShape.swap(m.meanShape);
+    this->anchor.swap(m.anchor);
+    this->offset.swap(m.offset);
+    this->splits.swap(m.splits);
+    this->leaves.swap(m.leaves);
+    this->nLandmarks = nLandmarks;
+    this->nCascades = nCascades;
+    this->nTrees = nTrees;
+    this->depth = depth;
+    this->nPixels = nPixels;
+    return true;
+}
+
+// ***************************************************************
+// ** LANDMARK DETECTOR
+// ***************************************************************
+
+/** LandmarkDetector::predict
+  * Fit the landmarks of a model to a face
+  * model: loaded landmark model
+  * grey: grey planes of the frame
+  * box: face box
+  * points: 2*L image coordinates (output)
+  **/
+void LandmarkDetector::predict(const LandmarkModel& model, GreyFrame& grey, Rect& box, float* points)
+{
+    TraceSpan span("landmarks");
+
+    const unsigned char* image = grey.getGrey();
+    int w = grey.getW();
+    int h = grey.getH();
+
+    int nLandmarks = model.nLandmarks;
+    int nPixels = model.nPixels;
+    int nSplits = (1<<model.depth) - 1;
+    int nLeaves = 1<<model.depth;
+    int shapeSize = 2*nLandmarks;
+
+    this->shape.assign(model.meanShape.begin(), model.meanShape.end());
+    this->intensity.resize(nPixels);
+    float* shape = &this->shape[0];
+    float* intensity = &this->intensity[0];
+    const float* mean = &model.meanShape[0];
+
+    float boxX = box.getX();
+    float boxY = box.getY();
+    float boxW = box.getWidth();
+    float boxH = box.getHeight();
+
+    // Centered mean shape norm (for the similarity transforms)
+    float meanCx = 0, meanCy = 0;
+    for(int l=0; l<nLandmarks; ++l)
+    {
+        meanCx += mean[2*l];
+        meanCy += mean[2*l+1];
+    }
+    meanCx /= nLandmarks;
+    meanCy /= nLandmarks;
+
+    float meanNorm = 0;
+    for(int l=0; l<nLandmarks; ++l)
+    {
+        float mx = mean[2*l] - meanCx;
+        float my = mean[2*l+1] - meanCy;
+        meanNorm += mx*mx + my*my;
+    }
+
+    for(int c=0; c<model.nCascades; ++c)
+    {
+        // Similarity (scale and rotation [a -b; b a]) from the mean shape to the current shape
+        float cx = 0, cy = 0;
+        for(int l=0; l<nLandmarks; ++l)
+        {
+            cx += shape[2*l];
+            cy += shape[2*l+1];
+        }
+        cx /= nLandmarks;
+        cy /= nLandmarks;
+
+        float dot = 0, cross = 0;
+        for(int l=0; l<nLandmarks; ++l)
+        {
+            float mx = mean[2*l] - meanCx;
+            float my = mean[2*l+1] - meanCy;
+            float sx = shape[2*l] - cx;
+            float sy = shape[2*l+1] - cy;
+            dot += mx*sx + my*sy;
+            cross += mx*sy - my*sx;
+        }
+        float a = meanNorm>0 ? dot/meanNorm : 1;
+        float b = meanNorm>0 ? cross/meanNorm : 0;
+
+        // Sample the pixels of this level (grey as the integral images, 0 outside the frame)
+        const unsigned short* anchor = &model.anchor[c*nPixels];
+        const float* offset = &model.offset[2*c*nPixels];
+        for(int i=0; i<nPixels; ++i)
+        {
+            float dx = offset[2*i];
+            float dy = offset[2*i+1];
+            float u = shape[2*anchor[i]] + a*dx - b*dy;
+            float v = shape[2*anchor[i]+1] + b*dx + a*dy;
+            int x = static_cast<int>(floor(boxX + u*boxW + 0.5f));
+            int y = static_cast<int>(floor(boxY + v*boxH + 0.5f));
+
+            intensity[i] = x>=0 && x<w && y>=0 && y<h ? image[y*w + x] : 0;
+        }
+
+        // Trees: walk the splits, add the leaf increment
+        const LandmarkModel::Split* splits = &model.splits[(size_t)c*model.nTrees*nSplits];
+        const float* leaves = &model.leaves[(size_t)c*model.nTrees*nLeaves*shapeSize];
+        for(int t=0; t<model.nTrees; ++t)
+        {
+            const LandmarkModel::Split* tree = splits + t*nSplits;
+            int node = 0;
+            while(node<nSplits)
+            {
+                const LandmarkModel::Split& s = tree[node];
+                node = 2*node + (intensity[s.pixel1] - intensity[s.pixel2]>s.threshold ? 1 : 2);
+            }
+
+            const float* leaf = leaves + ((size_t)t*nLeaves + node - nSplits)*shapeSize;
+            for(int k=0; k<shapeSize; ++k)
+                shape[k] += leaf[k];
+        }
+    }
+
+    for(int l=0; l<nLandmarks; ++l)
+    {
+        points[2*l] = boxX + shape[2*l]*boxW;
+        points[2*l+1] = boxY + shape[2*l+1]*boxH;
+    }
+}
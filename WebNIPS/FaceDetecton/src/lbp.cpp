@@ -0,0 +1,176 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include "../inc/lbp.h"
+#include "../inc/costmap.h"
+
+// Threads are not available on asm.js/wasm builds without pthreads
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define CASCADE_THREADS 0
+#else
+#define CASCADE_THREADS 1
+#include <mutex>
+#endif
+
+// Stage thresholds are lowered as OpenCV does when loading, so leaf sums equal to the threshold
+// (rounded differently) pass as they do there
+const double LBP_THRESHOLD_EPS = 1e-5;
+
+
+// ***************************************************************
+// ** LBP CASCADE
+// ***************************************************************
+
+LbpFeature::LbpFeature(Rect& b, const int* s, double lV, double rV): block(b), lVal(lV), rVal(rV)
+{
+    for(int i=0; i<8; ++i)
+        this->subset[i] = s[i];
+}
+
+LbpCascade::LbpCascade(std::string& path2File): sizeH(0), sizeW(0)
+{
+    std::ifstream infile(path2File.c_str());
+    if (!infile)
+        return;
+
+    // Reference window size, after the format tag
+    std::string sLine;
+    std::string tag;
+    if (!std::getline(infile, sLine))
+        return;
+    std::istringstream header(sLine);
+    if (!(header >> tag >> this->sizeW >> this->sizeH) || tag!="lbp")
+    {
+        this->sizeW = this->sizeH = 0;
+        return;
+    }
+
+    std::vector<LbpFeature> features;
+    int currentStage = 0;
+    double stageT = 0;
+
+    while (std::getline(infile, sLine))
+    {
+        std::istringstream line(sLine);
+        int stage, x, y, w, h;
+        double T, lVal, rVal;
+        int subset[8];
+        if (!(line >> stage >> T >> x >> y >> w >> h >> lVal >> rVal))
+            continue;
+        for (int i=0; i<8; ++i)
+            line >> subset[i];
+        if (!line)
+        {
+            this->layer.clear();
+            return;
+        }
+
+        // New stage
+        if (stage==currentStage+1)
+        {
+            this->layer.push_back(LbpStage(features, stageT));
+            features.clear();
+            currentStage++;
+        }
+
+        Rect block(x, y, w, h);
+        features.push_back(LbpFeature(block, subset, lVal, rVal));
+        stageT = T - LBP_THRESHOLD_EPS;
+    }
+
+    // Load last stage into cascade
+    if (!features.empty())
+        this->layer.push_back(LbpStage(features, stageT));
+}
+
+const LbpCascade* LbpCascade::fromFile(const std::string& path)
+{
+    // Loaded cascades, kept until exit
+    static std::map<std::string, LbpCascade*> loaded;
+#if CASCADE_THREADS
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+
+    std::map<std::string, LbpCascade*>::iterator it = loaded.find(path);
+    if (it!=loaded.end())
+        return it->second;
+
+    std::string file = path;
+    LbpCascade* cascade = new LbpCascade(file);
+    if (cascade->layer.empty() || cascade->sizeW==0 || cascade->sizeH==0)
+    {
+        delete cascade;
+        return 0;
+    }
+
+    loaded[path] = cascade;
+    return cascade;
+}
+
+// ***************************************************************
+// ** DETECTOR (LBP ENGINE)
+// ***************************************************************
+
+std::vector<Rect> Detector::step(const LbpCascade& cascade, std::vector<Rect>& windows, Frame& im)
+{
+    std::vector<const LbpCascade*> cascades(1, &cascade);
+    return this->step(cascades, windows, im)[0];
+}
+
+std::vector<std::vector<Rect> > Detector::step(const std::vector<const LbpCascade*>& cascades, std::vector<Rect>& windows, Frame& im)
+{
+    std::vector<ScaledLbpCascade> scaled;
+    for (unsigned int m=0; m<cascades.size(); ++m)
+        scaled.push_back(ScaledLbpCascade(*cascades[m]));
+
+    return this->step(cascades, scaled, windows, im);
+}
+
+std::vector<std::vector<Rect> > Detector::step(const std::vector<const LbpCascade*>& cascades, std::vector<ScaledLbpCascade>& scaled, std::vector<Rect>& windows, Frame& im)
+{
+    // Windows are evaluated one by one, with no variance test: stage k of every cascade still
+    // accepting the window is evaluated before stage k+1, so a window is dropped at the earliest
+    // stage where all cascades rejected it
+    std::vector<std::vector<Rect> > positives(cascades.size());
+
+    unsigned int nStages = 0;
+    for (unsigned int m=0; m<cascades.size(); ++m)
+        nStages = std::max(nStages, (unsigned int)cascades[m]->layer.size());
+
+    const unsigned int* data = im.getIntData();
+    std::vector<bool> alive(cascades.size());
+    for (std::vector<Rect>::iterator win = windows.begin(); win!=windows.end(); ++win)
+    {
+        unsigned int origin = win->getX() + win->getY()*im.getWidth();
+
+        alive.assign(cascades.size(), true);
+        unsigned int nAlive = cascades.size();
+        for (unsigned int s=0; s<nStages && nAlive>0; ++s)
+        {
+            for (unsigned int m=0; m<cascades.size(); ++m)
+            {
+                // Rejected, or accepted by all its stages
+                if (!alive[m] || s>=cascades[m]->layer.size())
+                    continue;
+
+                scaled[m].scaleTo(win->getWidth(), win->getHeight(), im.getWidth());
+                if (this->costMap)
+                    this->costMap->add(*win, scaled[m].getFeatures(s));
+
+                if (!scaled[m].passes(s, data, origin))
+                {
+                    alive[m] = false;
+                    nAlive--;
+                }
+            }
+        }
+
+        for (unsigned int m=0; m<cascades.size(); ++m)
+            if (alive[m])
+                positives[m].push_back(*win);
+    }
+
+    return positives;
+}
@@ -1,14 +1,308 @@
+#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
+#endif
+#include <algorithm>
 #include "violajones.h"
+#include "lbp.h"
+#include "pipeline.h"
+#include "facelib.h"
+#include "trace.h"
+#include "costmap.h"
+#include "landmarks.h"
+#include "bbf.h"
+#include "greyframe.h"
 
 
-// Define common image buffer and return parameters
-unsigned char* buffer;		   	// Common buffer where input image is held
-unsigned short   rect[4];	  	// Rectangle defining the face bounding box (left, top, width, height)
-float 		   expression[7];  	// Vector defining the intensity for each facial expression
+// Face analysis instance
+struct FaceHandle
+{
+	unsigned char* buffer;		   	// Buffer where input image is held
+	GreyFrame*     grey;           	// Grey planes of the buffer, shared by every engine
+	unsigned short   rect[4];	  	// Rectangle defining the face bounding box (left, top, width, height)
+	bool           complete;       	// Last budgeted detection scanned every window
+	std::vector<float> heatmap;    	// Cost heatmap copy returned by fd_heatmap
+	std::vector<float> landmarks;  	// Landmark count and coordinates returned by fd_landmarks
+	std::vector<unsigned short> parts;	// Part count and boxes returned by fd_parts
+	std::vector<BbfDetection> objects;	// Objects found by fd_detect_bbf
+	std::vector<float> bbf;        	// Object count and objects returned by fd_detect_bbf
 
-// Define objects to be used
-ViolaJones*    faceDetector;   	// Face detection object
+	ViolaJones*    faceDetector;   	// Face detection object
+	LandmarkDetector* landmarkDetector;	// Landmark alignment object (model is shared)
+	BbfDetector*   bbfDetector;    	// BBF (ccv) detection object (cascade is shared)
+	FramePool*     frames;         	// Frame slots (optional)
+	DetectionPipeline* pipeline;   	// Asynchronous detection (optional)
+};
+
+// Default instance used by the single stream calls
+FaceHandle*    instance;
+
+// Landmark model shared (read-only) by all instances
+LandmarkModel  landmarkModel;
+
+// BBF cascade shared (read-only) by all instances
+BbfCascade     bbfCascade;
+
+// Default number of frame slots (capture, integral images, cascade and one queued frame)
+const int DEFAULT_SLOTS = 4;
+
+// Frame slot of the default instance owning a frame buffer, 0 if image is not a slot
+static FrameSlot* findSlot(unsigned char* image){
+	if(!instance || !instance->frames || !image)
+		return 0;
+	return instance->frames->find(image);
+}
+
+// ********************************************************
+// ** REENTRANT CALLS
+// ********************************************************
+
+extern "C"{
+	// Create instance with its own buffer and detector
+	FaceHandle* fd_create(int w, int h){
+		FaceHandle* fd = new FaceHandle();
+		fd->buffer = (unsigned char *)new unsigned char[w*h*4]();
+		fd->grey = new GreyFrame(w, h);
+		fd->grey->update(fd->buffer);
+		fd->faceDetector = new ViolaJones(w, h);
+		fd->landmarkDetector = new LandmarkDetector();
+		fd->bbfDetector = new BbfDetector(w, h);
+		std::fill(fd->rect, fd->rect + 4, 0);
+		fd->frames = 0;
+		fd->pipeline = 0;
+		fd->complete = true;
+
+		return fd;
+	}
+
+	// Return input image buffer
+	unsigned char* fd_frame_buffer(FaceHandle* fd){
+		return fd->buffer;
+	}
+
+	// Detect face and return bounding box (image is in buffer)
+	unsigned short* fd_detect(FaceHandle* fd){
+		fd->grey->update(fd->buffer);
+		fd->faceDetector->detect(*fd->grey, fd->rect);
+		return fd->rect;
+	}
+
+	// Detect face within budget (ms) and return bounding box (image is in buffer)
+	unsigned short* fd_detect_budget(FaceHandle* fd, double budget){
+		fd->grey->update(fd->buffer);
+		fd->faceDetector->detect(*fd->grey, fd->rect, budget, fd->complete);
+		return fd->rect;
+	}
+
+	// Return 1 if the last budgeted detection was not cut short by its deadline
+	int fd_detect_complete(FaceHandle* fd){
+		return fd->complete ? 1 : 0;
+	}
+
+	// Track face and return bounding box (image is in buffer)
+	unsigned short* fd_track(FaceHandle* fd){
+		fd->grey->update(fd->buffer);
+		fd->faceDetector->track(*fd->grey, fd->rect);
+
+		// Shrink box around the face
+		float scale = 0.7;
+		unsigned int dif = (1-scale)*fd->rect[2];
+
+		fd->rect[0] = fd->rect[0]+dif/2;
+		fd->rect[1] = fd->rect[1]+dif/2;
+		fd->rect[2] = fd->rect[2]-dif;
+		fd->rect[3] = fd->rect[3]-dif;
+
+		return fd->rect;
+	}
+
+	// Also detect faces with the cascade of a text file (utils/xml_parser.py), e.g. profile faces,
+	// in the same pass as the frontal one (both: with its mirrored cascade too). Return face model
+	// count, 0 if the cascade cannot be read
+	int fd_add_cascade(FaceHandle* fd, const char* cascade, int both){
+		const Cascade* faceCascade = Cascade::fromFile(cascade);
+		if(!faceCascade)
+			return 0;
+
+		int models = fd->faceDetector->addCascade(faceCascade);
+		if(both)
+			models = fd->faceDetector->addCascade(Cascade::fromFile(cascade, true));
+		return models;
+	}
+
+	// Detect faces with the LBP engine and the LBP cascade of a text file (utils/xml_parser.py)
+	// instead of the Haar cascades. Return LBP face model count, 0 if the cascade cannot be read
+	int fd_add_lbp_cascade(FaceHandle* fd, const char* cascade){
+		const LbpCascade* faceCascade = LbpCascade::fromFile(cascade);
+		if(!faceCascade)
+			return 0;
+
+		return fd->faceDetector->addLbpCascade(faceCascade);
+	}
+
+	// Search facial parts with the cascade of a text file (utils/xml_parser.py) in a region of the
+	// face box (x, y, w, h relative to it), at window widths minSize to maxSize of the face width.
+	// Return part index, -1 if the cascade cannot be read
+	int fd_add_part(FaceHandle* fd, const char* cascade, float x, float y, float w, float h, float minSize, float maxSize){
+		const Cascade* partCascade = Cascade::fromFile(cascade);
+		if(!partCascade)
+			return -1;
+
+		FacePart part = {partCascade, x, y, w, h, minSize, maxSize};
+		return fd->faceDetector->addPart(part);
+	}
+
+	// Detect facial parts inside the last face detected or tracked, reusing its integral images.
+	// Return part count then one box (left, top, width, height; all 0 if not found) per part
+	unsigned short* fd_parts(FaceHandle* fd){
+		Rect face(fd->rect[0], fd->rect[1], fd->rect[2], fd->rect[3]);
+		std::vector<Rect> found;
+		fd->faceDetector->detectParts(*fd->grey, face, found);
+
+		fd->parts.assign(1 + 4*found.size(), 0);
+		fd->parts[0] = found.size();
+		for(unsigned int i=0; i<found.size(); ++i)
+		{
+			fd->parts[1+4*i] = found[i].getX();
+			fd->parts[2+4*i] = found[i].getY();
+			fd->parts[3+4*i] = found[i].getWidth();
+			fd->parts[4+4*i] = found[i].getHeight();
+		}
+		return &fd->parts[0];
+	}
+
+	// Fit the landmarks of the loaded model to the face in box (left, top, width, height) of the
+	// frame in the buffer. Return landmark count then coordinates (x0, y0, x1, y1, ...), or null if
+	// no model is loaded or box is empty
+	float* fd_landmarks(FaceHandle* fd, int x, int y, int w, int h){
+		if(!landmarkModel.isLoaded() || w<=0 || h<=0)
+			return 0;
+
+		// The box may be of a frame written after the last detection: reconvert the buffer, keeping
+		// what fd_parts still needs of the detected frame
+		fd->faceDetector->keepFrame(*fd->grey);
+		fd->grey->update(fd->buffer);
+
+		Rect box(x, y, w, h);
+		int n = landmarkModel.getLandmarks();
+		fd->landmarks.resize(1 + 2*n);
+		fd->landmarks[0] = n;
+		fd->landmarkDetector->predict(landmarkModel, *fd->grey, box, &fd->landmarks[1]);
+		return &fd->landmarks[0];
+	}
+
+	// Detect objects with the loaded BBF cascade as ccv.detect_objects (interval levels per octave,
+	// groups of minNeighbors windows or more). Return object count then x, y, width, height,
+	// neighbors and confidence of every object, or null if no cascade is loaded
+	float* fd_detect_bbf(FaceHandle* fd, int interval, int minNeighbors){
+		if(!bbfCascade.isLoaded())
+			return 0;
+
+		fd->grey->update(fd->buffer);
+		fd->bbfDetector->detect(bbfCascade, *fd->grey, interval, minNeighbors, fd->objects);
+		fd->bbf.resize(1 + 6*fd->objects.size());
+		fd->bbf[0] = fd->objects.size();
+		for(unsigned int i=0; i<fd->objects.size(); ++i)
+		{
+			const BbfDetection& d = fd->objects[i];
+			float* out = &fd->bbf[1+6*i];
+			out[0] = d.x;
+			out[1] = d.y;
+			out[2] = d.width;
+			out[3] = d.height;
+			out[4] = d.neighbors;
+			out[5] = d.confidence;
+		}
+		return &fd->bbf[0];
+	}
+
+	// Start accumulating the cost heatmap on cell x cell pixel cells (cell 0: stop)
+	void fd_heatmap_enable(FaceHandle* fd, int cell){
+		fd->faceDetector->enableCostMap(cell>0 ? cell : 0);
+	}
+
+	// Return cost heatmap as floats: grid width, grid height, number of scales, then one
+	// row major plane of features evaluated per cell for every scale. Null if not enabled
+	float* fd_heatmap(FaceHandle* fd){
+		CostMap* map = fd->faceDetector->getCostMap();
+		if(!map)
+			return 0;
+
+		unsigned int size = map->getScales()*map->getGridW()*map->getGridH();
+		fd->heatmap.resize(3 + size);
+		fd->heatmap[0] = map->getGridW();
+		fd->heatmap[1] = map->getGridH();
+		fd->heatmap[2] = map->getScales();
+		std::copy(map->getData(), map->getData() + size, fd->heatmap.begin() + 3);
+		return &fd->heatmap[0];
+	}
+
+	// Write cost heatmap of scale sc (sum of all scales if sc<0) as PGM. Return 0 on error
+	int fd_heatmap_write(FaceHandle* fd, const char* path, int sc){
+		CostMap* map = fd->faceDetector->getCostMap();
+		return map && map->writePGM(path, sc) ? 1 : 0;
+	}
+
+	// Free instance (pipeline is stopped before its frames and detector go away)
+	void fd_destroy(FaceHandle* fd){
+		delete fd->pipeline;
+		delete fd->frames;
+		delete fd->faceDetector;
+		delete fd->landmarkDetector;
+		delete fd->bbfDetector;
+		delete fd->grey;
+		delete[] fd->buffer;
+		delete fd;
+	}
+
+	// Return cascade statistics of all instances as JSON (valid until next call)
+	const char* get_stats(){
+		static std::string json;
+		json = CascadeStats::toJson();
+		return json.c_str();
+	}
+
+	// Clear cascade statistics
+	void reset_stats(){
+		CascadeStats::reset();
+	}
+
+	// Start (on != 0) or stop recording phase spans of all instances
+	void trace_enable(int on){
+		Trace::enable(on!=0);
+	}
+
+	// Return recorded spans as Chrome trace_event JSON (valid until next call)
+	const char* get_trace(){
+		static std::string json;
+		json = Trace::toJson();
+		return json.c_str();
+	}
+
+	// Forget recorded spans
+	void reset_trace(){
+		Trace::reset();
+	}
+
+	// Load the landmark model of all instances from memory. Return landmark count, 0 on error
+	int load_landmark_model(const unsigned char* data, int size){
+		return size>0 && landmarkModel.load(data, size) ? landmarkModel.getLandmarks() : 0;
+	}
+
+	// Load the landmark model of all instances from a file. Return landmark count, 0 on error
+	int load_landmark_model_file(const char* path){
+		return landmarkModel.load(std::string(path)) ? landmarkModel.getLandmarks() : 0;
+	}
+
+	// Load the BBF cascade of all instances from memory. Return stage count, 0 on error
+	int load_bbf_cascade(const unsigned char* data, int size){
+		return size>0 && bbfCascade.load(data, size) ? bbfCascade.stage.size() : 0;
+	}
+
+	// Load the BBF cascade of all instances from a file. Return stage count, 0 on error
+	int load_bbf_cascade_file(const char* path){
+		return bbfCascade.load(std::string(path)) ? bbfCascade.stage.size() : 0;
+	}
+}
 
 // ********************************************************
 // ** ASM.JS EXTERNAL CALLS
@@ -16,65 +310,130 @@ ViolaJones*    faceDetector;   	// Face detection object
 
 // Allocate buffer into memory
 extern "C"{
-	// Allocate image buffer (and do other initializations) and return a pointer to it
+	// Allocate image buffer (and its grey planes, detectors...) and return a pointer to it
 	unsigned char* capture_buffer(int w, int h){
-		buffer = (unsigned char *)new unsigned char[w*h*4];
-		faceDetector = new ViolaJones(w, h);
+		// Release previous instance
+		if(instance)
+			fd_destroy(instance);
+
+		instance = fd_create(w, h);
 
 		// Return input image buffer
-		return buffer;
+		return fd_frame_buffer(instance);
 	}
 
 	// Detect face and return bounding box (image is in buffer)
     unsigned short* detect_face(){
-		faceDetector->detect(buffer, rect);
-		return rect;
+		return fd_detect(instance);
+	}
+
+	// Detect face within budget (ms) and return bounding box (image is in buffer)
+    unsigned short* detect_face_budget(double budget){
+		return fd_detect_budget(instance, budget);
+	}
+
+	// Return 1 if the last budgeted detection scanned every window
+    int detect_complete(){
+		return fd_detect_complete(instance);
 	}
 
 	// Track face and return bounding box (image is in buffer)
     unsigned short* track_face(){
-        faceDetector->detect(buffer, rect);
-
-        float scale = 0.7;
-        unsigned int dif = (1-scale)*rect[2];
-        /*
-        unsigned short roi2track[4];
-        if(rect[2]==0 || rect[3]==0)
-        {
-            // If no detection set roi to whole frame
-            roi2track[0] = 0;
-            roi2track[1] = 0;
-            roi2track[2] = faceDetector->getW();
-            roi2track[3] = faceDetector->getH();
-        }
-        else
-        {
-            // Define roi
-            Rect roi(rect[0]-dif/2, rect[1]-dif/2, rect[2]+dif, rect[3]+dif);
-            Rect wholeFrame = Rect(0, 0, faceDetector->getW(), faceDetector->getH());
-            roi.limitTo(wholeFrame);
-
-            // Look around previous detection
-            roi2track[0] = roi.getX();
-            roi2track[1] = roi.getY();
-            roi2track[2] = roi.getWidth();
-            roi2track[3] = roi.getHeight();
-        }
-
-        faceDetector->track(buffer, roi2track, rect);
-        */
-
-        rect[0] = rect[0]+dif/2;
-        rect[1] = rect[1]+dif/2;
-        rect[2] = rect[2]-dif;
-        rect[3] = rect[3]-dif;
-
-		return rect;
-	}
-
-	// Recognize expression and return bounding box (image is in buffer)
-	float* recognize_expression(){
-		// TODO
-		return expression;
+		return fd_track(instance);
+	}
+
+	// Allocate n frame slots (and do other initializations). Frames are then written into
+	// slots from acquire_buffer instead of the common buffer
+	void capture_buffers(int w, int h, int n){
+		capture_buffer(w, h);
+		instance->frames = new FramePool(w, h, n);
+	}
+
+	// Get a free frame slot to write a frame into
+	unsigned char* acquire_buffer(){
+		FrameSlot* slot = instance->pipeline ? instance->pipeline->acquire() : instance->frames->acquire();
+		return slot ? slot->image : 0;
+	}
+
+	// Give an acquired frame slot back without submitting it. Return 0 if image is not a slot or
+	// the slot is not acquired (e.g. released twice or submitted)
+	int release_buffer(unsigned char* image){
+		FrameSlot* slot = findSlot(image);
+		if(!slot || !instance->frames->isAcquired(slot))
+			return 0;
+		return instance->frames->release(slot) ? 1 : 0;
+	}
+
+	// Detect face on an acquired frame slot and return bounding box (slot is kept), null if image
+	// is not an acquired slot
+	unsigned short* detect_buffer(unsigned char* image){
+		ViolaJones* faceDetector = instance->faceDetector;
+		FrameSlot* slot = findSlot(image);
+		if(!slot || !instance->frames->isAcquired(slot))
+			return 0;
+
+		DetectionPipeline::integrate(faceDetector, slot);
+
+		Frame frame = DetectionPipeline::frameOf(faceDetector, slot);
+		faceDetector->detect(frame, instance->rect);
+		return instance->rect;
+	}
+
+	// Start asynchronous detection of frames submitted through buffer or frame slots
+	void start_pipeline(){
+		ViolaJones* faceDetector = instance->faceDetector;
+		if(!instance->frames)
+			instance->frames = new FramePool(faceDetector->getW(), faceDetector->getH(), DEFAULT_SLOTS);
+		if(!instance->pipeline)
+			instance->pipeline = new DetectionPipeline(faceDetector, instance->frames);
+	}
+
+	// Queue an acquired frame slot for asynchronous detection (slot is released once processed).
+	// Return frame id, -1 if the pipeline is not started or image is not an acquired slot
+	int submit_buffer(unsigned char* image){
+		FrameSlot* slot = findSlot(image);
+		if(!slot || !instance->pipeline || !instance->frames->isAcquired(slot))
+			return -1;
+		return static_cast<int>(instance->pipeline->submit(slot));
+	}
+
+	// Queue the frame in buffer for asynchronous detection. Return its id, -1 if the pipeline is
+	// not started
+	int submit_frame(){
+		if(!instance || !instance->pipeline)
+			return -1;
+		return static_cast<int>(instance->pipeline->submit(instance->buffer));
+	}
+
+	// Return latest asynchronous bounding box, or null if none since last call or the pipeline is
+	// not started
+	unsigned short* poll_face(){
+		unsigned int frameId;
+		if(!instance || !instance->pipeline || !instance->pipeline->poll(instance->rect, frameId))
+			return 0;
+		return instance->rect;
+	}
+
+	// Detect facial parts inside the last face detected or tracked (on the frame it was found in)
+	unsigned short* detect_parts(){
+		return fd_parts(instance);
+	}
+
+	// Fit landmarks to the last face detected or tracked (on the frame in the buffer)
+	float* detect_landmarks(){
+		unsigned short* rect = instance->rect;
+		return fd_landmarks(instance, rect[0], rect[1], rect[2], rect[3]);
+	}
+
+	// Buffer of size bytes to write a BBF cascade into before load_bbf_cascade (valid until next call)
+	unsigned char* bbf_cascade_buffer(int size){
+		static std::vector<unsigned char> staging;
+		staging.resize(size>0 ? size : 1);
+		return &staging[0];
+	}
+
+	// Detect objects with the BBF cascade (image is in buffer), as fd_detect_bbf
+	float* detect_face_bbf(int interval, int minNeighbors){
+		return fd_detect_bbf(instance, interval, minNeighbors);
 	}
 }
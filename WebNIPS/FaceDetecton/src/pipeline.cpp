@@ -0,0 +1,264 @@
+#include <cstring>
+#include <algorithm>
+#include "../inc/pipeline.h"
+#include "../inc/greyframe.h"
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+DetectionPipeline::DetectionPipeline(ViolaJones* det, FramePool* pl, DetectionCallback cb, void* usr):
+    detector(det), pool(pl), callback(cb), user(usr), pendingInput(0), pendingReady(0),
+    resultId(0), resultPending(false), nextId(0), dropped(0), running(true)
+{
+    std::fill(this->result, this->result+4, 0);
+
+#if PIPELINE_THREADS
+    this->integrateThread = std::thread(&DetectionPipeline::integrateLoop, this);
+    this->detectThread = std::thread(&DetectionPipeline::detectLoop, this);
+#endif
+}
+
+DetectionPipeline::~DetectionPipeline()
+{
+#if PIPELINE_THREADS
+    // Stop stages
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->running = false;
+    }
+    this->inputCond.notify_all();
+    this->readyCond.notify_all();
+
+    this->integrateThread.join();
+    this->detectThread.join();
+#endif
+
+    // Give queued frames back
+    if(this->pendingInput)
+        this->pool->release(this->pendingInput);
+    if(this->pendingReady)
+        this->pool->release(this->pendingReady);
+}
+
+/** DetectionPipeline::acquire
+  * Get a slot to write the next frame into
+  * If the pool is exhausted, the oldest queued frame is dropped and its slot reused. Otherwise
+  * waits for the cascade to finish with a slot (threaded builds) or returns 0
+  **/
+FrameSlot* DetectionPipeline::acquire()
+{
+    FrameSlot* slot = this->pool->tryAcquire();
+    if(slot)
+        return slot;
+
+    // Reclaim a queued frame (latest frame wins)
+    {
+#if PIPELINE_THREADS
+        std::lock_guard<std::mutex> guard(this->lock);
+#endif
+        if(this->pendingReady)
+        {
+            slot = this->pendingReady;
+            this->pendingReady = 0;
+        }
+        else if(this->pendingInput)
+        {
+            slot = this->pendingInput;
+            this->pendingInput = 0;
+        }
+
+        if(slot)
+        {
+            this->pool->takeBack(slot);
+            this->dropped++;
+            return slot;
+        }
+    }
+
+    return this->pool->acquire();
+}
+
+/** DetectionPipeline::submit
+  * Queue a frame for detection. A queued frame not yet picked up by the pipeline is dropped
+  * slot: slot from DetectionPipeline::acquire holding the frame (owned by the pipeline on return)
+  * Return id of the queued frame
+  **/
+unsigned int DetectionPipeline::submit(FrameSlot* slot)
+{
+    this->pool->handOver(slot);
+
+#if PIPELINE_THREADS
+    unsigned int id;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if(this->pendingInput)
+        {
+            this->pool->release(this->pendingInput);
+            this->dropped++;
+        }
+
+        id = slot->id = this->nextId++;
+        this->pendingInput = slot;
+    }
+    this->inputCond.notify_one();
+
+    return id;
+#else
+    // Run both stages in place
+    unsigned int id = slot->id = this->nextId++;
+    integrate(this->detector, slot);
+    this->detect(slot);
+
+    return id;
+#endif
+}
+
+/** DetectionPipeline::submit
+  * Queue a copy of a frame for detection
+  * image: pointer to the image array (copied, can be overwritten on return)
+  * Return id of the queued frame
+  **/
+unsigned int DetectionPipeline::submit(unsigned char* image)
+{
+    FrameSlot* slot = this->acquire();
+    memcpy(slot->image, image, 4*this->pool->getW()*this->pool->getH());
+
+    return this->submit(slot);
+}
+
+/** DetectionPipeline::poll
+  * Get latest detection result
+  * rect: 4-element array where the face location is to be placed
+  * frameId: id of the frame the result belongs to
+  * Return false if there is no new result since last call
+  **/
+bool DetectionPipeline::poll(unsigned short* rect, unsigned int& frameId)
+{
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+
+    if(!this->resultPending)
+        return false;
+
+    std::copy(this->result, this->result+4, rect);
+    frameId = this->resultId;
+    this->resultPending = false;
+
+    return true;
+}
+
+unsigned int DetectionPipeline::getDropped()
+{
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+
+    return this->dropped;
+}
+
+/** DetectionPipeline::integrate
+  * Integral images of a slot frame. The tilted and integer integral images of a detector with
+  * tilted features or LBP cascades are allocated once per slot and kept with it
+  **/
+void DetectionPipeline::integrate(ViolaJones* detector, FrameSlot* slot)
+{
+    unsigned int size = detector->getW()*detector->getH();
+    if(detector->needsTilted() && !slot->tiltIm)
+        slot->tiltIm = new float[size]();
+    if(detector->needsInteger() && !slot->lbpIm)
+        slot->lbpIm = new unsigned int[size]();
+
+    slot->grey->update(slot->image);
+    detector->integrate(*slot->grey, slot->intIm, slot->sqIntIm, detector->needsTilted() ? slot->tiltIm : 0,
+                        detector->needsInteger() ? slot->lbpIm : 0);
+}
+
+Frame DetectionPipeline::frameOf(ViolaJones* detector, FrameSlot* slot)
+{
+    return Frame(slot->intIm, slot->sqIntIm, detector->getW(), detector->getH(),
+                 detector->needsTilted() ? slot->tiltIm : 0, detector->needsInteger() ? slot->lbpIm : 0);
+}
+
+// ***************************************************************
+// ** PRIVATE CLASS METHODS
+// ***************************************************************
+
+void DetectionPipeline::detect(FrameSlot* slot)
+{
+    Frame frame = frameOf(this->detector, slot);
+
+    unsigned short rect[4];
+    unsigned int id = slot->id;
+    this->detector->detect(frame, rect);
+    this->pool->release(slot);
+
+    if(this->callback)
+        this->callback(id, rect, this->user);
+
+#if PIPELINE_THREADS
+    std::lock_guard<std::mutex> guard(this->lock);
+#endif
+    std::copy(rect, rect+4, this->result);
+    this->resultId = id;
+    this->resultPending = true;
+}
+
+#if PIPELINE_THREADS
+void DetectionPipeline::integrateLoop()
+{
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while(true)
+    {
+        // Wait for a new frame
+        while(this->running && !this->pendingInput)
+            this->inputCond.wait(guard);
+
+        if(!this->running)
+            break;
+
+        FrameSlot* slot = this->pendingInput;
+        this->pendingInput = 0;
+
+        guard.unlock();
+        integrate(this->detector, slot);
+        guard.lock();
+
+        // Publish integral images, replacing any not yet taken by the cascade
+        if(this->pendingReady)
+        {
+            this->pool->release(this->pendingReady);
+            this->dropped++;
+        }
+
+        this->pendingReady = slot;
+        this->readyCond.notify_one();
+    }
+}
+
+void DetectionPipeline::detectLoop()
+{
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while(true)
+    {
+        // Wait for integral images
+        while(this->running && !this->pendingReady)
+            this->readyCond.wait(guard);
+
+        if(!this->running)
+            break;
+
+        FrameSlot* slot = this->pendingReady;
+        this->pendingReady = 0;
+
+        guard.unlock();
+        this->detect(slot);
+        guard.lock();
+    }
+}
+#endif
@@ -0,0 +1,416 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "../inc/resample.h"
+
+#if defined(__wasm_simd128__)
+#define RESAMPLE_WASM_SIMD 1
+#include <wasm_simd128.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define RESAMPLE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Sum of the weights of the horizontal and vertical passes (1<<WEIGHT_BITS each)
+const int OUT_SHIFT = 16;
+
+// (r+g+b)/3 as (r+g+b)*GREY_MUL>>GREY_SHIFT, exact for sums up to 3*255
+const unsigned int GREY_MUL = 43691;
+const int GREY_SHIFT = 17;
+
+// Zero bytes after the grey source row, so 32 bit gathers of its last pixels stay inside
+const int GREY_PAD = 4;
+
+
+// ***************************************************************
+// ** HORIZONTAL PASS KERNELS
+// ***************************************************************
+
+// Grey of pixels [from, n) of an RGBA row
+static void greyScalar(const unsigned char* rgba, unsigned char* grey, int from, int n)
+{
+    for(int c=from; c<n; ++c)
+        grey[c] = (rgba[4*c] + rgba[4*c+1] + rgba[4*c+2])/3;
+}
+
+// Taps of outputs [from, n) of a grey row (tap k of output i: index[first[i]+k], weight[...])
+static void horizontalScalar(const unsigned char* grey, const int* first, const int* count, const int* index,
+                             const int* weight, unsigned short* dst, int from, int n)
+{
+    for(int i=from; i<n; ++i)
+    {
+        unsigned int acc = 0;
+        for(int k=first[i]; k<first[i] + count[i]; ++k)
+            acc += grey[index[k]]*weight[k];
+        dst[i] = static_cast<unsigned short>(acc);
+    }
+}
+
+
+// ***************************************************************
+// ** VERTICAL PASS KERNELS
+// ***************************************************************
+
+// Weighted sum of count rows, for outputs [from, n)
+static void verticalScalar(const unsigned short* const* rows, const int* weights, int count, unsigned char* dst, int from, int n)
+{
+    for(int i=from; i<n; ++i)
+    {
+        unsigned int acc = 1u<<(OUT_SHIFT-1);
+        for(int k=0; k<count; ++k)
+            acc += rows[k][i]*weights[k];
+        dst[i] = static_cast<unsigned char>(acc>>OUT_SHIFT);
+    }
+}
+
+#ifdef RESAMPLE_AVX2
+__attribute__((target("avx2")))
+static void verticalAvx2(const unsigned short* const* rows, const int* weights, int count, unsigned char* dst, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        __m256i acc = _mm256_set1_epi32(1<<(OUT_SHIFT-1));
+        for(int k=0; k<count; ++k)
+        {
+            __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(rows[k] + i)));
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(v, _mm256_set1_epi32(weights[k])));
+        }
+        acc = _mm256_srli_epi32(acc, OUT_SHIFT);
+
+        // Narrow to bytes (packs work within 128 bit lanes: 4 outputs per lane)
+        __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(acc, acc), _mm256_setzero_si256());
+        int lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(packed));
+        int hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(packed, 1));
+        memcpy(dst + i, &lo, 4);
+        memcpy(dst + i + 4, &hi, 4);
+    }
+    verticalScalar(rows, weights, count, dst, i, n);
+}
+
+__attribute__((target("avx2")))
+static void greyAvx2(const unsigned char* rgba, unsigned char* grey, int n)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256i mul = _mm256_set1_epi32(GREY_MUL);
+
+    int c = 0;
+    for(; c+8<=n; c+=8)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i*)(rgba + 4*c));
+        __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(px, mask), _mm256_and_si256(_mm256_srli_epi32(px, 8), mask)),
+                                       _mm256_and_si256(_mm256_srli_epi32(px, 16), mask));
+        sum = _mm256_srli_epi32(_mm256_mullo_epi32(sum, mul), GREY_SHIFT);
+
+        __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(sum, sum), _mm256_setzero_si256());
+        int lo = _mm_cvtsi128_si32(_mm256_castsi256_si128(packed));
+        int hi = _mm_cvtsi128_si32(_mm256_extracti128_si256(packed, 1));
+        memcpy(grey + c, &lo, 4);
+        memcpy(grey + c + 4, &hi, 4);
+    }
+    greyScalar(rgba, grey, c, n);
+}
+
+// Taps padded to count per output and stored by tap (tap k of output i: index[k*n + i]), 8
+// outputs gathered at a time (grey is followed by GREY_PAD bytes)
+__attribute__((target("avx2")))
+static void horizontalAvx2(const unsigned char* grey, const int* index, const int* weight, int count,
+                           unsigned short* dst, int from, int n)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+
+    int i = from;
+    for(; i+8<=n; i+=8)
+    {
+        __m256i acc = _mm256_setzero_si256();
+        for(int k=0; k<count; ++k)
+        {
+            __m256i idx = _mm256_loadu_si256((const __m256i*)(index + k*n + i));
+            __m256i w = _mm256_loadu_si256((const __m256i*)(weight + k*n + i));
+            __m256i v = _mm256_and_si256(_mm256_i32gather_epi32((const int*)grey, idx, 1), mask);
+            acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(v, w));
+        }
+
+        // Narrow to 16 bit (packs work within 128 bit lanes), then join both lanes
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(acc, acc), 0x08);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(packed));
+    }
+}
+
+static bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+#ifdef RESAMPLE_WASM_SIMD
+static void verticalWasm(const unsigned short* const* rows, const int* weights, int count, unsigned char* dst, int n)
+{
+    int i = 0;
+    for(; i+8<=n; i+=8)
+    {
+        v128_t lo = wasm_i32x4_splat(1<<(OUT_SHIFT-1));
+        v128_t hi = lo;
+        for(int k=0; k<count; ++k)
+        {
+            v128_t v = wasm_v128_load(rows[k] + i);
+            v128_t w = wasm_i32x4_splat(weights[k]);
+            lo = wasm_i32x4_add(lo, wasm_i32x4_mul(wasm_u32x4_extend_low_u16x8(v), w));
+            hi = wasm_i32x4_add(hi, wasm_i32x4_mul(wasm_u32x4_extend_high_u16x8(v), w));
+        }
+        lo = wasm_u32x4_shr(lo, OUT_SHIFT);
+        hi = wasm_u32x4_shr(hi, OUT_SHIFT);
+
+        v128_t packed = wasm_u8x16_narrow_i16x8(wasm_u16x8_narrow_i32x4(lo, hi), wasm_i16x8_splat(0));
+        long long out = wasm_i64x2_extract_lane(packed, 0);
+        memcpy(dst + i, &out, 8);
+    }
+    verticalScalar(rows, weights, count, dst, i, n);
+}
+
+static void greyWasm(const unsigned char* rgba, unsigned char* grey, int n)
+{
+    const v128_t mask = wasm_i32x4_splat(0xff);
+    const v128_t mul = wasm_i32x4_splat(GREY_MUL);
+
+    int c = 0;
+    for(; c+4<=n; c+=4)
+    {
+        v128_t px = wasm_v128_load(rgba + 4*c);
+        v128_t sum = wasm_i32x4_add(wasm_i32x4_add(wasm_v128_and(px, mask), wasm_v128_and(wasm_u32x4_shr(px, 8), mask)),
+                                    wasm_v128_and(wasm_u32x4_shr(px, 16), mask));
+        sum = wasm_u32x4_shr(wasm_i32x4_mul(sum, mul), GREY_SHIFT);
+
+        v128_t packed = wasm_u8x16_narrow_i16x8(wasm_u16x8_narrow_i32x4(sum, sum), wasm_i16x8_splat(0));
+        int out = wasm_i32x4_extract_lane(packed, 0);
+        memcpy(grey + c, &out, 4);
+    }
+    greyScalar(rgba, grey, c, n);
+}
+
+// As horizontalAvx2, 4 outputs at a time (SIMD128 has no gather: lanes are loaded one by one)
+static void horizontalWasm(const unsigned char* grey, const int* index, const int* weight, int count,
+                           unsigned short* dst, int from, int n)
+{
+    int i = from;
+    for(; i+4<=n; i+=4)
+    {
+        v128_t acc = wasm_i32x4_splat(0);
+        for(int k=0; k<count; ++k)
+        {
+            const int* idx = index + k*n + i;
+            v128_t v = wasm_i32x4_make(grey[idx[0]], grey[idx[1]], grey[idx[2]], grey[idx[3]]);
+            acc = wasm_i32x4_add(acc, wasm_i32x4_mul(v, wasm_v128_load(weight + k*n + i)));
+        }
+
+        v128_t packed = wasm_u16x8_narrow_i32x4(acc, acc);
+        long long out = wasm_i64x2_extract_lane(packed, 0);
+        memcpy(dst + i, &out, 8);
+    }
+}
+#endif
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+Resampler::Resampler(int dstW, int dstH, Mode mode): dstW(dstW), dstH(dstH), mode(mode), hCount(0)
+{
+}
+
+const char* Resampler::simdKernel()
+{
+#if defined(RESAMPLE_AVX2)
+    return hasAvx2() ? "avx2" : "scalar";
+#elif defined(RESAMPLE_WASM_SIMD)
+    return "wasm-simd128";
+#else
+    return "scalar";
+#endif
+}
+
+/** Resampler::apply
+  * Resample box of a source image into a dstW x dstH grey patch
+  * src: source image (RGBA if channels is 4, grey if 1)
+  * srcW, srcH: source size
+  * stride: bytes per source row
+  * channels: 4 or 1
+  * box: region to resample (may exceed the source, edges are repeated)
+  * dst: output patch (dstW*dstH bytes)
+  * simd: use the vectorized kernels if available
+  **/
+void Resampler::apply(const unsigned char* src, int srcW, int srcH, int stride, int channels, Rect box,
+                      unsigned char* dst, bool simd)
+{
+    this->computeTaps(box.getX(), std::max(1, box.getWidth()), this->dstW, srcW, this->hTaps);
+    this->computeTaps(box.getY(), std::max(1, box.getHeight()), this->dstH, srcH, this->vTaps);
+
+    // Source columns and rows used
+    int colFirst = *std::min_element(this->hTaps.index.begin(), this->hTaps.index.end());
+    int colLast = *std::max_element(this->hTaps.index.begin(), this->hTaps.index.end());
+    int rowFirst = *std::min_element(this->vTaps.index.begin(), this->vTaps.index.end());
+    int rowLast = *std::max_element(this->vTaps.index.begin(), this->vTaps.index.end());
+
+    // Horizontal taps relative to the grey row, padded with null ones to the same count and stored by
+    // tap for the vectorized kernels
+    int nCols = colLast - colFirst + 1;
+    int n = this->dstW;
+    this->hCount = *std::max_element(this->hTaps.count.begin(), this->hTaps.count.end());
+    this->hIndex.assign(this->hCount*n, 0);
+    this->hWeight.assign(this->hCount*n, 0);
+    for(unsigned int k=0; k<this->hTaps.index.size(); ++k)
+        this->hTaps.index[k] -= colFirst;
+    for(int i=0; i<n; ++i)
+    {
+        for(int k=0; k<this->hTaps.count[i]; ++k)
+        {
+            this->hIndex[k*n + i] = this->hTaps.index[this->hTaps.first[i] + k];
+            this->hWeight[k*n + i] = this->hTaps.weight[this->hTaps.first[i] + k];
+        }
+    }
+
+    // Horizontal pass: grey conversion and taps of every source row used
+    this->grey.resize(nCols + GREY_PAD);
+    this->rows.resize((rowLast - rowFirst + 1)*n);
+    for(int r=rowFirst; r<=rowLast; ++r)
+    {
+        const unsigned char* line = src + r*stride;
+        unsigned char* grey = &this->grey[0];
+        unsigned short* out = &this->rows[(r-rowFirst)*n];
+
+        if(channels!=4)
+            memcpy(grey, line + colFirst, nCols);
+#if defined(RESAMPLE_AVX2)
+        else if(simd && hasAvx2())
+            greyAvx2(line + 4*colFirst, grey, nCols);
+#elif defined(RESAMPLE_WASM_SIMD)
+        else if(simd)
+            greyWasm(line + 4*colFirst, grey, nCols);
+#endif
+        else
+            greyScalar(line + 4*colFirst, grey, 0, nCols);
+
+        // Outputs left by the vectorized kernel are done by the scalar one
+        int from = 0;
+#if defined(RESAMPLE_AVX2)
+        if(simd && hasAvx2())
+        {
+            horizontalAvx2(grey, &this->hIndex[0], &this->hWeight[0], this->hCount, out, 0, n);
+            from = n - n%8;
+        }
+#elif defined(RESAMPLE_WASM_SIMD)
+        if(simd)
+        {
+            horizontalWasm(grey, &this->hIndex[0], &this->hWeight[0], this->hCount, out, 0, n);
+            from = n - n%4;
+        }
+#endif
+        horizontalScalar(grey, &this->hTaps.first[0], &this->hTaps.count[0], &this->hTaps.index[0], &this->hTaps.weight[0],
+                         out, from, n);
+    }
+
+    // Vertical pass
+    for(int j=0; j<this->dstH; ++j)
+    {
+        int first = this->vTaps.first[j];
+        int count = this->vTaps.count[j];
+        this->rowPtrs.resize(count);
+        for(int k=0; k<count; ++k)
+            this->rowPtrs[k] = &this->rows[(this->vTaps.index[first+k] - rowFirst)*this->dstW];
+
+        const unsigned short* const* rowsIn = &this->rowPtrs[0];
+        const int* weights = &this->vTaps.weight[first];
+        unsigned char* out = dst + j*this->dstW;
+
+#if defined(RESAMPLE_AVX2)
+        if(simd && hasAvx2())
+        {
+            verticalAvx2(rowsIn, weights, count, out, this->dstW);
+            continue;
+        }
+#elif defined(RESAMPLE_WASM_SIMD)
+        if(simd)
+        {
+            verticalWasm(rowsIn, weights, count, out, this->dstW);
+            continue;
+        }
+#endif
+        verticalScalar(rowsIn, weights, count, out, 0, this->dstW);
+    }
+}
+
+// ***************************************************************
+// ** PRIVATE CLASS METHODS
+// ***************************************************************
+
+/** Resampler::computeTaps
+  * Source taps and fixed point weights (summing to 1<<WEIGHT_BITS) of every output along an axis
+  * start, length: source range
+  * n: number of outputs
+  * limit: source size (taps are clamped to [0, limit))
+  **/
+void Resampler::computeTaps(double start, double length, int n, int limit, Taps& taps)
+{
+    taps.first.resize(n);
+    taps.count.resize(n);
+    taps.index.clear();
+    taps.weight.clear();
+
+    double step = length/n;
+    std::vector<std::pair<int,double> >& raw = this->raw;
+    std::vector<int>& q = this->quantized;
+    for(int i=0; i<n; ++i)
+    {
+        raw.clear();
+        if(this->mode==AREA)
+        {
+            double lo = start + i*step;
+            double hi = lo + step;
+            for(int p=static_cast<int>(floor(lo)); p<hi; ++p)
+            {
+                double cover = std::min(hi, p+1.0) - std::max(lo, (double)p);
+                if(cover>0)
+                    raw.push_back(std::pair<int,double>(p, cover/step));
+            }
+        }
+        else if(this->mode==BILINEAR)
+        {
+            double center = start + (i+0.5)*step - 0.5;
+            int p = static_cast<int>(floor(center));
+            double a = center - p;
+            raw.push_back(std::pair<int,double>(p, 1-a));
+            raw.push_back(std::pair<int,double>(p+1, a));
+        }
+        else
+        {
+            int lo = static_cast<int>(floor(start + i*step));
+            int hi = std::max(lo+1, static_cast<int>(floor(start + (i+1)*step)));
+            for(int p=lo; p<hi; ++p)
+                raw.push_back(std::pair<int,double>(p, 1.0/(hi-lo)));
+        }
+
+        // Quantize, give the rounding error to the heaviest tap and drop null taps
+        int total = 0;
+        unsigned int heaviest = 0;
+        q.resize(raw.size());
+        for(unsigned int k=0; k<raw.size(); ++k)
+        {
+            q[k] = static_cast<int>(floor(raw[k].second*(1<<WEIGHT_BITS) + 0.5));
+            total += q[k];
+            if(raw[k].second>raw[heaviest].second)
+                heaviest = k;
+        }
+        q[heaviest] += (1<<WEIGHT_BITS) - total;
+
+        taps.first[i] = taps.index.size();
+        for(unsigned int k=0; k<raw.size(); ++k)
+        {
+            if(q[k]==0)
+                continue;
+            taps.index.push_back(std::max(0, std::min(raw[k].first, limit-1)));
+            taps.weight.push_back(q[k]);
+        }
+        taps.count[i] = taps.index.size() - taps.first[i];
+    }
+}
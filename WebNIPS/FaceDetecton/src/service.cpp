@@ -0,0 +1,301 @@
+#include <cstring>
+#include <algorithm>
+#include "../inc/service.h"
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+DetectionService::DetectionService(unsigned int nThreads, StreamCallback cb, void* usr):
+    callback(cb), user(usr), cursor(0), running(true)
+{
+    for(unsigned int i=0; i<nThreads; ++i)
+        this->workers.push_back(std::thread(&DetectionService::workerLoop, this));
+}
+
+DetectionService::~DetectionService()
+{
+    // Stop workers
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->running = false;
+    }
+    this->work.notify_all();
+
+    for(unsigned int i=0; i<this->workers.size(); ++i)
+        this->workers[i].join();
+
+    // Frames in progress are abandoned
+    for(unsigned int i=0; i<this->streams.size(); ++i)
+    {
+        if(this->streams[i])
+            this->freeStream(this->streams[i]);
+    }
+}
+
+/** DetectionService::addStream
+  * Register a stream of frames
+  * w, h: frame size
+  * deadline: time (ms) after submission within which a frame has to be detected
+  * Return stream id
+  **/
+int DetectionService::addStream(unsigned int w, unsigned int h, double deadline)
+{
+    Stream* s = new Stream();
+    s->detector = new ViolaJones(w, h);
+    s->nPixels = w*h;
+    s->deadline = deadline;
+
+    // Pre-allocate frames (RGBA), grey planes and integral images
+    s->staging = (unsigned char *)new unsigned char[4*s->nPixels];
+    s->input = (unsigned char *)new unsigned char[4*s->nPixels];
+    s->working = (unsigned char *)new unsigned char[4*s->nPixels];
+    s->grey = new GreyFrame(w, h);
+    s->intIm = (float *)new float[s->nPixels];
+    s->sqIntIm = (float *)new float[s->nPixels];
+    s->positives.resize(s->detector->getScales());
+    s->latencies.reserve(N_LATENCIES);
+
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->streams.push_back(s);
+    return static_cast<int>(this->streams.size()-1);
+}
+
+void DetectionService::removeStream(int stream)
+{
+    Stream* s;
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        s = this->streams[stream];
+
+        // No new frames, wait for the current one
+        s->inputPending = false;
+        while(s->active)
+            this->idle.wait(guard);
+
+        this->streams[stream] = 0;
+    }
+
+    this->freeStream(s);
+}
+
+/** DetectionService::submit
+  * Queue a frame. A queued frame whose processing has not started yet is dropped
+  * stream: stream id
+  * image: pointer to the image array (copied, can be overwritten on return)
+  * Return id of the queued frame
+  **/
+unsigned int DetectionService::submit(int stream, unsigned char* image)
+{
+    Stream* s;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        s = this->streams[stream];
+    }
+
+    // Copy into the staging buffer, neither queued nor in progress, without blocking other streams
+    memcpy(s->staging, image, 4*s->nPixels);
+
+    unsigned int id;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+
+        if(s->inputPending)
+            s->stats.dropped++;
+
+        // Queue it: the buffer it replaces (a dropped frame, or free once its frame started) is the
+        // next staging one
+        std::swap(s->staging, s->input);
+        id = s->inputId = s->nextId++;
+        s->inputTime = Clock::now();
+        s->inputPending = true;
+        s->stats.submitted++;
+    }
+    this->work.notify_one();
+
+    return id;
+}
+
+bool DetectionService::poll(int stream, unsigned short* rect, unsigned int& frameId)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    Stream* s = this->streams[stream];
+
+    if(!s->resultPending)
+        return false;
+
+    std::copy(s->result, s->result+4, rect);
+    frameId = s->resultId;
+    s->resultPending = false;
+
+    return true;
+}
+
+StreamStats DetectionService::getStats(int stream)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    Stream* s = this->streams[stream];
+
+    StreamStats stats = s->stats;
+    std::vector<double> sorted = s->latencies;
+    std::sort(sorted.begin(), sorted.end());
+
+    if(!sorted.empty())
+    {
+        stats.p50 = sorted[(sorted.size()-1)*50/100];
+        stats.p90 = sorted[(sorted.size()-1)*90/100];
+        stats.p99 = sorted[(sorted.size()-1)*99/100];
+    }
+
+    return stats;
+}
+
+// ***************************************************************
+// ** PRIVATE CLASS METHODS
+// ***************************************************************
+
+void DetectionService::freeStream(Stream* s)
+{
+    delete s->detector;
+    delete[] s->staging;
+    delete[] s->input;
+    delete[] s->working;
+    delete s->grey;
+    delete[] s->intIm;
+    delete[] s->sqIntIm;
+    delete s;
+}
+
+bool DetectionService::nextTask(Task& task)
+{
+    unsigned int n = static_cast<unsigned int>(this->streams.size());
+    Clock::time_point now = Clock::now();
+
+    for(unsigned int k=0; k<n; ++k)
+    {
+        unsigned int idx = (this->cursor + k)%n;
+        Stream* s = this->streams[idx];
+        if(!s)
+            continue;
+
+        task.stream = s;
+        task.streamId = idx;
+
+        if(s->active)
+        {
+            // Hand out next scale of the frame in progress
+            if(!s->scanning || s->nextScale>=s->positives.size())
+                continue;
+
+            task.scale = s->nextScale++;
+        }
+        else
+        {
+            if(!s->inputPending)
+                continue;
+
+            // Discard frame if its deadline passed while queued
+            s->inputPending = false;
+            double waited = std::chrono::duration<double, std::milli>(now - s->inputTime).count();
+            if(waited>s->deadline)
+            {
+                s->stats.expired++;
+                continue;
+            }
+
+            // Start frame (submit keeps writing into the other buffer)
+            std::swap(s->input, s->working);
+            s->id = s->inputId;
+            s->time = s->inputTime;
+            s->active = true;
+            s->scanning = false;
+            task.scale = -1;
+        }
+
+        this->cursor = idx + 1;
+        return true;
+    }
+
+    return false;
+}
+
+void DetectionService::run(Task& task)
+{
+    Stream* s = task.stream;
+    Frame frame(s->intIm, s->sqIntIm, s->detector->getW(), s->detector->getH());
+
+    if(task.scale<0)
+    {
+        s->grey->update(s->working);
+        s->detector->integrate(*s->grey, s->intIm, s->sqIntIm);
+
+        std::lock_guard<std::mutex> guard(this->lock);
+        s->scanning = true;
+        s->nextScale = 0;
+        s->remaining = static_cast<unsigned int>(s->positives.size());
+        this->work.notify_all();
+        return;
+    }
+
+    std::pair<Rect,double> positive = s->detector->scan(frame, task.scale);
+
+    unsigned short rect[4];
+    unsigned int id;
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        s->positives[task.scale] = positive;
+        if(--s->remaining>0)
+            return;
+
+        // Last scale of the frame
+        std::vector<std::pair<Rect,double> > positives = s->positives;
+        Rect detection = s->detector->select(positives);
+
+        rect[0] = detection.getX();
+        rect[1] = detection.getY();
+        rect[2] = detection.getWidth();
+        rect[3] = detection.getHeight();
+
+        std::copy(rect, rect+4, s->result);
+        id = s->resultId = s->id;
+        s->resultPending = true;
+
+        // Latency
+        double latency = std::chrono::duration<double, std::milli>(Clock::now() - s->time).count();
+        if(s->latencies.size()<N_LATENCIES)
+            s->latencies.push_back(latency);
+        else
+            s->latencies[s->stats.completed%N_LATENCIES] = latency;
+
+        s->stats.completed++;
+        if(latency>s->deadline)
+            s->stats.late++;
+
+        s->active = false;
+    }
+    this->idle.notify_all();
+    this->work.notify_one();
+
+    if(this->callback)
+        this->callback(task.streamId, id, rect, this->user);
+}
+
+void DetectionService::workerLoop()
+{
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    while(true)
+    {
+        Task task;
+        while(this->running && !this->nextTask(task))
+            this->work.wait(guard);
+
+        if(!this->running)
+            break;
+
+        guard.unlock();
+        this->run(task);
+        guard.lock();
+    }
+}
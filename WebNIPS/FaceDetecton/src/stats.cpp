@@ -0,0 +1,98 @@
+#include <cstdio>
+#include "../inc/stats.h"
+
+// Threads are not available on asm.js/wasm builds without pthreads
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define STATS_THREADS 0
+#else
+#define STATS_THREADS 1
+#include <mutex>
+#endif
+
+
+// ***************************************************************
+// ** SHARED STATE
+// ***************************************************************
+
+static std::vector<std::vector<StageStats> > scales;   // Per scale index and stage
+#if STATS_THREADS
+static std::mutex lock;
+#endif
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+void StageStats::add(const StageStats& other)
+{
+    this->entered += other.entered;
+    this->varianceRejected += other.varianceRejected;
+    this->passed += other.passed;
+    this->features += other.features;
+    this->ms += other.ms;
+}
+
+bool CascadeStats::enabled()
+{
+#ifdef FD_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CascadeStats::add(unsigned int sc, const std::vector<StageStats>& stages)
+{
+#if STATS_THREADS
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+
+    if(scales.size()<=sc)
+        scales.resize(sc+1);
+    if(scales[sc].size()<stages.size())
+        scales[sc].resize(stages.size());
+
+    for(unsigned int s=0; s<stages.size(); ++s)
+        scales[sc][s].add(stages[s]);
+}
+
+std::vector<std::vector<StageStats> > CascadeStats::get()
+{
+#if STATS_THREADS
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+    return scales;
+}
+
+void CascadeStats::reset()
+{
+#if STATS_THREADS
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+    scales.clear();
+}
+
+std::string CascadeStats::toJson()
+{
+    std::vector<std::vector<StageStats> > snapshot = get();
+
+    std::string json = enabled() ? "{\"enabled\":true,\"scales\":[" : "{\"enabled\":false,\"scales\":[";
+    for(unsigned int sc=0; sc<snapshot.size(); ++sc)
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%s{\"scale\":%u,\"stages\":[", sc ? "," : "", sc);
+        json += buf;
+
+        for(unsigned int s=0; s<snapshot[sc].size(); ++s)
+        {
+            const StageStats& st = snapshot[sc][s];
+            snprintf(buf, sizeof(buf), "%s{\"stage\":%u,\"entered\":%llu,\"variance_rejected\":%llu,\"passed\":%llu,\"features\":%llu,\"ms\":%.3f}",
+                     s ? "," : "", s, st.entered, st.varianceRejected, st.passed, st.features, st.ms);
+            json += buf;
+        }
+        json += "]}";
+    }
+    json += "]}";
+
+    return json;
+}
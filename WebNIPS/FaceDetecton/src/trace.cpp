@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "../inc/trace.h"
+
+// Threads are not available on asm.js/wasm builds without pthreads
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define TRACE_THREADS 0
+#else
+#define TRACE_THREADS 1
+#include <mutex>
+#endif
+
+const unsigned int TRACE_RING_SIZE = 8192;  // Spans kept per thread
+
+// Span of a ring slot. seq is 2i+2 once span i is written, odd while the slot is rewritten, so a
+// dump can copy a slot its thread is overwriting and tell. Fields are relaxed atomics for the copy
+// not to be a data race (plain loads and stores on the usual targets)
+struct TraceSlot
+{
+    std::atomic<unsigned long long> seq;
+    std::atomic<const char*> name;
+    std::atomic<const char*> argName;
+    std::atomic<int> arg;
+    std::atomic<long long> start;
+    std::atomic<long long> end;
+};
+
+// Spans of one thread. Written by its thread only; head is published after every span
+struct TraceRing
+{
+    TraceSlot slots[TRACE_RING_SIZE];
+    std::atomic<unsigned long long> head;   // Spans written
+    std::atomic<unsigned long long> base;   // Spans before it were reset
+    unsigned int tid;
+
+    TraceRing(unsigned int id): head(0), base(0), tid(id)
+    {
+        for(unsigned int i=0; i<TRACE_RING_SIZE; ++i)
+            this->slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+};
+
+// Rings of every thread that recorded a span. Rings outlive their threads so their spans can
+// still be dumped, and are freed at exit
+class TraceRegistry
+{
+public:
+    ~TraceRegistry()
+    {
+        for(unsigned int i=0; i<this->rings.size(); ++i)
+            delete this->rings[i];
+    }
+
+    TraceRing* add()
+    {
+#if TRACE_THREADS
+        std::lock_guard<std::mutex> guard(this->lock);
+#endif
+        TraceRing* ring = new TraceRing(this->rings.size()+1);
+        this->rings.push_back(ring);
+        return ring;
+    }
+
+    std::vector<TraceRing*> get()
+    {
+#if TRACE_THREADS
+        std::lock_guard<std::mutex> guard(this->lock);
+#endif
+        return this->rings;
+    }
+
+private:
+    std::vector<TraceRing*> rings;
+#if TRACE_THREADS
+    std::mutex lock;
+#endif
+};
+
+static TraceRegistry registry;
+static thread_local TraceRing* threadRing = 0;
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+std::atomic<bool> Trace::active(false);
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+void Trace::enable(bool on)
+{
+    active.store(on, std::memory_order_relaxed);
+}
+
+long long Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Trace::record(const char* name, const char* argName, int arg, long long start, long long end)
+{
+    if(!threadRing)
+        threadRing = registry.add();
+
+    // Mark the slot as being rewritten before any field changes
+    unsigned long long head = threadRing->head.load(std::memory_order_relaxed);
+    TraceSlot& slot = threadRing->slots[head%TRACE_RING_SIZE];
+    slot.seq.store(2*head+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.argName.store(argName, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+
+    slot.seq.store(2*head+2, std::memory_order_release);
+    threadRing->head.store(head+1, std::memory_order_release);
+}
+
+void Trace::reset()
+{
+    std::vector<TraceRing*> rings = registry.get();
+    for(unsigned int i=0; i<rings.size(); ++i)
+        rings[i]->base.store(rings[i]->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+std::string Trace::toJson()
+{
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    std::vector<TraceRing*> rings = registry.get();
+    for(unsigned int r=0; r<rings.size(); ++r)
+    {
+        TraceRing* ring = rings[r];
+
+        // Copy the spans still in the ring, dropping those the thread overwrote or was overwriting
+        // meanwhile (slot sequence changed during the copy)
+        unsigned long long head = ring->head.load(std::memory_order_acquire);
+        unsigned long long from = std::max(ring->base.load(std::memory_order_relaxed),
+                                           head>TRACE_RING_SIZE ? head-TRACE_RING_SIZE : 0ULL);
+        std::vector<TraceEvent> events;
+        for(unsigned long long i=from; i<head; ++i)
+        {
+            const TraceSlot& slot = ring->slots[i%TRACE_RING_SIZE];
+            unsigned long long seq = slot.seq.load(std::memory_order_acquire);
+            if(seq!=2*i+2)
+                continue;
+
+            TraceEvent ev;
+            ev.name = slot.name.load(std::memory_order_relaxed);
+            ev.argName = slot.argName.load(std::memory_order_relaxed);
+            ev.arg = slot.arg.load(std::memory_order_relaxed);
+            ev.start = slot.start.load(std::memory_order_relaxed);
+            ev.end = slot.end.load(std::memory_order_relaxed);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.seq.load(std::memory_order_relaxed)==seq)
+                events.push_back(ev);
+        }
+
+        for(unsigned long long i=0; i<events.size(); ++i)
+        {
+            const TraceEvent& ev = events[i];
+            char buf[256];
+            int len = snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"cat\":\"facelib\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+                               first ? "" : ",", ev.name, ev.start/1000.0, (ev.end-ev.start)/1000.0, ring->tid);
+            if(ev.argName)
+                len += snprintf(buf+len, sizeof(buf)-len, ",\"args\":{\"%s\":%d}", ev.argName, ev.arg);
+            json += buf;
+            json += "}";
+            first = false;
+        }
+    }
+    json += "]}";
+
+    return json;
+}
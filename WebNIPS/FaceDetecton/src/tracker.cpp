@@ -0,0 +1,163 @@
+#include <cmath>
+#include <algorithm>
+#include "../inc/tracker.h"
+
+
+// ***************************************************************
+// ** PUBLIC CLASS METHODS
+// ***************************************************************
+
+/** TemplateTracker::init
+  * Take template from box
+  * frame: integral image of the current frame
+  * box: face location
+  **/
+void TemplateTracker::init(Frame& frame, Rect& box)
+{
+    this->valid = this->sample(frame, box, this->templ);
+}
+
+/** TemplateTracker::update
+  * Find template in new frame by coarse to fine search around a guess, then refine size
+  * frame: integral image of the current frame
+  * box: initial guess, overwritten with the best match
+  * Return normalized cross-correlation of the best match (-1 if not found)
+  **/
+double TemplateTracker::update(Frame& frame, Rect& box)
+{
+    if(!this->valid)
+        return -1;
+
+    // Coarse to fine search of displacement
+    int radius = std::max(1, static_cast<int>(this->searchRadius*box.getWidth()));
+    int step = std::max(1, box.getWidth()/(2*N_CELLS));
+
+    double score = this->search(frame, box, radius, step);
+    while(step>1)
+    {
+        radius = step;
+        step = step/2;
+        score = this->search(frame, box, radius, step);
+    }
+
+    // Refine size
+    const double SCALES[2] = {0.95, 1.05};
+    Rect best = box;
+    for(int s=0; s<2; ++s)
+    {
+        Rect candidate = box;
+        candidate.centerScale(SCALES[s], SCALES[s]);
+
+        double val = this->match(frame, candidate);
+        if(val>score)
+        {
+            score = val;
+            best = candidate;
+        }
+    }
+    box = best;
+
+    // Adapt template to slow appearance changes
+    if(score>0 && this->sample(frame, box, this->patch))
+    {
+        double norm = 0;
+        for(int i=0; i<N_CELLS*N_CELLS; ++i)
+        {
+            this->templ[i] = (1-this->updateRate)*this->templ[i] + this->updateRate*this->patch[i];
+            norm += this->templ[i]*this->templ[i];
+        }
+
+        norm = sqrt(norm);
+        for(int i=0; i<N_CELLS*N_CELLS; ++i)
+            this->templ[i] /= norm;
+    }
+
+    return score;
+}
+
+// ***************************************************************
+// ** PRIVATE CLASS METHODS
+// ***************************************************************
+
+bool TemplateTracker::sample(Frame& frame, Rect& box, double* out)
+{
+    int cellW = box.getWidth()/N_CELLS;
+    int cellH = box.getHeight()/N_CELLS;
+
+    // Box must lie inside the frame (integral image is read at the far corner)
+    if(cellW<1 || cellH<1 || box.getX()<0 || box.getY()<0 ||
+       box.getX() + N_CELLS*cellW >= (int)frame.getWidth() ||
+       box.getY() + N_CELLS*cellH >= (int)frame.getHeight())
+        return false;
+
+    // Cell sums (all cells have the same area, so sums are proportional to means)
+    double mean = 0;
+    Rect cell(0, 0, cellW, cellH);
+    for(int j=0; j<N_CELLS; ++j)
+    {
+        for(int i=0; i<N_CELLS; ++i)
+        {
+            cell.setX(box.getX() + i*cellW);
+            cell.setY(box.getY() + j*cellH);
+
+            double val = frame.sumOver(cell);
+            out[i + j*N_CELLS] = val;
+            mean += val;
+        }
+    }
+    mean /= N_CELLS*N_CELLS;
+
+    // Zero mean, unit norm
+    double norm = 0;
+    for(int i=0; i<N_CELLS*N_CELLS; ++i)
+    {
+        out[i] -= mean;
+        norm += out[i]*out[i];
+    }
+
+    if(norm<=0)
+        return false;
+
+    norm = sqrt(norm);
+    for(int i=0; i<N_CELLS*N_CELLS; ++i)
+        out[i] /= norm;
+
+    return true;
+}
+
+double TemplateTracker::match(Frame& frame, Rect& box)
+{
+    if(!this->sample(frame, box, this->patch))
+        return -1;
+
+    double ncc = 0;
+    for(int i=0; i<N_CELLS*N_CELLS; ++i)
+        ncc += this->templ[i]*this->patch[i];
+
+    return ncc;
+}
+
+double TemplateTracker::search(Frame& frame, Rect& box, int radius, int step)
+{
+    double bestScore = -1;
+    Rect best = box;
+
+    for(int dy=-radius; dy<=radius; dy+=step)
+    {
+        for(int dx=-radius; dx<=radius; dx+=step)
+        {
+            Rect candidate = box;
+            candidate.shift(dx, dy);
+
+            double score = this->match(frame, candidate);
+            if(score>bestScore)
+            {
+                bestScore = score;
+                best = candidate;
+            }
+        }
+    }
+
+    box = best;
+    return bestScore;
+}
@@ -4,16 +4,61 @@
 #include <string>
 #include <algorithm>
 #include <cmath>
+#include <cctype>
+#include <map>
 #include "../inc/haar.h"
 #include "../inc/violajones.h"
 #include "../inc/connected.h"
+#include "../inc/tracker.h"
+#include "../inc/trace.h"
+#include "../inc/costmap.h"
+#include "../inc/lbp.h"
+#include "../inc/greyframe.h"
+
+// Threads are not available on asm.js/wasm builds without pthreads
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define CASCADE_THREADS 0
+#else
+#define CASCADE_THREADS 1
+#include <mutex>
+#endif
 
 
 // ***************************************************************
 // ** PUBLIC CLASS METHODS
 // ***************************************************************
 
-ViolaJones::ViolaJones(int w, int h){
+// Detector parameters
+const double DETECT_SCALE = 1.1;            // Scaling between consecutive window sizes
+const double DETECT_SHIFT = 0.02;           // Window shift (relative to window size)
+const unsigned int DETECT_WSIZE = 260;      // Smallest window size on whole frame detection (pixels)
+const unsigned int DETECT_N_SCALES = 5;     // Number of window sizes on whole frame detection
+
+// Tracking parameters
+const unsigned int TRACK_MAX_MISSES = 3;    // Consecutive misses before falling back to detection
+const unsigned int TRACK_DETECT_PERIOD = 30;// Frames between forced whole frame detections
+const double TRACK_ROI_SCALE = 1.4;         // Search area around the predicted face (relative to its size)
+const unsigned int TRACK_N_SCALES = 3;      // Scales searched around the predicted face size
+const double TRACK_ALPHA = 0.6;             // Motion model position gain
+const double TRACK_BETA = 0.2;              // Motion model velocity gain
+const unsigned int TRACK_VALIDATE_PERIOD = 10;// Frames followed by the template tracker between cascade runs
+const double TRACK_MIN_NCC = 0.8;           // Template tracker confidence below which the cascade is run
+const double TRACK_SEARCH = 0.25;           // Template tracker search radius (relative to face size)
+const double TRACK_TEMPLATE_RATE = 0.1;     // Template tracker appearance update rate
+
+// Budgeted detection parameters
+const unsigned int BUDGET_BAND = 3;         // Scales around the last face size scanned first
+const double BUDGET_CENTER = 0.5;           // Central region scanned first without prior face (relative to ROI size)
+const double BUDGET_PRIOR = 1.5;            // Region around prior face scanned first (relative to face size)
+const unsigned int BUDGET_CHUNK = 64;       // Windows scanned between deadline checks
+
+// Facial part detection parameters
+const double PART_SCALE = 1.2;              // Scaling between consecutive part window sizes
+const double PART_SHIFT = 0.1;              // Part window shift (relative to window size)
+const double PART_CONFIDENCE = 3;           // Merged windows needed for a part
+
+ViolaJones::ViolaJones(int w, int h): tiltIntegralImage(0), lbpIntegralImage(0), motion(TRACK_ALPHA, TRACK_BETA), misses(0), sinceDetect(0), sinceValidate(0),
+    costMap(0), squareCurrent(false){
     this->imW = w;
     this->imH = h;
 
@@ -22,37 +67,51 @@ ViolaJones::ViolaJones(int w, int h){
     this->sqIntegralImage = (float *)new float[w*h];
 
     // Load cascade
-    this->cascade = Cascade(HAAR_WIDTH, HAAR_HEIGHT, haar_data1);
+    this->cascades.push_back(&Cascade::frontal());
+
+    // Inter-frame tracker
+    this->tracker = new TemplateTracker(TRACK_SEARCH, TRACK_TEMPLATE_RATE);
 }
 
 ViolaJones::~ViolaJones()
 {
     // Free integral image memory
-    delete this->integralImage;
-    delete this->sqIntegralImage;
+    delete[] this->integralImage;
+    delete[] this->sqIntegralImage;
+    delete[] this->tiltIntegralImage;
+    delete[] this->lbpIntegralImage;
+
+    delete this->tracker;
+    delete this->costMap;
+}
+
+/** ViolaJones::enableCostMap
+  * Start accumulating the cost heatmap of every detection (see CostMap), or stop it
+  * cell: heatmap cell size (pixels), 0 to disable
+  **/
+void ViolaJones::enableCostMap(unsigned int cell)
+{
+    delete this->costMap;
+    this->costMap = cell>0 ? new CostMap(this->imW, this->imH, cell, DETECT_WSIZE, DETECT_SCALE, DETECT_N_SCALES) : 0;
 }
 
 /** ViolaJones::detect
   * Detect face given image
-  * image: pointer to the image array
+  * grey: grey planes of the frame
   * rect: 4-element array where the face location is to be placed
   **/
-Rect ViolaJones::detect(unsigned char* image, unsigned short* rect)
+Rect ViolaJones::detect(GreyFrame& grey, unsigned short* rect)
 {
-    // Compute integral images
-    this->generateIntegralImage(image);
-    this->generateSquareIntegralImage(image);
+    TraceSpan span("detect");
 
-    // Define detector
-    double scale = 1.1;
-    double shift = 0.02;
-    unsigned int refWSz = 260;
-    Detector detector(scale, shift, refWSz);
+    // Compute integral images
+    this->integrateFrame(grey);
+    this->squareFrame(grey);
 
     // Apply to whole frame
-    Frame frame(this->integralImage, this->sqIntegralImage, this->imW, this->imH);
-    Rect wholeFrame(0,0,frame.getWidth(), frame.getHeight());
-    Rect detection = detector.apply(this->cascade, wholeFrame, frame);
+    Frame frame(this->integralImage, this->sqIntegralImage, this->imW, this->imH, this->tiltIntegralImage, this->lbpIntegralImage);
+    Rect detection = this->detectFrame(frame);
+    this->lastFace = detection;
 
     // Fill positive
     //float s = 0.75;
@@ -66,29 +125,232 @@ Rect ViolaJones::detect(unsigned char* image, unsigned short* rect)
     return detection;
 }
 
+/** ViolaJones::detect
+  * Detect face on a frame whose integral images are already computed
+  * frame: integral images (see ViolaJones::integrate)
+  * rect: 4-element array where the face location is to be placed
+  **/
+Rect ViolaJones::detect(Frame& frame, unsigned short* rect)
+{
+    TraceSpan span("detect");
+
+    Rect detection = this->detectFrame(frame);
+    this->lastFace = detection;
+
+    rect[0] = detection.getX();
+    rect[1] = detection.getY();
+    rect[2] = detection.getWidth();
+    rect[3] = detection.getHeight();
+
+    return detection;
+}
+
+/** ViolaJones::detect
+  * Detect face within a time budget. Windows are scanned by decreasing likelihood: scales around
+  * the last face size, then the region around the last face (the frame center if there is none),
+  * then the rest. When the budget runs out the best detection among the windows scanned so far
+  * is returned
+  * grey: grey planes of the frame
+  * rect: 4-element array where the face location is to be placed
+  * budget: time available, integral images included (ms)
+  * complete: set to false if the budget ran out before all windows were scanned
+  **/
+Rect ViolaJones::detect(GreyFrame& grey, unsigned short* rect, double budget, bool& complete)
+{
+    TraceSpan span("detect_budget");
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budget));
+
+    // Compute integral images
+    this->integrateFrame(grey);
+    this->squareFrame(grey);
+
+    // Apply to whole frame until deadline
+    Frame frame(this->integralImage, this->sqIntegralImage, this->imW, this->imH, this->tiltIntegralImage, this->lbpIntegralImage);
+    Detector detector(DETECT_SCALE, DETECT_SHIFT, DETECT_WSIZE, DETECT_N_SCALES);
+    detector.costMap = this->costMap;
+    Rect wholeFrame(0,0,frame.getWidth(), frame.getHeight());
+    Rect detection;
+    if(this->lbpEngine(frame))
+        detection = detector.apply(this->lbpCascades, wholeFrame, frame, this->lastFace, deadline, complete);
+    else
+        detection = detector.apply(this->usableCascades(frame), wholeFrame, frame, this->lastFace, deadline, complete);
+
+    // An interrupted scan that found nothing says little about the face, keep the prior
+    if(complete || detection.getWidth()>0)
+        this->lastFace = detection;
+
+    rect[0] = detection.getX();
+    rect[1] = detection.getY();
+    rect[2] = detection.getWidth();
+    rect[3] = detection.getHeight();
+
+    return detection;
+}
+
+/** ViolaJones::integrate
+  * Compute integral images of a frame into caller provided buffers (imW*imH values each). The
+  * tilted and integer ones are needed by detectors with tilted features or LBP cascades (see
+  * needsTilted, needsInteger): frames without them are detected with the other face models only
+  * grey: grey planes of the frame
+  * intIm: integral image
+  * sqIntIm: squared integral image
+  * tiltIm: tilted integral image (optional)
+  * lbpIm: integer integral image (optional)
+  **/
+void ViolaJones::integrate(GreyFrame& grey, float* intIm, float* sqIntIm, float* tiltIm, unsigned int* lbpIm)
+{
+    if(tiltIm)
+        this->generateIntegralImages(grey.getSum(), intIm, tiltIm);
+    else
+        this->generateIntegralImage(grey.getSum(), intIm);
+
+    if(lbpIm)
+        this->generateIntegerIntegralImage(grey.getSum(), lbpIm);
+    this->generateSquareIntegralImage(grey.getSum(), sqIntIm);
+}
+
+/** ViolaJones::scan
+  * Apply whole frame detection at a single scale
+  * frame: integral images (see ViolaJones::integrate)
+  * sc: scale index, in [0, getScales())
+  * Return merged positive and its confidence (the most confident face model), to be passed to
+  * ViolaJones::select
+  **/
+std::pair<Rect,double> ViolaJones::scan(Frame& frame, unsigned int sc)
+{
+    Detector detector(DETECT_SCALE, DETECT_SHIFT, DETECT_WSIZE, DETECT_N_SCALES);
+    detector.costMap = this->costMap;
+
+    Rect wholeFrame(0,0,frame.getWidth(), frame.getHeight());
+    std::vector<std::pair<Rect,double> > merged;
+    if(this->lbpEngine(frame))
+        merged = detector.scan(this->lbpCascades, wholeFrame, frame, sc);
+    else
+        merged = detector.scan(this->usableCascades(frame), wholeFrame, frame, sc);
+
+    std::pair<Rect,double> best = merged[0];
+    for(unsigned int m=1; m<merged.size(); ++m)
+        if(merged[m].second>best.second)
+            best = merged[m];
+
+    return best;
+}
+
+unsigned int ViolaJones::getScales()
+{
+    return DETECT_N_SCALES;
+}
+
+/** ViolaJones::select
+  * Choose final detection among the positives of every scale
+  * positives: results of ViolaJones::scan for all scales
+  **/
+Rect ViolaJones::select(std::vector<std::pair<Rect,double> >& positives)
+{
+    Detector detector(DETECT_SCALE, DETECT_SHIFT, DETECT_WSIZE, DETECT_N_SCALES);
+    detector.costMap = this->costMap;
+    return detector.select(positives);
+}
+
 /** ViolaJones::track
-  * Track face given previous location and new image
-  * image: pointer to the image array
+  * Track face given previous detections and new image
+  * The face location is predicted with a constant velocity model and followed by template
+  * matching. The cascade is only applied around the prediction, on a narrow band of scales
+  * around the last face size, every TRACK_VALIDATE_PERIOD frames or when the template match
+  * is poor. Whole frame detection is used when no face is followed, after TRACK_MAX_MISSES
+  * consecutive misses and every TRACK_DETECT_PERIOD frames.
+  * grey: grey planes of the frame
   * rect: 4-element array where the new face location is to be placed
   **/
-Rect ViolaJones::track(unsigned char* image, unsigned short* roi, unsigned short* rect){
+Rect ViolaJones::track(GreyFrame& grey, unsigned short* rect){
+    TraceSpan span("track");
 
-    this->generateIntegralImage(image);
+    // Compute integral image (squared one is only needed by the cascade)
+    this->integrateFrame(grey);
+    this->squareCurrent = false;
 
-    // Compute integral images
-    this->generateIntegralImage(image);
-    this->generateSquareIntegralImage(image);
+    Frame frame(this->integralImage, this->sqIntegralImage, this->imW, this->imH, this->tiltIntegralImage, this->lbpIntegralImage);
+    Rect detection;
 
-    // Define detector
-    double scale = 1.1;
-    double shift = 0.02;
-    unsigned int refWSz = 260;
-    Detector detector(scale, shift, refWSz);
+    if(!this->motion.isValid() || this->misses>=TRACK_MAX_MISSES || this->sinceDetect>=TRACK_DETECT_PERIOD)
+    {
+        // (Re)acquire face on the whole frame
+        this->squareFrame(grey);
+        detection = this->detectFrame(frame);
+        this->sinceDetect = 0;
+        this->sinceValidate = 0;
+        this->misses = 0;
+
+        if(detection.getWidth()>0)
+        {
+            this->motion.reset(detection);
+            this->tracker->init(frame, detection);
+        }
+        else
+        {
+            this->motion.invalidate();
+            this->tracker->invalidate();
+        }
+    }
+    else
+    {
+        Rect prediction = this->motion.predict();
+        bool found = false;
+        this->sinceDetect++;
 
-    // Apply to whole frame
-    Frame frame(this->integralImage, this->sqIntegralImage, this->imW, this->imH);
-    Rect roiFrame(roi[0],roi[1],roi[2],roi[3]);
-    Rect detection = detector.apply(cascade, roiFrame, frame);
+        // Follow template from predicted location
+        if(this->tracker->isValid() && this->sinceValidate<TRACK_VALIDATE_PERIOD)
+        {
+            TraceSpan matchSpan("template_match");
+            detection = prediction;
+            found = this->tracker->update(frame, detection)>=TRACK_MIN_NCC;
+            this->sinceValidate++;
+        }
+
+        // Validate with cascade around predicted location
+        if(!found)
+        {
+            this->squareFrame(grey);
+
+            Rect roi = prediction;
+            roi.centerScale(TRACK_ROI_SCALE, TRACK_ROI_SCALE);
+            Rect wholeFrame(0, 0, frame.getWidth(), frame.getHeight());
+            roi.limitTo(wholeFrame);
+
+            // Band of whole frame detection scales centered at predicted size
+            int band = static_cast<int>(floor(log(prediction.getWidth()/(double)DETECT_WSIZE)/log(DETECT_SCALE) + 0.5)) - (int)TRACK_N_SCALES/2;
+            band = std::max(0, std::min(band, (int)(DETECT_N_SCALES - TRACK_N_SCALES)));
+            unsigned int wSize = static_cast<unsigned int>(DETECT_WSIZE*pow(DETECT_SCALE, band));
+            Detector detector(DETECT_SCALE, DETECT_SHIFT, wSize, TRACK_N_SCALES);
+            detector.costMap = this->costMap;
+            detection = this->lbpEngine(frame) ? detector.apply(this->lbpCascades, roi, frame) :
+                                                 detector.apply(this->usableCascades(frame), roi, frame);
+
+            found = detection.getWidth()>0;
+            if(found)
+            {
+                this->tracker->init(frame, detection);
+                this->sinceValidate = 0;
+            }
+        }
+
+        if(found)
+        {
+            this->misses = 0;
+            this->motion.correct(detection);
+        }
+        else
+        {
+            // Keep predicted location while the face is missing
+            this->misses++;
+            this->motion.coast();
+            detection = prediction;
+        }
+    }
+
+    this->lastFace = detection;
 
     // Fill positive
     rect[0] = detection.getX();
@@ -99,12 +361,189 @@ Rect ViolaJones::track(unsigned char* image, unsigned short* roi, unsigned short
     return detection;
 }
 
+/** ViolaJones::addCascade
+  * Add a face model applied together with the frontal one (e.g. profile faces, see
+  * Cascade::fromFile). Models share the windows, integral images and variance test of a single
+  * scan, and a window is dropped once every model has rejected it
+  * cascade: face cascade (shared, read-only)
+  **/
+unsigned int ViolaJones::addCascade(const Cascade* cascade)
+{
+    if(cascade->tilted && !this->tiltIntegralImage)
+        this->tiltIntegralImage = new float[this->imW*this->imH]();
+
+    this->cascades.push_back(cascade);
+    return this->cascades.size();
+}
+
+/** ViolaJones::addLbpCascade
+  * Switch face detection to the LBP engine (see lbp.h): once an LBP cascade is added, faces are
+  * found with the LBP cascades (applied in a single pass as the Haar ones) instead of the Haar
+  * ones, on an integer integral image computed with the frame, and the squared integral image is
+  * only computed for facial parts. Frames without the integer integral image (integral images
+  * computed by ViolaJones::integrate without it) keep the Haar cascades
+  * cascade: face cascade (shared, read-only)
+  **/
+unsigned int ViolaJones::addLbpCascade(const LbpCascade* cascade)
+{
+    if(!this->lbpIntegralImage)
+        this->lbpIntegralImage = new unsigned int[this->imW*this->imH]();
+
+    this->lbpCascades.push_back(cascade);
+    return this->lbpCascades.size();
+}
+
+/** ViolaJones::addPart
+  * Add a facial part searched by detectParts
+  * part: part cascade, search region and sizes (relative to the face box)
+  **/
+unsigned int ViolaJones::addPart(const FacePart& part)
+{
+    if(part.cascade->tilted && !this->tiltIntegralImage)
+        this->tiltIntegralImage = new float[this->imW*this->imH]();
+
+    this->parts.push_back(part);
+    return this->parts.size() - 1;
+}
+
+/** ViolaJones::detectParts
+  * Detect facial parts inside a face of the frame last passed to detect or track, reusing its
+  * integral images (the squared one is only computed if tracking skipped it)
+  * grey: grey planes of the frame last passed to detect or track
+  * face: face box
+  * found: one box per part (empty if not found)
+  **/
+void ViolaJones::detectParts(GreyFrame& grey, Rect& face, std::vector<Rect>& found)
+{
+    if(face.getWidth()>0)
+        this->keepFrame(grey);
+
+    Frame frame(this->integralImage, this->sqIntegralImage, this->imW, this->imH, this->tiltIntegralImage, this->lbpIntegralImage);
+    this->detectParts(frame, face, found);
+}
+
+/** ViolaJones::keepFrame
+  * Build the squared integral image skipped by tracking if parts may still be searched on this
+  * frame, so detectParts does not read the sum of a later frame
+  * grey: grey planes of the frame last passed to detect or track
+  **/
+void ViolaJones::keepFrame(GreyFrame& grey)
+{
+    if(!this->squareCurrent && !this->parts.empty())
+    {
+        this->generateSquareIntegralImage(grey.getSum(), this->sqIntegralImage);
+        this->squareCurrent = true;
+    }
+}
+
+/** ViolaJones::detectParts
+  * Detect facial parts inside a face: every part cascade is applied to the windows of its region
+  * of the face box, at the part sizes, on the given integral images
+  * frame: integral images of the frame the face was found in
+  * face: face box
+  * found: one box per part (empty if not found)
+  **/
+void ViolaJones::detectParts(Frame& frame, Rect& face, std::vector<Rect>& found)
+{
+    TraceSpan span("parts");
+
+    found.assign(this->parts.size(), Rect());
+    if(face.getWidth()<=0 || face.getHeight()<=0)
+        return;
+
+    Rect wholeFrame(0, 0, frame.getWidth(), frame.getHeight());
+    for(unsigned int i=0; i<this->parts.size(); ++i)
+    {
+        const FacePart& part = this->parts[i];
+        const Cascade& cascade = *part.cascade;
+        if(cascade.tilted && !frame.getTiltData())
+            continue;
+
+        Rect roi(face.getX() + part.x*face.getWidth(), face.getY() + part.y*face.getHeight(),
+                 part.w*face.getWidth(), part.h*face.getHeight());
+        roi.limitTo(wholeFrame);
+
+        // Part window widths, from the cascade reference size up
+        double minW = std::max((double)cascade.sizeW, part.minSize*face.getWidth());
+        double maxW = std::max(minW, part.maxSize*face.getWidth());
+        unsigned int nScales = 1 + static_cast<unsigned int>(floor(log(maxW/minW)/log(PART_SCALE)));
+
+        Detector detector(PART_SCALE, PART_SHIFT, static_cast<unsigned int>(minW), nScales);
+        detector.aspect = (double)cascade.sizeH/cascade.sizeW;
+        detector.confidence = PART_CONFIDENCE;
+        if(roi.getWidth()>0 && roi.getHeight()>0)
+            found[i] = detector.apply(cascade, roi, frame);
+    }
+}
+
 // ***************************************************************
 // ** PRIVATE CLASS METHODS
 // ***************************************************************
 
-void ViolaJones::generateIntegralImage(unsigned char* image){
-    float* intIm = this->integralImage;
+Rect ViolaJones::detectFrame(Frame& frame){
+    Detector detector(DETECT_SCALE, DETECT_SHIFT, DETECT_WSIZE, DETECT_N_SCALES);
+    detector.costMap = this->costMap;
+
+    Rect wholeFrame(0,0,frame.getWidth(), frame.getHeight());
+    if(this->lbpEngine(frame))
+        return detector.apply(this->lbpCascades, wholeFrame, frame);
+    return detector.apply(this->usableCascades(frame), wholeFrame, frame);
+}
+
+/** ViolaJones::integrateFrame
+  * Integral image of a frame into the detector buffer, with the tilted one in the same pass if a
+  * cascade has tilted features
+  * grey: grey planes of the frame
+  **/
+void ViolaJones::integrateFrame(GreyFrame& grey)
+{
+    if(this->tiltIntegralImage)
+        this->generateIntegralImages(grey.getSum(), this->integralImage, this->tiltIntegralImage);
+    else
+        this->generateIntegralImage(grey.getSum(), this->integralImage);
+
+    if(this->lbpIntegralImage)
+        this->generateIntegerIntegralImage(grey.getSum(), this->lbpIntegralImage);
+}
+
+/** ViolaJones::squareFrame
+  * Squared integral image of a frame into the detector buffer, for the variance normalization of
+  * the Haar cascades (the LBP engine needs none, facial parts compute it on demand)
+  * grey: grey planes of the frame
+  **/
+void ViolaJones::squareFrame(GreyFrame& grey)
+{
+    if(!this->lbpCascades.empty())
+    {
+        this->squareCurrent = false;
+        return;
+    }
+
+    this->generateSquareIntegralImage(grey.getSum(), this->sqIntegralImage);
+    this->squareCurrent = true;
+}
+
+bool ViolaJones::lbpEngine(Frame& frame)
+{
+    return !this->lbpCascades.empty() && frame.getIntData();
+}
+
+std::vector<const Cascade*> ViolaJones::usableCascades(Frame& frame)
+{
+    if(frame.getTiltData())
+        return this->cascades;
+
+    // Integral images computed elsewhere (ViolaJones::integrate) may have no tilted one
+    std::vector<const Cascade*> usable;
+    for(unsigned int m=0; m<this->cascades.size(); ++m)
+        if(!this->cascades[m]->tilted)
+            usable.push_back(this->cascades[m]);
+    return usable;
+}
+
+void ViolaJones::generateIntegralImage(const unsigned short* sum, float* intIm){
+    // Grey is the sum plane (r+g+b) over NORM
+    TraceSpan span("integral_image");
 
     // Define norm (8b, 3channels)
     //const int NORM = 255*3;
@@ -112,46 +551,43 @@ void ViolaJones::generateIntegralImage(unsigned char* image){
 
 
     // Fill first pixel
-    intIm[0] = (float)(image[0] + image[1] + image[2])/NORM;
+    intIm[0] = (float)sum[0]/NORM;
 
     // Fill first row
     for(int i=1;i<this->imW;++i)
     {
         // Indices
-        int pos = this->nChn*i;
         int idx = i;
 
         // Integral values
-        intIm[idx] = ((float)(image[pos] + image[pos+1] + image[pos+2])) / NORM + intIm[idx-1];
+        intIm[idx] = ((float)sum[idx]) / NORM + intIm[idx-1];
     }
 
     // Fill first column
     for(int j=1;j<this->imH;++j)
     {
         // Indices
-        int pos = this->nChn*(j*this->imW);
         int idx = j*this->imW;
         int idxPrev = (j-1)*this->imW;
 
         // Integral value
-        intIm[idx] = ((float)(image[pos] + image[pos+1] + image[pos+2])) / NORM + intIm[idxPrev];
+        intIm[idx] = ((float)sum[idx]) / NORM + intIm[idxPrev];
     }
 
 
-    // Fill rest of matrix
-    for(int i=1;i<this->imW;++i)
+    // Fill rest of matrix (row by row, following memory layout)
+    for(int j=1;j<this->imH;++j)
     {
-        for(int j=1;j<this->imH;++j)
+        for(int i=1;i<this->imW;++i)
         {
             // Indices
-            int pos = this->nChn*(i+j*this->imW);
             int idx = (i+j*this->imW);
             int idxUp = i+(j-1)*this->imW;
             int idxLeft = i-1 + j*this->imW;
             int idxUpLeft = i-1 + (j-1)*this->imW;
 
             // Value at current position
-            float curVal = ((float)(image[pos] + image[pos+1] + image[pos+2])) / NORM;
+            float curVal = ((float)sum[idx]) / NORM;
 
             // Integral value
             intIm[idx] = curVal + intIm[idxUp] + intIm[idxLeft] - intIm[idxUpLeft];
@@ -159,26 +595,107 @@ void ViolaJones::generateIntegralImage(unsigned char* image){
     }
 }
 
-void ViolaJones::generateSquareIntegralImage(unsigned char* image){
-    float* intIm = this->sqIntegralImage;
+/** ViolaJones::generateIntegralImages
+  * Upright and tilted (45 degree rotated sum area table, Lienhart and Maydt) integral images in a
+  * single pass. The upright one is the same as generateIntegralImage. The tilted one holds at
+  * x, y the sum of the triangle above pixel x, y (rows y' <= y, columns |x' - x| <= y - y'), from
+  * the two triangles of the previous row: left and right ends take the values the triangles
+  * outside the frame have (the one two rows above at the same end column)
+  * sum: sum plane of the frame (GreyFrame::getSum)
+  * intIm: integral image
+  * tiltIm: tilted integral image
+  **/
+void ViolaJones::generateIntegralImages(const unsigned short* sum, float* intIm, float* tiltIm){
+    TraceSpan span("integral_image");
+
+    // Define norm (8b, 3channels)
+    const int NORM = 3;
+    const int W = this->imW;
+
+    for(int j=0;j<this->imH;++j)
+    {
+        float* row = intIm + j*W;
+        float* tilt = tiltIm + j*W;
+        float* tiltUp = tilt - W;           // Valid if j>0
+        float* tiltUp2 = tilt - 2*W;        // Valid if j>1
+        const unsigned short* px = sum + j*W;
+
+        for(int i=0;i<W;++i)
+        {
+            // Value at current position (as generateIntegralImage)
+            float curVal = ((float)px[i]) / NORM;
+
+            // Upright integral value
+            if(i==0 && j==0)
+                row[i] = curVal;
+            else if(j==0)
+                row[i] = curVal + row[i-1];
+            else if(i==0)
+                row[i] = curVal + row[i-W];
+            else
+                row[i] = curVal + row[i-W] + row[i-1] - row[i-W-1];
+
+            // Tilted integral value: left and right triangles of the previous row, less their
+            // overlap, plus the pixel and the one above it
+            if(j==0)
+                tilt[i] = curVal;
+            else
+            {
+                float upVal = ((float)px[i-W]) / NORM;
+                float left = i>0 ? tiltUp[i-1] : (j>1 ? tiltUp2[0] : 0);
+                float right = i<W-1 ? tiltUp[i+1] : (j>1 ? tiltUp2[W-1] : 0);
+                float overlap = j>1 ? tiltUp2[i] : 0;
+
+                tilt[i] = left + right - overlap + curVal + upVal;
+            }
+        }
+    }
+}
+
+/** ViolaJones::generateIntegerIntegralImage
+  * Integer integral image of the LBP engine: grey as r+g+b (three times the grey of the float
+  * integral images, so exact), accumulated one row at a time. Sums wrap modulo 2^32 on large
+  * frames, which keeps the sums over rects exact
+  * sum: sum plane of the frame (GreyFrame::getSum)
+  * intIm: integer integral image
+  **/
+void ViolaJones::generateIntegerIntegralImage(const unsigned short* sum, unsigned int* intIm){
+    TraceSpan span("integer_integral_image");
+
+    const int W = this->imW;
+    for(int j=0;j<this->imH;++j)
+    {
+        const unsigned short* px = sum + j*W;
+        unsigned int* row = intIm + j*W;
+        unsigned int rowSum = 0;
+
+        for(int i=0;i<W;++i)
+        {
+            rowSum += px[i];
+            row[i] = j>0 ? row[i-W] + rowSum : rowSum;
+        }
+    }
+}
+
+void ViolaJones::generateSquareIntegralImage(const unsigned short* sum, float* intIm){
+    TraceSpan span("square_integral_image");
 
     // Define norm (8b, 3channels)
     //const int NORM = 255*255*3;
     const int NORM = 3;
 
     // Fill first pixel
-    float grey = (float)(image[0] + image[1] + image[2])/NORM;
+    float grey = (float)sum[0]/NORM;
     intIm[0] = (float)grey*grey;
 
     // Fill first row
     for(int i=1;i<this->imW;++i)
     {
         // Indices
-        int pos = this->nChn*i;
         int idx = i;
 
         // Integral values
-        grey = (image[pos] + image[pos+1] + image[pos+2])/NORM;
+        grey = sum[idx]/NORM;
         intIm[idx] = (float)(grey*grey) + intIm[idx-1];
     }
 
@@ -186,30 +703,28 @@ void ViolaJones::generateSquareIntegralImage(unsigned char* image){
     for(int j=1;j<this->imH;++j)
     {
         // Indices
-        int pos = this->nChn*(j*this->imW);
         int idx = j*this->imW;
         int idxPrev = (j-1)*this->imW;
 
         // Integral value
-        grey = (image[pos] + image[pos+1] + image[pos+2])/NORM;
+        grey = sum[idx]/NORM;
         intIm[idx] = (float)(grey*grey) + intIm[idxPrev];
     }
 
 
-    // Fill rest of matrix
-    for(int i=1;i<this->imW;++i)
+    // Fill rest of matrix (row by row, following memory layout)
+    for(int j=1;j<this->imH;++j)
     {
-        for(int j=1;j<this->imH;++j)
+        for(int i=1;i<this->imW;++i)
         {
             // Indices
-            int pos = this->nChn*(i+j*this->imW);
             int idx = (i+j*this->imW);
             int idxUp = i+(j-1)*this->imW;
             int idxLeft = i-1 + j*this->imW;
             int idxUpLeft = i-1 + (j-1)*this->imW;
 
             // Value at current position
-            grey = (image[pos] + image[pos+1] + image[pos+2])/NORM;
+            grey = sum[idx]/NORM;
             float curVal = (float)(grey*grey);
 
             // Integral value
@@ -254,8 +769,8 @@ void Rect::centerScale(double sX, double sY)
     int dx = this->width - static_cast<int>(this->width*sX);
     int dy = this->height - static_cast<int>(this->height*sY);
 
-    this->x -= static_cast<int>(dx/2);
-    this->y -= static_cast<int>(dy/2);
+    this->x += static_cast<int>(dx/2);
+    this->y += static_cast<int>(dy/2);
 
     this->width = scaledWidth;
     this->height = scaledHeight;
@@ -286,12 +801,68 @@ void Rect::limitTo(Rect& r)
         this->setWidth(r.getX()+r.getWidth()-this->getX());
 
     if(this->getY()+this->getHeight()>r.getY()+r.getHeight())
-        this->setHeight(r.getY()+r.getHeight()-this->getX());
+        this->setHeight(r.getY()+r.getHeight()-this->getY());
+}
+
+void MotionModel::reset(Rect& r)
+{
+    this->state[0] = r.getX() + r.getWidth()/2.0;
+    this->state[1] = r.getY() + r.getHeight()/2.0;
+    this->state[2] = r.getWidth();
+
+    for(int i=0; i<3; ++i)
+    {
+        this->velocity[i] = 0;
+        this->predicted[i] = this->state[i];
+    }
+
+    this->valid = true;
+}
+
+Rect MotionModel::predict()
+{
+    // Constant velocity
+    for(int i=0; i<3; ++i)
+        this->predicted[i] = this->state[i] + this->velocity[i];
+
+    double size = this->predicted[2];
+    return Rect(static_cast<int>(this->predicted[0] - size/2), static_cast<int>(this->predicted[1] - size/2),
+                static_cast<int>(size), static_cast<int>(size));
 }
 
-std::vector<Rect> Stage::apply(std::vector<Rect> windows, Frame& im)
+void MotionModel::correct(Rect& r)
+{
+    double measured[3] = {r.getX() + r.getWidth()/2.0, r.getY() + r.getHeight()/2.0, (double)r.getWidth()};
+
+    for(int i=0; i<3; ++i)
+    {
+        // Innovation
+        double residual = measured[i] - this->predicted[i];
+
+        this->state[i] = this->predicted[i] + this->alpha*residual;
+        this->velocity[i] = this->velocity[i] + this->beta*residual;
+    }
+}
+
+void MotionModel::coast()
+{
+    // Accept prediction and damp velocity (the face is likely to have stopped)
+    for(int i=0; i<3; ++i)
+    {
+        this->state[i] = this->predicted[i];
+        this->velocity[i] *= 0.5;
+    }
+}
+
+#ifdef FD_STATS
+std::vector<Rect> Stage::apply(std::vector<Rect> windows, Frame& im, StageStats* stats) const
+#else
+std::vector<Rect> Stage::apply(std::vector<Rect> windows, Frame& im) const
+#endif
 {
     std::vector<Rect> positives;
+    FD_STAT(unsigned long long varianceRejected = 0;)
+    FD_STAT(std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();)
 
     // For every window
     for(std::vector<Rect>::iterator window = windows.begin(); window!=windows.end(); ++window)
@@ -307,7 +878,7 @@ std::vector<Rect> Stage::apply(std::vector<Rect> windows, Frame& im)
         {
             // Extract features
             double val = 0;
-            for(std::vector<Feature>::iterator feature=this->feat.begin(); feature!=this->feat.end(); ++feature)
+            for(std::vector<Feature>::const_iterator feature=this->feat.begin(); feature!=this->feat.end(); ++feature)
             {
                 val += feature->extract(*window, im, winMean, winStdDev);
             }
@@ -316,8 +887,20 @@ std::vector<Rect> Stage::apply(std::vector<Rect> windows, Frame& im)
             if(val<this->T)
                 positives.push_back(*window);
         }
+        FD_STAT(else varianceRejected++;)
     }
 
+#ifdef FD_STATS
+    if(stats)
+    {
+        stats->entered += windows.size();
+        stats->varianceRejected += varianceRejected;
+        stats->passed += positives.size();
+        stats->features += (windows.size() - varianceRejected)*this->feat.size();
+        stats->ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+#endif
+
     return positives;
 }
 
@@ -332,14 +915,22 @@ struct Sorter
 }labelSorter;
 
 std::pair<Rect,double> Merger::apply(Frame& frame, std::vector<Rect>& rects, unsigned int shift)
+{
+    Rect wholeFrame(0, 0, frame.getWidth(), frame.getHeight());
+    return this->apply(wholeFrame, rects, shift);
+}
+
+std::pair<Rect,double> Merger::apply(Rect& roi, std::vector<Rect>& rects, unsigned int shift)
 {
     // refer to "An Analisys of the Viola-Jones Face Detection Algorithm", Yi-Qing Wang (Algorithm 11)
 
     if(!rects.empty())
     {
-        // 1. Create a matrix of the same size as frame.
-        int ssmpl_width = static_cast<int>(frame.getWidth()/shift);
-        int ssmpl_height = static_cast<int>(frame.getHeight()/shift);
+        // 1. Create a matrix of the same size as roi (cells aligned to the frame origin)
+        int ssmpl_x = static_cast<int>(roi.getX()/shift);
+        int ssmpl_y = static_cast<int>(roi.getY()/shift);
+        int ssmpl_width = static_cast<int>((roi.getX()+roi.getWidth())/shift) - ssmpl_x;
+        int ssmpl_height = static_cast<int>((roi.getY()+roi.getHeight())/shift) - ssmpl_y;
 
         unsigned int *in = new unsigned int[ssmpl_width*ssmpl_height]();
         unsigned int *out = new unsigned int[ssmpl_width*ssmpl_height]();
@@ -347,7 +938,7 @@ std::pair<Rect,double> Merger::apply(Frame& frame, std::vector<Rect>& rects, uns
         // 2. Fill matrix
         for(std::vector<Rect>::iterator r = rects.begin(); r!=rects.end(); ++r)
         {
-            unsigned int pos = (r->getY()*ssmpl_width + r->getX())/shift;
+            unsigned int pos = (r->getY()/shift - ssmpl_y)*ssmpl_width + r->getX()/shift - ssmpl_x;
             in[pos] = 1;
         }
 
@@ -365,7 +956,7 @@ std::pair<Rect,double> Merger::apply(Frame& frame, std::vector<Rect>& rects, uns
             int x = pos - y*ssmpl_width;
 
             clusters[out[pos]].first++;
-            clusters[out[pos]].second.push_back(std::pair<int,int>(x,y));
+            clusters[out[pos]].second.push_back(std::pair<int,int>(ssmpl_x + x, ssmpl_y + y));
         }
 
         std::sort(clusters.begin(), clusters.end(), labelSorter);
@@ -377,8 +968,8 @@ std::pair<Rect,double> Merger::apply(Frame& frame, std::vector<Rect>& rects, uns
         std::pair<int, int> origin = this->getClusterRepresentant(clusters.front().second);
         Rect detection(origin.first*shift, origin.second*shift, rects[0].getWidth(), rects[0].getHeight());
 
-        delete in;
-        delete out;
+        delete[] in;
+        delete[] out;
 
         if (clusters.front().first > this->confidence)
             return std::pair<Rect, double>(detection, clusters.front().first);
@@ -468,6 +1059,24 @@ double Frame::sumOverSq(Rect& r, double mean)
     return (curVal - upVal - leftVal + diagVal) - mean*r.getHeight()*r.getWidth();
 }
 
+// Extract mean and get sum over 45 degree rotated Rect (2*w*h pixels)
+double Frame::tiltedSumOver(Rect& r, double mean, double stdDev)
+{
+    int x = r.getX();
+    int y = r.getY();
+    int w = r.getWidth();
+    int h = r.getHeight();
+
+    // Top, left, right and bottom corners
+    double topVal = this->tiltData[x + y*this->width];
+    double leftVal = this->tiltData[x - h + (y + h)*this->width];
+    double rightVal = this->tiltData[x + w + (y + w)*this->width];
+    double bottomVal = this->tiltData[x + w - h + (y + w + h)*this->width];
+
+    // Sum
+    return (bottomVal - leftVal - rightVal + topVal)/stdDev - mean*2*h*w;
+}
+
 double Frame::stdDevOver(Rect& win)
 {
     double mean = sumOver(win)/win.area();
@@ -479,7 +1088,7 @@ double Frame::stdDevOver(Rect& win)
     return sqrt((S2-S1*S1/n)/n);
 }
 
-double Feature::extract(Rect& win, Frame& im, double mean, double stdDev)
+double Feature::extract(Rect& win, Frame& im, double mean, double stdDev) const
 {
     double out = 0;
 
@@ -488,7 +1097,7 @@ double Feature::extract(Rect& win, Frame& im, double mean, double stdDev)
     double scaleY = win.getHeight()/this->refSize.second;
 
     double val = 0;
-    for(std::vector<std::pair<Rect,double> >::iterator r = this->rect.begin(); r!=this->rect.end(); ++r)
+    for(std::vector<std::pair<Rect,double> >::const_iterator r = this->rect.begin(); r!=this->rect.end(); ++r)
     {
         // Scale to window
         Rect feat_w = r->first;
@@ -504,7 +1113,10 @@ double Feature::extract(Rect& win, Frame& im, double mean, double stdDev)
         // Get value
         Rect scaled_win(origX, origY, width, height);
 
-        val += weight*im.sumOver(scaled_win, mean, stdDev);
+        if(this->tilted)
+            val += weight*im.tiltedSumOver(scaled_win, mean, stdDev);
+        else
+            val += weight*im.sumOver(scaled_win, mean, stdDev);
     }
 
     if(val>this->T)
@@ -516,6 +1128,27 @@ double Feature::extract(Rect& win, Frame& im, double mean, double stdDev)
 }
 
 
+/** Feature::mirror
+  * Reflect every rect within the reference window (x -> refW - x - w). Window scales are
+  * integer, so the scaled rects are reflected exactly within the area the feature covers.
+  * Tilted rects swap their diagonals and keep their corners inside the window (x -> refW - x),
+  * one reference pixel left of the exact reflection
+  **/
+Feature Feature::mirror() const
+{
+    std::vector<std::pair<Rect,double> > rects = this->rect;
+    for (std::vector<std::pair<Rect,double> >::iterator r = rects.begin(); r!=rects.end(); ++r)
+    {
+        if (this->tilted)
+            r->first.set(this->refSize.first - r->first.getX(), r->first.getY(), r->first.getHeight(), r->first.getWidth());
+        else
+            r->first.setX(this->refSize.first - r->first.getX() - r->first.getWidth());
+    }
+
+    return Feature(rects, this->T, this->lVal, this->rVal, this->refSize, this->tilted);
+}
+
+
 // Sort labels according to cardinality
 struct SizeSorter
 {
@@ -534,43 +1167,210 @@ struct ConfSorter
   }
 }cfSorter;
 
+// Keep windows whose center lies inside a region
+struct InsideFilter
+{
+  Rect region;
+  InsideFilter(Rect& r): region(r) {}
+  bool operator()(Rect& win)
+  {
+       return win.isInside(region);
+  }
+};
 
+Rect Detector::apply(const Cascade& cascade, Rect& roi, Frame& im)
+{
+    std::vector<const Cascade*> cascades(1, &cascade);
+    return this->apply(cascades, roi, im);
+}
 
-Rect Detector::apply(Cascade& cascade, Rect& roi, Frame& im)
+Rect Detector::apply(const std::vector<const Cascade*>& cascades, Rect& roi, Frame& im)
+{
+    return this->applyModels(cascades, roi, im);
+}
+
+Rect Detector::apply(const std::vector<const LbpCascade*>& cascades, Rect& roi, Frame& im)
+{
+    return this->applyModels(cascades, roi, im);
+}
+
+template<class Model>
+Rect Detector::applyModels(const std::vector<const Model*>& cascades, Rect& roi, Frame& im)
 {
     std::vector<std::pair<Rect,double> > positives;
 
-    const int N_SCALES = 5;
-    double scale = 1;
+    for (unsigned int sc=0; sc<this->nScales; ++sc)
+    {
+        std::vector<std::pair<Rect,double> > merged = this->scan(cascades, roi, im, sc);
+        positives.insert(positives.end(), merged.begin(), merged.end());
+    }
 
-    // Define merger
-    const double CONFIDENCE = 10;
-    Merger merger(CONFIDENCE);
+    return this->select(positives);
+}
 
-    for (int sc=1; sc<=N_SCALES; ++sc)
-    {   
-        // Define window to shift
-        Rect refWin(0,0,this->wSize*scale,this->wSize*scale);
+Rect Detector::apply(const Cascade& cascade, Rect& roi, Frame& im, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete)
+{
+    std::vector<const Cascade*> cascades(1, &cascade);
+    return this->apply(cascades, roi, im, prior, deadline, complete);
+}
 
-        // Shift in pixels (relative to window size)
-        unsigned int pix_shift = static_cast<int>(this->shift*this->wSize*scale);
+Rect Detector::apply(const std::vector<const Cascade*>& cascades, Rect& roi, Frame& im, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete)
+{
+    return this->applyModels(cascades, roi, im, prior, deadline, complete);
+}
 
-        // Generate set of shifted windows in roi
-        std::vector<Rect> windows = generateWindows(roi, refWin);
+Rect Detector::apply(const std::vector<const LbpCascade*>& cascades, Rect& roi, Frame& im, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete)
+{
+    return this->applyModels(cascades, roi, im, prior, deadline, complete);
+}
 
-        // Find positives
-        std::vector<Rect> out = this->step(cascade, windows, im);
+template<class Model>
+Rect Detector::applyModels(const std::vector<const Model*>& cascades, Rect& roi, Frame& im, Rect& prior, std::chrono::steady_clock::time_point deadline, bool& complete)
+{
+    // Order scales by distance to the prior face size, the nearest ones form the band scanned first
+    std::vector<std::pair<double, unsigned int> > order;
+    for (unsigned int sc=0; sc<this->nScales; ++sc)
+    {
+        double dist = prior.getWidth()>0 ? fabs(log(prior.getWidth()/(this->wSize*this->getScale(sc)))) : 0;
+        order.push_back(std::pair<double, unsigned int>(dist, sc));
+    }
+    std::sort(order.begin(), order.end());
+    unsigned int nBand = prior.getWidth()>0 ? std::min(BUDGET_BAND, this->nScales) : 0;
 
-        // Define post-processing
-        std::pair<Rect,double> pstv = merger.apply(im, out, pix_shift);
+    // Windows of every scale, those centered around the prior face (or the ROI center) first
+    Rect center = prior.getWidth()>0 ? prior : roi;
+    if (prior.getWidth()>0)
+        center.centerScale(BUDGET_PRIOR, BUDGET_PRIOR);
+    else
+        center.centerScale(BUDGET_CENTER, BUDGET_CENTER);
 
-        // Append to output
-        positives.push_back(pstv);
+    std::vector<std::vector<Rect> > windows(this->nScales);
+    std::vector<unsigned int> nCenter(this->nScales);
+    for (unsigned int sc=0; sc<this->nScales; ++sc)
+    {
+        TraceSpan span("windows", "scale", sc);
+        Rect refWin(0,0,this->wSize*this->getScale(sc),this->wSize*this->getScale(sc)*this->aspect);
+        windows[sc] = generateWindows(roi, refWin);
+        nCenter[sc] = std::stable_partition(windows[sc].begin(), windows[sc].end(), InsideFilter(center)) - windows[sc].begin();
+    }
 
-        // Increment scale
-        scale = scale*this->scale;
+    // Scan band center, band rest, other scales center and other scales rest until deadline
+    std::vector<std::vector<std::vector<Rect> > > found(cascades.size(), std::vector<std::vector<Rect> >(this->nScales));
+    complete = true;
+    for (unsigned int pass=0; pass<4 && complete; ++pass)
+    {
+        TraceSpan span("cascade_pass", "pass", pass);
+        bool inBand = pass<2;
+        bool inCenter = pass%2==0;
+
+        for (unsigned int k=0; k<this->nScales && complete; ++k)
+        {
+            if ((k<nBand)!=inBand)
+                continue;
+
+            unsigned int sc = order[k].second;
+            unsigned int first = inCenter ? 0 : nCenter[sc];
+            unsigned int last = inCenter ? nCenter[sc] : windows[sc].size();
+
+            // Features are scaled once for all chunks of the scale
+            std::vector<typename Model::Scaled> scaled;
+            for (unsigned int m=0; m<cascades.size(); ++m)
+                scaled.push_back(typename Model::Scaled(*cascades[m]));
+
+            for (unsigned int i=first; i<last; i+=BUDGET_CHUNK)
+            {
+                if (std::chrono::steady_clock::now()>=deadline)
+                {
+                    complete = false;
+                    break;
+                }
+
+                std::vector<Rect> chunk(windows[sc].begin()+i, windows[sc].begin()+std::min(i+BUDGET_CHUNK, last));
+                std::vector<std::vector<Rect> > out = this->step(cascades, scaled, chunk, im);
+                for (unsigned int m=0; m<cascades.size(); ++m)
+                    found[m][sc].insert(found[m][sc].end(), out[m].begin(), out[m].end());
+            }
+        }
+    }
+
+    // Merge positives of every scale and cascade
+    Merger merger(this->confidence);
+
+    std::vector<std::pair<Rect,double> > positives;
+    for (unsigned int sc=0; sc<this->nScales; ++sc)
+    {
+        TraceSpan span("merge", "scale", sc);
+        unsigned int pix_shift = std::max(1, static_cast<int>(this->shift*this->wSize*this->getScale(sc)));
+
+        for (unsigned int m=0; m<cascades.size(); ++m)
+            if (!found[m][sc].empty())
+                positives.push_back(merger.apply(roi, found[m][sc], pix_shift));
+    }
+
+    if (positives.empty())
+        return Rect();
+
+    return this->select(positives);
+}
+
+std::pair<Rect,double> Detector::scan(const Cascade& cascade, Rect& roi, Frame& im, unsigned int sc)
+{
+    std::vector<const Cascade*> cascades(1, &cascade);
+    return this->scan(cascades, roi, im, sc)[0];
+}
+
+std::vector<std::pair<Rect,double> > Detector::scan(const std::vector<const Cascade*>& cascades, Rect& roi, Frame& im, unsigned int sc)
+{
+    return this->scanModels(cascades, roi, im, sc);
+}
+
+std::vector<std::pair<Rect,double> > Detector::scan(const std::vector<const LbpCascade*>& cascades, Rect& roi, Frame& im, unsigned int sc)
+{
+    return this->scanModels(cascades, roi, im, sc);
+}
+
+template<class Model>
+std::vector<std::pair<Rect,double> > Detector::scanModels(const std::vector<const Model*>& cascades, Rect& roi, Frame& im, unsigned int sc)
+{
+    // Window scale
+    double scale = this->getScale(sc);
+
+    // Define merger
+    Merger merger(this->confidence);
+
+    // Define window to shift
+    Rect refWin(0,0,this->wSize*scale,this->wSize*scale*this->aspect);
+
+    // Shift in pixels (relative to window size)
+    unsigned int pix_shift = std::max(1, static_cast<int>(this->shift*this->wSize*scale));
+
+    // Generate set of shifted windows in roi
+    std::vector<Rect> windows;
+    {
+        TraceSpan span("windows", "scale", sc);
+        windows = generateWindows(roi, refWin);
     }
 
+    // Find positives of every cascade
+    std::vector<std::vector<Rect> > out;
+    {
+        TraceSpan span("cascade", "scale", sc);
+        out = this->step(cascades, windows, im);
+    }
+
+    // Define post-processing
+    TraceSpan span("merge", "scale", sc);
+    std::vector<std::pair<Rect,double> > merged;
+    for (unsigned int m=0; m<cascades.size(); ++m)
+        merged.push_back(merger.apply(roi, out[m], pix_shift));
+
+    return merged;
+}
+
+Rect Detector::select(std::vector<std::pair<Rect,double> >& positives)
+{
+    TraceSpan span("select");
+
     // Sort the representing windows in ascending order of window size (square wins assumed)
     std::sort (positives.begin(), positives.end(), szSorter);
 
@@ -607,27 +1407,134 @@ Rect Detector::apply(Cascade& cascade, Rect& roi, Frame& im)
     return positives.begin()->first;
 }
 
-std::vector<Rect> Detector::step(Cascade& cascade, std::vector<Rect> windows, Frame& im)
+std::vector<Rect> Detector::step(const Cascade& cascade, std::vector<Rect> windows, Frame& im)
 {
     // refer to "An Analisys of the Viola-Jones Face Detection Algorithm", Yi-Qing Wang (Algorithm 7)
     // refer to "Rapid Object detection using Boosted Cascade of Simple Featuer", P. Viola, M. Jones
 
     // Start with all windows
     std::vector<Rect> positives = windows;
+    FD_STAT(std::vector<StageStats> stats(cascade.layer.size());)
 
     // Every layer of the cascade
-    for(std::vector<Stage>::iterator lyr = cascade.layer.begin(); lyr != cascade.layer.end(); ++lyr)
+    for(std::vector<Stage>::const_iterator lyr = cascade.layer.begin(); lyr != cascade.layer.end(); ++lyr)
     {
 
+        if (positives.empty())
+            break;
+
+        // Cost heatmap: windows passing the variance test evaluate every feature of the stage
+        if (this->costMap)
+            for (std::vector<Rect>::iterator win = positives.begin(); win!=positives.end(); ++win)
+                if (im.stdDevOver(*win)>1)
+                    this->costMap->add(*win, lyr->feat.size());
+
         // Get positives for current layer
-        if (!positives.empty())
-            positives = lyr->apply(positives, im);
+#ifdef FD_STATS
+        positives = lyr->apply(positives, im, &stats[lyr - cascade.layer.begin()]);
+#else
+        positives = lyr->apply(positives, im);
+#endif
+    }
+
+#ifdef FD_STATS
+    // Scale index of the windows (all windows of a step have the same size). Statistics describe
+    // the face cascade only
+    if (!windows.empty() && &cascade==&Cascade::frontal())
+    {
+        double ratio = (double)windows[0].getWidth()/this->wSize;
+        unsigned int sc = ratio>1 ? static_cast<unsigned int>(floor(log(ratio)/log(this->scale) + 0.5)) : 0;
+        CascadeStats::add(sc, stats);
     }
+#endif
 
     // Return positive windows
     return positives;
 }
 
+std::vector<std::vector<Rect> > Detector::step(const std::vector<const Cascade*>& cascades, std::vector<Rect>& windows, Frame& im)
+{
+    std::vector<ScaledCascade> scaled;
+    for (unsigned int m=0; m<cascades.size(); ++m)
+        scaled.push_back(ScaledCascade(*cascades[m]));
+
+    return this->step(cascades, scaled, windows, im);
+}
+
+std::vector<std::vector<Rect> > Detector::step(const std::vector<const Cascade*>& cascades, std::vector<ScaledCascade>& scaled, std::vector<Rect>& windows, Frame& im)
+{
+    std::vector<std::vector<Rect> > positives;
+
+    // A single cascade is applied stage by stage over all windows
+    if (cascades.size()==1)
+    {
+        positives.push_back(this->step(*cascades[0], windows, im));
+        return positives;
+    }
+
+    // Several cascades are applied window by window: features are scaled once per window size,
+    // window mean, standard deviation and variance test are computed once, and stage k of every
+    // cascade still accepting the window is evaluated before stage k+1, so a window is dropped at
+    // the earliest stage where all cascades rejected it. Statistics (FD_STATS) are only collected
+    // by single cascade steps
+    positives.resize(cascades.size());
+
+    unsigned int nStages = 0;
+    for (unsigned int m=0; m<cascades.size(); ++m)
+        nStages = std::max(nStages, (unsigned int)cascades[m]->layer.size());
+
+    const float* data = im.getData();
+    const float* tilt = im.getTiltData();
+    std::vector<bool> alive(cascades.size());
+    for (std::vector<Rect>::iterator win = windows.begin(); win!=windows.end(); ++win)
+    {
+        double winStdDev = im.stdDevOver(*win);
+        if (winStdDev<=1)
+            continue;
+
+        double winMean = im.sumOver(*win)/win->area();
+        unsigned int origin = win->getX() + win->getY()*im.getWidth();
+
+        alive.assign(cascades.size(), true);
+        unsigned int nAlive = cascades.size();
+        for (unsigned int s=0; s<nStages && nAlive>0; ++s)
+        {
+            for (unsigned int m=0; m<cascades.size(); ++m)
+            {
+                // Rejected, or accepted by all its stages
+                if (!alive[m] || s>=cascades[m]->layer.size())
+                    continue;
+
+                scaled[m].scaleTo(win->getWidth(), win->getHeight(), im.getWidth());
+                if (this->costMap)
+                    this->costMap->add(*win, scaled[m].getFeatures(s));
+
+                if (!scaled[m].passes(s, data, tilt, origin, winMean, winStdDev))
+                {
+                    alive[m] = false;
+                    nAlive--;
+                }
+            }
+        }
+
+        for (unsigned int m=0; m<cascades.size(); ++m)
+            if (alive[m])
+                positives[m].push_back(*win);
+    }
+
+    return positives;
+}
+
+double Detector::getScale(unsigned int sc)
+{
+    // Repeated product, as scales were originally accumulated
+    double scale = 1;
+    for (unsigned int i=0; i<sc; ++i)
+        scale = scale*this->scale;
+
+    return scale;
+}
+
 std::vector<Rect> Detector::generateWindows(Rect& roi, Rect& win)
 {
    std::vector<Rect> windows;
@@ -641,6 +1548,8 @@ std::vector<Rect> Detector::generateWindows(Rect& roi, Rect& win)
        // Shift in pixels (relative to window size)
        double deltaX = static_cast<int>(this->shift*win.getWidth());
        double deltaY = static_cast<int>(this->shift*win.getHeight());
+       deltaX = std::max(deltaX, 1.0);
+       deltaY = std::max(deltaY, 1.0);
 
        while(win.getY()+win.getHeight()<roi.getY()+roi.getHeight())
        {
@@ -658,7 +1567,7 @@ std::vector<Rect> Detector::generateWindows(Rect& roi, Rect& win)
    return windows;
 }
 
-Cascade::Cascade(std::string& path2File)
+Cascade::Cascade(std::string& path2File): tilted(false)
 {
     std::vector<Stage> cascade;
 
@@ -666,6 +1575,8 @@ Cascade::Cascade(std::string& path2File)
     std::ifstream infile;
 
     infile.open(path2File);
+    if (!infile)
+        return;
 
     unsigned int ln = 0;
 
@@ -676,6 +1587,10 @@ Cascade::Cascade(std::string& path2File)
 
     while (std::getline(infile, sLine))
     {
+        // Other formats (e.g. LBP cascades) start with a tag instead of the reference size
+        if (ln==0 && (sLine.empty() || !isdigit((unsigned char)sLine[0])))
+            return;
+
         std::vector<double> params = split(sLine, ' ');
 
         if(ln>0)
@@ -694,9 +1609,14 @@ Cascade::Cascade(std::string& path2File)
 
             //std::transform(tokens.begin(), tokens.end(), params.begin(), std::stod);
 
+            // Tilted features end with an extra 1 (see utils/xml_parser.py)
+            bool tiltedFeature = params.size()>5 && (params.size() - 5)%5==1 && params.back()!=0;
+            unsigned int nParams = (params.size() - 5)%5==1 ? params.size() - 1 : params.size();
+            this->tilted = this->tilted || tiltedFeature;
+
             // Load rectangles
             std::vector<std::pair<Rect,double> > rects;
-            for (unsigned int i=5;i<params.size();i+=5)
+            for (unsigned int i=5;i+4<nParams;i+=5)
             {
                 Rect r(params[i],params[i+1], params[i+2], params[i+3]);
 
@@ -705,8 +1625,8 @@ Cascade::Cascade(std::string& path2File)
             }
 
             // Load feature
-            std::pair<unsigned int, unsigned int> refSize (this->sizeW, this->sizeW);
-            Feature f(rects, params[2], params[3], params[4], refSize);
+            std::pair<unsigned int, unsigned int> refSize (this->sizeW, this->sizeH);
+            Feature f(rects, params[2], params[3], params[4], refSize, tiltedFeature);
             features.push_back(f);
 
             // Load stage threshold
@@ -723,12 +1643,14 @@ Cascade::Cascade(std::string& path2File)
     }
 
     // Load last stage into cascade
-    Stage stage(features,stageT);
-    this->layer.push_back(stage);
-
+    if (!features.empty())
+    {
+        Stage stage(features,stageT);
+        this->layer.push_back(stage);
+    }
 }
 
-Cascade::Cascade(const int W, const int H, double data[2912][20])
+Cascade::Cascade(const int W, const int H, double data[2912][20]): tilted(false)
 {
     std::vector<Stage> cascade;
 
@@ -742,7 +1664,7 @@ Cascade::Cascade(const int W, const int H, double data[2912][20])
     this->sizeH = H;
 
     // Load cascade
-    for(unsigned int i = 0; i<=2912; ++i)
+    for(unsigned int i = 0; i<2912; ++i)
     {
         // New stage
         if (data[i][0]==(currentStage+1))
@@ -770,7 +1692,7 @@ Cascade::Cascade(const int W, const int H, double data[2912][20])
         }
 
         // Load feature
-        std::pair<unsigned int, unsigned int> refSize (this->sizeW, this->sizeW);
+        std::pair<unsigned int, unsigned int> refSize (this->sizeW, this->sizeH);
         Feature f(rects, data[i][2], data[i][3], data[i][4], refSize);
         features.push_back(f);
 
@@ -783,6 +1705,70 @@ Cascade::Cascade(const int W, const int H, double data[2912][20])
     this->layer.push_back(stage);
 }
 
+const Cascade& Cascade::frontal()
+{
+    // Built once, on first use (thread-safe initialization)
+    static const Cascade shared(HAAR_WIDTH, HAAR_HEIGHT, haar_data1);
+    return shared;
+}
+
+const Cascade* Cascade::fromFile(const std::string& path, bool mirrored)
+{
+    // Loaded cascades (by file and orientation), kept until exit
+    static std::map<std::pair<std::string, bool>, Cascade*> loaded;
+#if CASCADE_THREADS
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+
+    std::pair<std::string, bool> key(path, mirrored);
+    std::map<std::pair<std::string, bool>, Cascade*>::iterator it = loaded.find(key);
+    if (it!=loaded.end())
+        return it->second;
+
+    std::string file = path;
+    Cascade* cascade = new Cascade(file);
+    if (cascade->layer.empty() || cascade->sizeW==0 || cascade->sizeH==0)
+    {
+        delete cascade;
+        return 0;
+    }
+
+    if (mirrored)
+    {
+        Cascade* flipped = new Cascade(cascade->mirror());
+        delete cascade;
+        cascade = flipped;
+    }
+
+    loaded[key] = cascade;
+    return cascade;
+}
+
+/** Cascade::mirror
+  * Cascade of the horizontally mirrored object: every feature rect is reflected within the
+  * reference window once, here, so the mirrored model is evaluated as any other (e.g. in the
+  * same pass as the original one, sharing the window mean and standard deviation)
+  **/
+Cascade Cascade::mirror() const
+{
+    Cascade mirrored;
+    mirrored.sizeW = this->sizeW;
+    mirrored.sizeH = this->sizeH;
+    mirrored.tilted = this->tilted;
+
+    for (std::vector<Stage>::const_iterator lyr = this->layer.begin(); lyr!=this->layer.end(); ++lyr)
+    {
+        std::vector<Feature> features;
+        for (std::vector<Feature>::const_iterator f = lyr->feat.begin(); f!=lyr->feat.end(); ++f)
+            features.push_back(f->mirror());
+
+        mirrored.layer.push_back(Stage(features, lyr->T));
+    }
+
+    return mirrored;
+}
+
 std::vector<double> split(std::string str, char delimiter)
 {
   std::vector<double> out;
@@ -0,0 +1,60 @@
+'''
+    Convert a ccv BBF cascade (bin/js/face.js, the cascade object read by ccv.js) to the binary
+    format of BbfCascade (inc/bbf.h), little endian:
+
+        char[4] "FDBB", int32 version, width, height, stages
+        per stage: int32 features, float64 threshold
+        per feature: int32 size, int32 px[size], py[size], pz[size], nx[size], ny[size], nz[size],
+                     float64 alpha[2]
+
+    Camface.bbfCascadeData (camface.js) writes the same bytes in the browser.
+
+        python3 bbf_parser.py ../bin/js/face.js [--out face.bbf]
+'''
+
+import argparse
+import json
+import struct
+
+MAGIC = b'FDBB'
+VERSION = 1
+
+
+def read_cascade(path):
+    ''' Cascade object of a JavaScript file assigning it (var cascade = {...};) or of plain JSON '''
+    with open(path) as f:
+        text = f.read()
+    return json.loads(text[text.index('{'):text.rindex('}') + 1])
+
+
+def write_cascade(path, cascade):
+    stages = cascade['stage_classifier']
+    with open(path, 'wb') as f:
+        f.write(MAGIC)
+        f.write(struct.pack('<4i', VERSION, cascade['width'], cascade['height'], len(stages)))
+        for stage in stages:
+            features = stage['orig_feature']
+            f.write(struct.pack('<id', len(features), stage['threshold']))
+            for k, feature in enumerate(features):
+                size = feature['size']
+                f.write(struct.pack('<i', size))
+                for key in ('px', 'py', 'pz', 'nx', 'ny', 'nz'):
+                    f.write(struct.pack('<%di' % size, *feature[key][:size]))
+                f.write(struct.pack('<2d', *stage['alpha'][2 * k:2 * k + 2]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a ccv BBF cascade for BbfCascade')
+    parser.add_argument('cascade', help='face.js or JSON cascade')
+    parser.add_argument('--out', help='output file (default: cascade name with .bbf)')
+    args = parser.parse_args()
+
+    cascade = read_cascade(args.cascade)
+    out = args.out or args.cascade.rsplit('.', 1)[0] + '.bbf'
+    write_cascade(out, cascade)
+    print('%s: %d stages, %d features' % (out, len(cascade['stage_classifier']),
+                                           sum(len(s['orig_feature']) for s in cascade['stage_classifier'])))
+
+
+if __name__ == '__main__':
+    main()
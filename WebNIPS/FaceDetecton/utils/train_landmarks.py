@@ -0,0 +1,295 @@
+'''
+    Train an ensemble of regression trees landmark model for LandmarkModel (inc/landmarks.h)
+
+    Input is a list file with one face per line:
+
+        image.ppm [x y w h]
+
+    where the box is the face found by the detector (e.g. facedetect output), or the landmark
+    bounding box if omitted. Landmarks are read from the image path with a .pts extension
+    (iBUG 300-W format). Images are binary PGM/PPM, or anything PIL reads if it is installed.
+    Pixels are sampled as LandmarkDetector::predict does: grey (r+g+b)/3, nearest pixel, 0 outside
+    the image, positions moved with the shape by the mean-to-current similarity transform.
+
+    Every cascade level samples its pixels around the mean shape (each anchored to the nearest
+    landmark) and fits trees by gradient boosting: every split is the best of a few random pixel
+    pairs (closer pairs preferred) and thresholds, leaves hold the shrunk mean residual.
+
+        python3 train_landmarks.py faces.txt [--cascades 10] [--trees 500] [--depth 4]
+                                             [--pixels 400] [--out landmarks.bin]
+
+    Requires numpy.
+'''
+
+import argparse
+import os
+import numpy as np
+
+MAGIC = b'FDLM'
+VERSION = 1
+SPLIT = np.dtype([('pixel1', '<u2'), ('pixel2', '<u2'), ('threshold', '<f4')])
+
+
+# ***************************************************************
+# ** DATA
+# ***************************************************************
+
+def read_pnm(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    # Header: magic, width, height, maxval (comments allowed)
+    fields, pos = [], 0
+    while len(fields) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b'#':
+            pos = data.index(b'\n', pos)
+            continue
+        end = pos
+        while not data[end:end + 1].isspace():
+            end += 1
+        fields.append(data[pos:end])
+        pos = end
+    pos += 1
+
+    w, h = int(fields[1]), int(fields[2])
+    channels = 3 if fields[0] == b'P6' else 1
+    pixels = np.frombuffer(data, dtype=np.uint8, count=w * h * channels, offset=pos)
+    return pixels.reshape(h, w, channels)
+
+
+def read_grey(path):
+    ''' Grey image as the detector sees it: (r+g+b)/3 '''
+    if path.lower().endswith(('.pgm', '.ppm', '.pnm')):
+        im = read_pnm(path)
+    else:
+        from PIL import Image
+        im = np.asarray(Image.open(path).convert('RGB'))
+    if im.ndim == 2 or im.shape[2] == 1:
+        return im.reshape(im.shape[0], im.shape[1]).astype(np.int32)
+    return im[:, :, :3].astype(np.int32).sum(axis=2) // 3
+
+
+def read_pts(path):
+    with open(path) as f:
+        text = f.read()
+    body = text[text.index('{') + 1:text.index('}')]
+    return np.array(body.split(), dtype=np.float64).reshape(-1, 2)
+
+
+def load(list_path):
+    images, boxes, shapes = [], [], []
+    root = os.path.dirname(list_path)
+    with open(list_path) as f:
+        for line in f:
+            fields = line.split()
+            if not fields or fields[0].startswith('#'):
+                continue
+            path = os.path.join(root, fields[0])
+            points = read_pts(os.path.splitext(path)[0] + '.pts')
+            if len(fields) >= 5:
+                box = np.array([float(v) for v in fields[1:5]])
+            else:
+                lo, hi = points.min(axis=0), points.max(axis=0)
+                box = np.array([lo[0], lo[1], hi[0] - lo[0], hi[1] - lo[1]])
+
+            images.append(read_grey(path))
+            boxes.append(box)
+            shapes.append((points - box[:2]) / box[2:])
+    return images, np.array(boxes), np.array(shapes)
+
+
+# ***************************************************************
+# ** MODEL
+# ***************************************************************
+
+def similarity(mean, shapes):
+    ''' Scale/rotation (a, b) of [a -b; b a] mapping the centered mean shape onto every shape '''
+    m = mean - mean.mean(axis=0)
+    s = shapes - shapes.mean(axis=1, keepdims=True)
+    norm = (m ** 2).sum()
+    a = (m[None, :, 0] * s[..., 0] + m[None, :, 1] * s[..., 1]).sum(axis=1) / norm
+    b = (m[None, :, 0] * s[..., 1] - m[None, :, 1] * s[..., 0]).sum(axis=1) / norm
+    return a, b
+
+
+def sample_pixels(images, boxes, owner, mean, shapes, anchor, offset):
+    ''' Intensities (n x P) of the pixels of a cascade level for every shape '''
+    a, b = similarity(mean, shapes)
+    dx, dy = offset[:, 0], offset[:, 1]
+    u = shapes[:, anchor, 0] + a[:, None] * dx - b[:, None] * dy
+    v = shapes[:, anchor, 1] + b[:, None] * dx + a[:, None] * dy
+    x = np.floor(boxes[owner, 0, None] + u * boxes[owner, 2, None] + 0.5).astype(np.int64)
+    y = np.floor(boxes[owner, 1, None] + v * boxes[owner, 3, None] + 0.5).astype(np.int64)
+
+    values = np.zeros(x.shape)
+    for i in np.unique(owner):
+        rows = owner == i
+        im = images[i]
+        xi, yi = x[rows], y[rows]
+        inside = (xi >= 0) & (xi < im.shape[1]) & (yi >= 0) & (yi < im.shape[0])
+        vi = np.zeros(xi.shape)
+        vi[inside] = im[yi[inside], xi[inside]]
+        values[rows] = vi
+    return values
+
+
+def fit_tree(intensity, residual, positions, args, rng):
+    ''' Fit one tree to the residuals. Return (splits, leaves, leaf of every shape) '''
+    n_splits = 2 ** args.depth - 1
+    n_pixels = positions.shape[0]
+    node = np.zeros(intensity.shape[0], dtype=np.int64)
+    splits = np.zeros(n_splits, dtype=SPLIT)
+
+    for k in range(n_splits):
+        rows = np.nonzero(node == k)[0]
+
+        # Candidate pairs, accepted with probability exp(-distance/lambda)
+        pairs = []
+        while len(pairs) < args.candidates:
+            p1, p2 = rng.integers(n_pixels, size=2)
+            dist = np.linalg.norm(positions[p1] - positions[p2])
+            if p1 != p2 and rng.random() < np.exp(-dist / args.lam):
+                pairs.append((p1, p2))
+        pairs = np.array(pairs)
+        thresholds = (rng.random(args.candidates) * 256 - 128) / 2
+
+        if len(rows) > 0:
+            diff = intensity[rows][:, pairs[:, 0]] - intensity[rows][:, pairs[:, 1]]
+            left = diff > thresholds[None, :]
+            res = residual[rows]
+            total = res.sum(axis=0)
+            n_left = left.sum(axis=0)
+            sum_left = left.T.astype(np.float64) @ res
+            sum_right = total[None, :] - sum_left
+            score = ((sum_left ** 2).sum(axis=1) / np.maximum(n_left, 1) +
+                     (sum_right ** 2).sum(axis=1) / np.maximum(len(rows) - n_left, 1))
+            best = int(np.argmax(score))
+            go_left = left[:, best]
+        else:
+            best = 0
+            go_left = np.zeros(0, dtype=bool)
+
+        splits[k] = (pairs[best, 0], pairs[best, 1], thresholds[best])
+        node[rows[go_left]] = 2 * k + 1
+        node[rows[~go_left]] = 2 * k + 2
+
+    leaf = node - n_splits
+    leaves = np.zeros((n_splits + 1, residual.shape[1]))
+    for l in range(n_splits + 1):
+        rows = leaf == l
+        if rows.any():
+            leaves[l] = args.nu * residual[rows].mean(axis=0)
+    return splits, leaves, leaf
+
+
+def train(images, boxes, targets, args, rng):
+    n_faces, n_landmarks = targets.shape[:2]
+    mean = targets.mean(axis=0)
+
+    # Initial shapes: mean shape, then other training shapes
+    owner = np.repeat(np.arange(n_faces), args.oversampling)
+    shapes = np.repeat(mean[None], len(owner), axis=0)
+    for i in range(len(owner)):
+        if i % args.oversampling:
+            shapes[i] = targets[rng.integers(n_faces)]
+
+    lo, hi = mean.min(axis=0), mean.max(axis=0)
+    pad = 0.1 * (hi - lo)
+    model = {'mean': mean, 'anchor': [], 'offset': [], 'splits': [], 'leaves': []}
+
+    for c in range(args.cascades):
+        # Pixels of this level around the mean shape, anchored to the nearest landmark
+        positions = lo - pad + rng.random((args.pixels, 2)) * (hi - lo + 2 * pad)
+        anchor = np.argmin(((positions[:, None] - mean[None]) ** 2).sum(axis=2), axis=1)
+        offset = positions - mean[anchor]
+
+        intensity = sample_pixels(images, boxes, owner, mean, shapes, anchor, offset)
+        residual = (targets[owner] - shapes).reshape(len(owner), -1)
+
+        for t in range(args.trees):
+            splits, leaves, leaf = fit_tree(intensity, residual, positions, args, rng)
+            residual -= leaves[leaf]
+            model['splits'].append(splits)
+            model['leaves'].append(leaves)
+
+        shapes = targets[owner] - residual.reshape(len(owner), n_landmarks, 2)
+        model['anchor'].append(anchor)
+        model['offset'].append(offset)
+        print('cascade %d: mean error %.4f (box widths)' % (c, error(shapes, targets[owner])))
+
+    return model
+
+
+def predict(model, args, images, boxes):
+    ''' Normalized shapes of every face, as LandmarkDetector::predict '''
+    mean = model['mean']
+    owner = np.arange(len(images))
+    shapes = np.repeat(mean[None], len(images), axis=0)
+    n_splits = 2 ** args.depth - 1
+    for c in range(args.cascades):
+        intensity = sample_pixels(images, boxes, owner, mean, shapes, model['anchor'][c], model['offset'][c])
+        flat = shapes.reshape(len(images), -1)
+        for t in range(args.trees):
+            splits = model['splits'][c * args.trees + t]
+            node = np.zeros(len(images), dtype=np.int64)
+            for _ in range(args.depth):
+                s = splits[node]
+                left = intensity[owner, s['pixel1']] - intensity[owner, s['pixel2']] > s['threshold']
+                node = 2 * node + np.where(left, 1, 2)
+            flat = flat + model['leaves'][c * args.trees + t][node - n_splits]
+        shapes = flat.reshape(shapes.shape)
+    return shapes
+
+
+def error(shapes, targets):
+    return np.linalg.norm(shapes - targets, axis=2).mean()
+
+
+def write_model(path, model, args):
+    n_landmarks = model['mean'].shape[0]
+    with open(path, 'wb') as f:
+        f.write(MAGIC)
+        np.array([VERSION, n_landmarks, args.cascades, args.trees, args.depth, args.pixels], dtype='<i4').tofile(f)
+        model['mean'].astype('<f4').tofile(f)
+        np.array(model['anchor']).astype('<u2').tofile(f)
+        np.array(model['offset']).astype('<f4').tofile(f)
+        np.concatenate(model['splits']).tofile(f)
+        np.array(model['leaves']).astype('<f4').tofile(f)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Train an ensemble of regression trees landmark model')
+    parser.add_argument('list')
+    parser.add_argument('--cascades', type=int, default=10)
+    parser.add_argument('--trees', type=int, default=500)
+    parser.add_argument('--depth', type=int, default=4)
+    parser.add_argument('--pixels', type=int, default=400)
+    parser.add_argument('--nu', type=float, default=0.1, help='shrinkage')
+    parser.add_argument('--lam', type=float, default=0.1, help='pixel pair distance prior (box widths)')
+    parser.add_argument('--candidates', type=int, default=20, help='random splits tried per node')
+    parser.add_argument('--oversampling', type=int, default=20, help='initial shapes per face')
+    parser.add_argument('--test', type=float, default=0.1, help='fraction of faces held out')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--out', default='landmarks.bin')
+    args = parser.parse_args()
+
+    rng = np.random.default_rng(args.seed)
+    images, boxes, shapes = load(args.list)
+    order = rng.permutation(len(images))
+    n_test = int(args.test * len(images))
+    test, train_set = order[:n_test], order[n_test:]
+    print('%d faces (%d held out), %d landmarks' % (len(images), n_test, shapes.shape[1]))
+
+    model = train([images[i] for i in train_set], boxes[train_set], shapes[train_set], args, rng)
+    if n_test:
+        predicted = predict(model, args, [images[i] for i in test], boxes[test])
+        print('held out mean error %.4f (box widths)' % error(predicted, shapes[test]))
+
+    write_model(args.out, model, args)
+    print('wrote %s' % args.out)
+
+
+if __name__ == '__main__':
+    main()
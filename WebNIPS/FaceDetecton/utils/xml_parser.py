@@ -1,15 +1,37 @@
+import argparse
+import sys
 import xml.dom.minidom
 
 
 '''
-    Parse xml doc and print into .txt file.
-    Each line in the format <StageNumber, StageT, T, lVal, rVal,
-                             rect_k[0], rect_k[1], rect_k[2], rect_k[3], rect_k[4]>
-'''
+    Convert an OpenCV Haar or LBP cascade (XML) for the detector.
+
+    Both OpenCV layouts are read: the old one (<trees> of stumps holding their features) and the
+    opencv_traincascade one (<weakClassifiers> indexing a <features> list). Output is either the
+    text format read by Cascade::fromFile (e.g. eye or mouth cascades searched inside the face by
+    ViolaJones::detectParts), one line per feature after the reference window size
+
+        W H
+        StageNumber StageT T lVal rVal x y w h weight [x y w h weight ...] [1]
+
+    where a trailing 1 marks a tilted feature (45 degree rotated rects of Lienhart's extended set:
+    top corner at x, y, width along the down right diagonal and height along the down left one),
+    or a C header holding a haar_data1 array in the layout of haar.h (3 upright rects per feature).
+
+    LBP cascades (opencv_traincascade -featureType LBP, read by LbpCascade::fromFile) are written
+    as text only, one line per weak classifier
+
+        lbp W H
+        StageNumber StageT x y w h lVal rVal subset0 ... subset7
 
-cascade_filename = "haarcascade_frontalface_default"
-path2Source = "/Users/cipriancorneanu/Research/QtProjects/QtNeurochild/QtNeurochildTest/" + cascade_filename + ".xml"
-output_filename = "haar.h"
+    where x y w h is the top left block of the 3x3 grid and the 8 subset words (int32) are the
+    256-bit mask of the LBP codes giving lVal.
+
+        python3 xml_parser.py haarcascade_eye.xml [--out eye.txt] [--format txt|h]
+        python3 xml_parser.py --test                (embedded profile face sample)
+
+    Only stump trees are supported.
+'''
 
 testSource = """\
 <opencv_storage>
@@ -126,107 +148,172 @@ def getText(nodelist):
     for node in nodelist:
         if node.nodeType == node.TEXT_NODE:
             rc.append(node.data)
-    return ''.join(rc)
-
-
-def parseFile(storage):
-    # Create empty file
-    open('cascade.h', 'w').close()
+    return ''.join(rc).strip()
 
-    # Header
-    with open(output_filename, "a") as file:
-        file.write('#ifndef CASCADE' + '\n')
-        file.write('#define CASCADE' + '\n\n')
-
-    cascade = storage.getElementsByTagName(cascade_filename)
 
-    for node in cascade:
-        size = node.getElementsByTagName("size")[0]
+def children(node, tag=None):
+    return [c for c in node.childNodes
+            if c.nodeType == c.ELEMENT_NODE and (tag is None or c.tagName == tag)]
 
-        with open(output_filename, "a") as file:
-            sizeString = getText(size.childNodes)
-            tokens = sizeString.split(' ')
-            file.write('const int HAAR_WIDTH = ' + tokens[0] + ';\n')
-            file.write('const int HAAR_HEIGHT = ' + tokens[1] + ';\n\n')
 
-            file.write('double haar_data1[][20] = { ')
-
-        stages = node.getElementsByTagName("stages")
-        handleStages(stages, "")
-
-    # Footer
-    with open(output_filename, "a") as file:
-        file.write('};' + '\n' + '#endif' + '\n')
+def child(node, tag):
+    found = children(node, tag)
+    if not found:
+        raise ValueError('missing <%s>' % tag)
+    return found[0]
 
 
-def handleStages(stages, paramStage):
-    n = 0
+def handleFeature(feature):
+    ''' Feature rects as a flat token list (x y w h weight ... [1 if tilted]) '''
+    tokens = []
+    for r in children(child(feature, 'rects'), '_'):
+        tokens += getText(r.childNodes).split()
 
-    for stage in stages:
-        stageParts = stage.childNodes
+    tilted = children(feature, 'tilted')
+    if tilted and getText(tilted[0].childNodes) not in ('', '0'):
+        tokens.append('1')
+    return tokens
 
 
-        for stagePart in stageParts:
-            print n
+def isTilted(line):
+    return (len(line) - 5) % 5 == 1
 
-            if stagePart.nodeType == stagePart.ELEMENT_NODE:
-                sT = stagePart.getElementsByTagName("stage_threshold")
 
-                # Handle stage
-                paramStage = `n` + ', ' + getText(sT[0].childNodes) + ', '
-                handleStage(stagePart, paramStage)
-                n = n + 1
+def handleOldCascade(node):
+    ''' <size>, <stages> of <trees> whose nodes hold their feature '''
+    width, height = getText(child(node, 'size').childNodes).split()
+    lines = []
+    for n, stage in enumerate(children(child(node, 'stages'), '_')):
+        stageT = getText(child(stage, 'stage_threshold').childNodes)
+        for tree in children(child(stage, 'trees'), '_'):
+            nodes = children(tree, '_')
+            if len(nodes) != 1 or not children(nodes[0], 'left_val') or not children(nodes[0], 'right_val'):
+                raise ValueError('stage %d: only stump trees are supported' % n)
 
+            root = nodes[0]
+            lines.append([str(n), stageT, getText(child(root, 'threshold').childNodes),
+                          getText(child(root, 'left_val').childNodes), getText(child(root, 'right_val').childNodes)] +
+                         handleFeature(child(root, 'feature')))
+    return width, height, lines
 
-def handleStage(stage, paramStage):
-    trees = stage.getElementsByTagName("trees")
-    handleTrees(trees, paramStage)
 
+def handleLbpCascade(node):
+    ''' LBP <width>, <height>, <stages> of categorical stumps indexing <features> of one <rect> '''
+    width = getText(child(node, 'width').childNodes)
+    height = getText(child(node, 'height').childNodes)
+    features = [getText(child(f, 'rect').childNodes).split() for f in children(child(node, 'features'), '_')]
 
-def handleTrees(trees, paramStage):
-    for tree in trees:
-        paramTree = handleTree(tree, paramStage)
+    lines = []
+    for n, stage in enumerate(children(child(node, 'stages'), '_')):
+        stageT = getText(child(stage, 'stageThreshold').childNodes)
+        for weak in children(child(stage, 'weakClassifiers'), '_'):
+            internal = getText(child(weak, 'internalNodes').childNodes).split()
+            leaves = getText(child(weak, 'leafValues').childNodes).split()
+            if len(internal) != 11 or len(leaves) != 2:
+                raise ValueError('stage %d: only stump trees are supported' % n)
 
+            lines.append([str(n), stageT] + features[int(internal[2])] + leaves + internal[3:])
+    return width, height, lines
 
-def handleTree(tree, paramStage):
-    features = tree.getElementsByTagName("feature")
-    thresholds = tree.getElementsByTagName("threshold")
-    lValues = tree.getElementsByTagName("left_val")
-    rValues = tree.getElementsByTagName("right_val")
 
-    for f, t, lV, rV in zip(features, thresholds, lValues, rValues):
-        paramFeature = handleFeature(f)
+def handleNewCascade(node):
+    ''' <width>, <height>, <stages> of <weakClassifiers> indexing <features> '''
+    if children(node, 'featureType') and getText(child(node, 'featureType').childNodes) != 'HAAR':
+        raise ValueError('only HAAR and LBP cascades are supported')
 
-        paramTree = getText(t.childNodes) + ', ' + getText(lV.childNodes) + ', ' + getText(rV.childNodes) + ', '
+    width = getText(child(node, 'width').childNodes)
+    height = getText(child(node, 'height').childNodes)
+    features = [handleFeature(f) for f in children(child(node, 'features'), '_')]
 
-        # Print line to file
-        with open(output_filename, "a") as file:
-            file.write('{' + paramStage + paramTree + paramFeature + '},' + '\n')
+    lines = []
+    for n, stage in enumerate(children(child(node, 'stages'), '_')):
+        stageT = getText(child(stage, 'stageThreshold').childNodes)
+        for weak in children(child(stage, 'weakClassifiers'), '_'):
+            internal = getText(child(weak, 'internalNodes').childNodes).split()
+            leaves = getText(child(weak, 'leafValues').childNodes).split()
+            if len(internal) != 4 or len(leaves) != 2:
+                raise ValueError('stage %d: only stump trees are supported' % n)
 
+            lines.append([str(n), stageT, internal[3], leaves[0], leaves[1]] + features[int(internal[2])])
+    return width, height, lines
 
-def handleFeature(feature):
-    rects = feature.getElementsByTagName("rects")
 
-    for rect in rects:
-        rs = rect.getElementsByTagName("_")
+def isLbp(storage):
+    root = children(storage.documentElement)[0]
+    return bool(children(root, 'featureType')) and getText(child(root, 'featureType').childNodes) == 'LBP'
 
-        rect_str = ""
-        for r in rs:
-            # Print rectangles
-            rect_str += getText(r.childNodes) + ' '
 
-    rect_str = rect_str[:-1].replace(' ', ', ')
-    tokens = rect_str.split(', ')
+def parseFile(storage):
+    ''' Reference size and feature lines of the cascade in an opencv_storage document '''
+    root = children(storage.documentElement)[0]
+    if isLbp(storage):
+        return handleLbpCascade(root)
+    if children(root, 'stages') and children(root, 'features'):
+        return handleNewCascade(root)
+    return handleOldCascade(root)
 
-    if len(tokens)==10:
-        rect_str = rect_str + ', 0, 0, 0, 0, 0'
 
-    return " " + rect_str
+def writeText(path, width, height, lines, lbp=False):
+    with open(path, 'w') as file:
+        file.write(('lbp ' if lbp else '') + width + ' ' + height + '\n')
+        for line in lines:
+            file.write(' '.join(line) + '\n')
 
 
-# Define source
-#source = xml.dom.minidom.parseString(testSource)
-source = xml.dom.minidom.parse(path2Source)
+def writeHeader(path, width, height, lines):
+    with open(path, 'w') as file:
+        file.write('#ifndef CASCADE' + '\n')
+        file.write('#define CASCADE' + '\n\n')
+        file.write('const int HAAR_WIDTH = ' + width + ';\n')
+        file.write('const int HAAR_HEIGHT = ' + height + ';\n\n')
+        file.write('double haar_data1[][20] = { ')
+        for line in lines:
+            if isTilted(line):
+                raise ValueError('tilted features need the txt format')
+            if len(line) > 20:
+                raise ValueError('more than 3 rects in a feature')
+            values = line + ['0'] * (20 - len(line))
+            file.write('{' + ', '.join(values) + '},' + '\n')
+        file.write('};' + '\n' + '#endif' + '\n')
 
 
-parseFile(source)
+def main():
+    parser = argparse.ArgumentParser(description='Convert an OpenCV Haar or LBP cascade for the detector')
+    parser.add_argument('xml', nargs='?')
+    parser.add_argument('--out', help='output file (default: cascade name with .txt or .h)')
+    parser.add_argument('--format', choices=['txt', 'h'], default='txt')
+    parser.add_argument('--test', action='store_true', help='convert the embedded profile face sample')
+    args = parser.parse_args()
+
+    if args.test:
+        source = xml.dom.minidom.parseString(testSource)
+        name = 'test'
+    elif args.xml:
+        source = xml.dom.minidom.parse(args.xml)
+        name = args.xml.rsplit('.', 1)[0]
+    else:
+        parser.error('no cascade given')
+
+    out = args.out or name + '.' + args.format
+    lbp = isLbp(source)
+    try:
+        width, height, lines = parseFile(source)
+        if args.format == 'txt':
+            writeText(out, width, height, lines, lbp)
+        elif lbp:
+            raise ValueError('LBP cascades need the txt format')
+        else:
+            writeHeader(out, width, height, lines)
+    except ValueError as e:
+        sys.exit('xml_parser: ' + str(e))
+
+    if lbp:
+        print('%s: LBP %sx%s, %s stages, %d features' % (out, width, height, int(lines[-1][0]) + 1 if lines else 0, len(lines)))
+        return
+
+    print('%s: %sx%s, %s stages, %d features (%d tilted)' % (out, width, height, int(lines[-1][0]) + 1 if lines else 0,
+                                                          len(lines), sum(isTilted(line) for line in lines)))
+
+
+if __name__ == '__main__':
+    main()
@@ -113,7 +113,8 @@ function serveStatic(response, pathname) {
             'wav': 'audio/wav',
             'ogg': 'audio/ogg',
             'gif': 'image/gif',
-            'css': 'text/css'
+            'css': 'text/css',
+            'wasm': 'application/wasm'
         };
 
     response.writeHead(200, {